@@ -1,6 +1,7 @@
 #include "address.h"
 #include "sylar/endian.h"
 #include "sylar/log.h"
+#include "sylar/offload.h"
 #include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
@@ -106,7 +107,7 @@ bool Address::LookUp( std::vector<SPtr>& result, const std::string& host, int fa
   }
 
   addrinfo* results;
-  int error = getaddrinfo( node.c_str(), service, &hints, &results );
+  int error = sylar::offload( [&]() { return getaddrinfo( node.c_str(), service, &hints, &results ); } );
   if ( error ) {
     SYLAR_LOG_ERROR( g_logger ) << "Address::Lookup getaddress(" << host << ", " << family << ", " << type
                                 << ") err=" << error << " errstr = " << strerror( errno );
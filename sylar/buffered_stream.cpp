@@ -0,0 +1,224 @@
+#include "sylar/buffered_stream.h"
+#include "sylar/config.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace sylar {
+
+static ConfigVar<uint32_t>::SPtr g_buffered_stream_read_buffer = Config::Lookup(
+  "buffered_stream.read_buffer", (uint32_t)( 16 * 1024 ), "BufferedStream read-ahead buffer size" );
+
+static ConfigVar<uint32_t>::SPtr g_buffered_stream_write_buffer = Config::Lookup(
+  "buffered_stream.write_buffer", (uint32_t)( 16 * 1024 ), "BufferedStream write coalescing buffer size" );
+
+BufferedStream::BufferedStream( Stream::SPtr stream, size_t read_buffer, size_t write_buffer )
+  : m_stream { stream }
+  , m_readBuf( read_buffer ? read_buffer : g_buffered_stream_read_buffer->getValue() )
+  , m_readPos { 0 }
+  , m_readEnd { 0 }
+  , m_writeBuf( write_buffer ? write_buffer : g_buffered_stream_write_buffer->getValue() )
+  , m_writeLen { 0 }
+{}
+
+int BufferedStream::read( void* buffer, size_t length )
+{
+  if ( m_readPos == m_readEnd ) {
+    if ( length >= m_readBuf.size() ) {
+      return flush() ? -1 : m_stream->read( buffer, length );
+    }
+    int ret = fill();
+    if ( ret <= 0 ) {
+      return ret;
+    }
+  }
+
+  size_t len { std::min( length, getReadBuffered() ) };
+  std::memcpy( buffer, &m_readBuf[m_readPos], len );
+  m_readPos += len;
+  return len;
+}
+
+int BufferedStream::read( ByteArray::SPtr ba, size_t length )
+{
+  if ( m_readPos == m_readEnd ) {
+    if ( length >= m_readBuf.size() ) {
+      return flush() ? -1 : m_stream->read( ba, length );
+    }
+    int ret = fill();
+    if ( ret <= 0 ) {
+      return ret;
+    }
+  }
+
+  size_t len { std::min( length, getReadBuffered() ) };
+  ba->write( &m_readBuf[m_readPos], len );
+  m_readPos += len;
+  return len;
+}
+
+int BufferedStream::peek( void* buffer, size_t length )
+{
+  if ( m_readPos == m_readEnd ) {
+    int ret = fill();
+    if ( ret <= 0 ) {
+      return ret;
+    }
+  }
+
+  size_t len { std::min( length, getReadBuffered() ) };
+  std::memcpy( buffer, &m_readBuf[m_readPos], len );
+  return len;
+}
+
+int BufferedStream::readUntil( std::string& out, const std::string& delimiter, size_t max_length )
+{
+  if ( delimiter.empty() ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // 已查找过的字节数，相对于 m_readPos，fill 移动数据后依然有效
+  size_t searched { 0 };
+  while ( true ) {
+    const char* begin { m_readBuf.data() + m_readPos };
+    size_t avail { getReadBuffered() };
+    if ( avail >= delimiter.size() ) {
+      size_t from { searched >= delimiter.size() ? searched - delimiter.size() + 1 : 0 };
+      const char* found { std::search( begin + from, begin + avail, delimiter.begin(), delimiter.end() ) };
+      if ( found != begin + avail ) {
+        size_t len = found - begin + delimiter.size();
+        out.assign( begin, len );
+        m_readPos += len;
+        return len;
+      }
+      searched = avail;
+    }
+
+    if ( avail >= max_length ) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    int ret = fill();
+    if ( ret <= 0 ) {
+      return ret;
+    }
+  }
+}
+
+int BufferedStream::readLine( std::string& line, size_t max_length )
+{
+  int ret = readUntil( line, "\n", max_length );
+  if ( ret > 0 ) {
+    line.pop_back();
+    if ( !line.empty() && line.back() == '\r' ) {
+      line.pop_back();
+    }
+  }
+  return ret;
+}
+
+int BufferedStream::write( const void* buffer, size_t length )
+{
+  iovec iov { const_cast<void*>( buffer ), length };
+  return writev( &iov, 1 );
+}
+
+int BufferedStream::write( ByteArray::SPtr ba, size_t length )
+{
+  std::vector<iovec> iovs;
+  ba->getReadBuffers( iovs, length );
+  int ret = writev( iovs.data(), iovs.size() );
+  if ( ret > 0 ) {
+    ba->setPosition( ba->getPosition() + ret );
+  }
+  return ret;
+}
+
+int BufferedStream::writev( const iovec* iov, size_t count )
+{
+  size_t total { 0 };
+  for ( size_t i = 0; i < count; ++i ) {
+    total += iov[i].iov_len;
+  }
+
+  if ( m_writeLen + total > m_writeBuf.size() ) {
+    return flushWith( iov, count ) ? -1 : total;
+  }
+  for ( size_t i = 0; i < count; ++i ) {
+    std::memcpy( &m_writeBuf[m_writeLen], iov[i].iov_base, iov[i].iov_len );
+    m_writeLen += iov[i].iov_len;
+  }
+  return total;
+}
+
+int BufferedStream::flush()
+{
+  return m_writeLen ? flushWith( nullptr, 0 ) : 0;
+}
+
+void BufferedStream::close()
+{
+  flush();
+  m_stream->close();
+}
+
+int BufferedStream::fill()
+{
+  if ( flush() ) {
+    return -1;
+  }
+
+  if ( m_readPos == m_readEnd ) {
+    m_readPos = m_readEnd = 0;
+  } else if ( m_readPos > 0 ) {
+    std::memmove( m_readBuf.data(), &m_readBuf[m_readPos], m_readEnd - m_readPos );
+    m_readEnd -= m_readPos;
+    m_readPos = 0;
+  }
+  // readUntil 找不到分隔符时缓冲区可能已满，扩容直到达到其 max_length
+  if ( m_readEnd == m_readBuf.size() ) {
+    m_readBuf.resize( m_readBuf.size() * 2 );
+  }
+
+  int ret = m_stream->read( &m_readBuf[m_readEnd], m_readBuf.size() - m_readEnd );
+  if ( ret > 0 ) {
+    m_readEnd += ret;
+  }
+  return ret;
+}
+
+int BufferedStream::flushWith( const iovec* iov, size_t count )
+{
+  std::vector<iovec> iovs;
+  iovs.reserve( count + 1 );
+  if ( m_writeLen ) {
+    iovs.push_back( { m_writeBuf.data(), m_writeLen } );
+    m_writeLen = 0;
+  }
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( iov[i].iov_len ) {
+      iovs.push_back( iov[i] );
+    }
+  }
+
+  size_t idx { 0 };
+  while ( idx < iovs.size() ) {
+    int ret = m_stream->writev( &iovs[idx], iovs.size() - idx );
+    if ( ret <= 0 ) {
+      return -1;
+    }
+    size_t left = ret;
+    while ( left > 0 && left >= iovs[idx].iov_len ) {
+      left -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if ( left > 0 ) {
+      iovs[idx].iov_base = (char*)iovs[idx].iov_base + left;
+      iovs[idx].iov_len -= left;
+    }
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "sylar/bytearray.h"
+#include "sylar/stream.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sylar {
+
+// 带缓冲的流装饰器：读侧一次从下层预读整块，小读取、peek 和按分隔符读取都在缓冲区内完成；
+// 写侧把小块写入攒在缓冲区中，满了或 flush 时与当次数据一起以一次 writev 写出。
+// 需要从下层读之前会先 flush，请求-响应式协议不会因请求还在缓冲区中而互相等待
+class BufferedStream : public Stream
+{
+public:
+  using SPtr = std::shared_ptr<BufferedStream>;
+
+  // 缓冲区大小为 0 时使用 buffered_stream.read_buffer / buffered_stream.write_buffer
+  // 析构时不会 flush，写缓冲区中的数据需要显式 flush 或 close
+  BufferedStream( Stream::SPtr stream, size_t read_buffer = 0, size_t write_buffer = 0 );
+
+  // 缓冲区有数据时只从缓冲区取；为空且 length 不小于缓冲区时直接读入调用方的内存
+  int read( void* buffer, size_t length ) override;
+  int read( ByteArray::SPtr ba, size_t length ) override;
+  // 写入缓冲区即返回 length，出错时返回 -1，此时缓冲区中未写出的数据被丢弃
+  int write( const void* buffer, size_t length ) override;
+  int write( ByteArray::SPtr ba, size_t length ) override;
+  int writev( const iovec* iov, size_t count ) override;
+  // 先 flush 再关闭下层流
+  void close() override;
+
+  // 拷贝至多 length 字节但不消费，缓冲区为空时先预读一次；EOF 返回 0，出错返回 -1
+  int peek( void* buffer, size_t length );
+  // 读到 delimiter 为止，out 中包含 delimiter；超过 max_length 仍未找到时返回 -1，errno 为 EMSGSIZE，
+  // 数据留在缓冲区中。EOF 返回 0，此时缓冲区中不完整的数据保留给 read
+  int readUntil( std::string& out, const std::string& delimiter, size_t max_length = 64 * 1024 );
+  // 读一行，去掉行尾的 \n 或 \r\n
+  int readLine( std::string& line, size_t max_length = 64 * 1024 );
+  // 把写缓冲区全部写到下层流，成功返回 0
+  int flush();
+
+  size_t getReadBuffered() const { return m_readEnd - m_readPos; }
+  size_t getWriteBuffered() const { return m_writeLen; }
+  Stream::SPtr getStream() const { return m_stream; }
+
+private:
+  // 把未读数据移到缓冲区开头，再从下层读一次填充剩余空间
+  int fill();
+  // 把写缓冲区和 iov 一起写出，直到全部写完
+  int flushWith( const iovec* iov, size_t count );
+
+private:
+  Stream::SPtr m_stream;
+  std::vector<char> m_readBuf;
+  size_t m_readPos;
+  size_t m_readEnd;
+  std::vector<char> m_writeBuf;
+  size_t m_writeLen;
+};
+
+}
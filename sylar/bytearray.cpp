@@ -1,5 +1,6 @@
 #include "bytearray.h"
 #include "sylar/endian.h"
+#include "sylar/chunk_pool.h"
 #include "sylar/log.h"
 #include <cstddef>
 #include <cstdint>
@@ -17,17 +18,39 @@ namespace sylar {
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_NAME( "system" );
 
-ByteArray::Node::Node( size_t s ) : ptr { new char[s] }, next { nullptr }, size( s ) {}
+// 节点头的池不随 bytearray.pool.sizes 变化
+static const uint32_t s_node_pool_max_free { 4096 };
+
+struct _ByteArrayIniter
+{
+  _ByteArrayIniter() { ChunkPool::Register( sizeof( ByteArray::Node ), s_node_pool_max_free ); }
+};
+
+static _ByteArrayIniter s_bytearray_initer;
+
+ByteArray::Node::Node( size_t s )
+  : ptr { static_cast<char*>( ChunkPool::Alloc( s ) ) }, next { nullptr }, size( s )
+{}
 
 ByteArray::Node::Node() : ptr { nullptr }, next { nullptr }, size { 0 } {}
 
 ByteArray::Node::~Node()
 {
   if ( ptr ) {
-    delete[] ptr;
+    ChunkPool::Dealloc( ptr, size );
   }
 }
 
+void* ByteArray::Node::operator new( size_t size )
+{
+  return ChunkPool::Alloc( size );
+}
+
+void ByteArray::Node::operator delete( void* ptr, size_t size )
+{
+  ChunkPool::Dealloc( ptr, size );
+}
+
 ByteArray::ByteArray( size_t base_size )
   : m_baseSize { base_size }
   , m_position { 0 }
@@ -81,6 +104,7 @@ void ByteArray::writeFuint16( uint16_t value )
   if ( m_endian != SYLAR_BYTE_ORDER ) {
     value = byteswap( value );
   }
+  write( &value, sizeof( value ) );
 }
 
 void ByteArray::writeFint32( int32_t value )
@@ -125,7 +149,7 @@ static uint32_t EncodeZigzag32( const int32_t& val )
   return val * 2;
 }
 
-static int32_t EncodeZigzag64( const int64_t& val )
+static uint64_t EncodeZigzag64( const int64_t& val )
 {
   if ( val < 0 ) {
     return ( (uint64_t)( -val ) ) * 2 - 1;
@@ -146,7 +170,7 @@ static int64_t DecodeZigzag64( const uint64_t& val )
 
 void ByteArray::writeInt32( int32_t value )
 {
-  writeUint32( EncodeZigzag32( EncodeZigzag32( value ) ) );
+  writeUint32( EncodeZigzag32( value ) );
 }
 
 void ByteArray::writeUint32( uint32_t value )
@@ -287,6 +311,7 @@ uint32_t ByteArray::readUint32()
     uint8_t b = readFuint8();
     if ( b < 0x80 ) {
       result |= ( (uint32_t)b ) << i;
+      break;
     } else {
       result |= ( (uint32_t)( b & 0x7f ) ) << i;
     }
@@ -379,6 +404,7 @@ void ByteArray::clear()
   }
   m_cur = m_root;
   m_root->next = nullptr;
+  m_capacity = m_baseSize;
 }
 
 void ByteArray::write( const void* buf, size_t size )
@@ -395,7 +421,7 @@ void ByteArray::write( const void* buf, size_t size )
 
   while ( size ) {
     if ( ncap >= size ) {
-      std::memcpy( m_cur->ptr + npos, (const char*)buf + npos, size );
+      std::memcpy( m_cur->ptr + npos, (const char*)buf + bpos, size );
       if ( m_cur->size == npos + size ) {
         m_cur = m_cur->next;
       }
@@ -556,7 +582,7 @@ void ByteArray::addCapacity( size_t size )
   }
 
   size -= old_cap;
-  size_t count = ( size / m_baseSize ) + ( ( ( size % m_baseSize ) > old_cap ) ? 1 : 0 );
+  size_t count = ( size + m_baseSize - 1 ) / m_baseSize;
   Node* tmp = m_root;
   while ( tmp->next ) {
     tmp = tmp->next;
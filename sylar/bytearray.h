@@ -8,8 +8,13 @@
 
 namespace sylar {
 
+class IOBuf;
+
 class ByteArray
 {
+  // IOBuf::append(ByteArray&&) 直接接管节点内存
+  friend class IOBuf;
+
 public:
   using SPtr = std::shared_ptr<ByteArray>;
 
@@ -19,6 +24,10 @@ public:
     Node();
     ~Node();
 
+    // 节点头与数据块一样从 ChunkPool 分配
+    static void* operator new( size_t size );
+    static void operator delete( void* ptr, size_t size );
+
     char* ptr;
     Node* next;
     size_t size;
@@ -0,0 +1,289 @@
+#include "chunk_pool.h"
+#include "sylar/config.h"
+#include "sylar/hugepage.h"
+#include "sylar/log.h"
+#include "sylar/thread.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+namespace sylar {
+
+static Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+static ConfigVar<std::map<std::string, uint32_t>>::SPtr g_bytearray_pool_sizes { Config::Lookup(
+  "bytearray.pool.sizes",
+  std::map<std::string, uint32_t> { { "4096", 1024 } },
+  "pooled ByteArray node sizes -> max free chunks kept globally" ) };
+
+static ConfigVar<uint32_t>::SPtr g_bytearray_pool_thread_cache { Config::Lookup(
+  "bytearray.pool.thread_cache", (uint32_t)64, "free chunks cached per thread and size" ) };
+
+static std::atomic<uint32_t> s_thread_cache { 64 };
+
+namespace {
+
+struct SizePool
+{
+  std::size_t size { 0 };
+  std::atomic<uint32_t> maxFree { 0 };
+  std::atomic<uint64_t> hits { 0 };
+  std::atomic<uint64_t> misses { 0 };
+  Mutex mutex;
+  std::vector<void*> free;
+};
+
+// 池只增不删，停止池化时把 maxFree 置 0，线程缓存可以安全地持有其指针
+struct Registry
+{
+  Mutex mutex;
+  std::vector<SizePool*> pools;
+  // 每次 Register 递增，线程缓存据此重新查找池
+  std::atomic<uint32_t> version { 1 };
+};
+
+} // namespace
+
+// 进程退出时仍可能有 ByteArray 释放，故不析构
+static Registry& GetRegistry()
+{
+  static Registry* s_registry { new Registry };
+  return *s_registry;
+}
+
+static SizePool* FindPool( std::size_t size )
+{
+  Registry& registry { GetRegistry() };
+  Mutex::Lock lock( registry.mutex );
+  for ( SizePool* pool : registry.pools ) {
+    if ( pool->size == size ) {
+      return pool;
+    }
+  }
+  return nullptr;
+}
+
+// 把 chunks 中 count 个块归还全局，全局已满的部分交回 HugePageAllocator
+static void ReleaseChunks( SizePool* pool, std::vector<void*>& chunks, std::size_t count )
+{
+  std::size_t begin { chunks.size() - count };
+  {
+    Mutex::Lock lock( pool->mutex );
+    uint32_t max_free { pool->maxFree.load( std::memory_order_relaxed ) };
+    while ( begin < chunks.size() && pool->free.size() < max_free ) {
+      pool->free.push_back( chunks.back() );
+      chunks.pop_back();
+    }
+  }
+  while ( chunks.size() > begin ) {
+    HugePageAllocator::Dealloc( chunks.back(), pool->size );
+    chunks.pop_back();
+  }
+}
+
+namespace {
+
+struct ThreadCache
+{
+  struct Entry
+  {
+    std::size_t size;
+    // 为 nullptr 表示该大小未池化
+    SizePool* pool;
+    std::vector<void*> chunks;
+  };
+
+  ~ThreadCache();
+
+  Entry* get( std::size_t size );
+
+  std::vector<Entry> entries;
+  uint32_t version { 0 };
+};
+
+} // namespace
+
+// 线程退出时 t_cache 可能先于其他 thread_local 对象析构，之后的申请释放绕过线程缓存
+static thread_local bool t_cache_destroyed { false };
+static thread_local ThreadCache t_cache;
+
+ThreadCache::~ThreadCache()
+{
+  t_cache_destroyed = true;
+  for ( Entry& entry : entries ) {
+    if ( entry.pool ) {
+      ReleaseChunks( entry.pool, entry.chunks, entry.chunks.size() );
+    }
+  }
+}
+
+ThreadCache::Entry* ThreadCache::get( std::size_t size )
+{
+  uint32_t cur { GetRegistry().version.load( std::memory_order_acquire ) };
+  if ( version != cur ) {
+    version = cur;
+    for ( Entry& entry : entries ) {
+      entry.pool = FindPool( entry.size );
+      // 已停止池化的大小，把线程缓存中的块交回 HugePageAllocator
+      if ( !entry.pool || !entry.pool->maxFree ) {
+        for ( void* ptr : entry.chunks ) {
+          HugePageAllocator::Dealloc( ptr, entry.size );
+        }
+        entry.chunks.clear();
+      }
+    }
+  }
+
+  for ( Entry& entry : entries ) {
+    if ( entry.size == size ) {
+      return &entry;
+    }
+  }
+  entries.push_back( { size, FindPool( size ), {} } );
+  return &entries.back();
+}
+
+static void ApplyConfig( const std::map<std::string, uint32_t>& old_value,
+                         const std::map<std::string, uint32_t>& new_value )
+{
+  for ( auto& i : old_value ) {
+    if ( !new_value.count( i.first ) ) {
+      ChunkPool::Register( std::strtoul( i.first.c_str(), nullptr, 10 ), 0 );
+    }
+  }
+  for ( auto& i : new_value ) {
+    std::size_t size { std::strtoul( i.first.c_str(), nullptr, 10 ) };
+    if ( !size ) {
+      SYLAR_LOG_ERROR( g_logger ) << "bytearray.pool.sizes invalid size: " << i.first;
+      continue;
+    }
+    ChunkPool::Register( size, i.second );
+  }
+}
+
+struct _ChunkPoolIniter
+{
+  _ChunkPoolIniter()
+  {
+    ApplyConfig( {}, g_bytearray_pool_sizes->getValue() );
+    g_bytearray_pool_sizes->addListener( ApplyConfig );
+    s_thread_cache = g_bytearray_pool_thread_cache->getValue();
+    g_bytearray_pool_thread_cache->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_thread_cache = new_value; } );
+  }
+};
+
+static _ChunkPoolIniter s_chunk_pool_initer;
+
+void* ChunkPool::Alloc( std::size_t size )
+{
+  ThreadCache::Entry* entry { t_cache_destroyed ? nullptr : t_cache.get( size ) };
+  SizePool* pool { entry ? entry->pool : nullptr };
+  if ( !pool || !pool->maxFree.load( std::memory_order_relaxed ) ) {
+    return HugePageAllocator::Alloc( size );
+  }
+
+  if ( entry->chunks.empty() ) {
+    // 一次取回半个线程缓存，摊薄全局锁
+    std::size_t batch { std::max<std::size_t>( s_thread_cache / 2, 1 ) };
+    Mutex::Lock lock( pool->mutex );
+    std::size_t count { std::min( batch, pool->free.size() ) };
+    entry->chunks.insert( entry->chunks.end(), pool->free.end() - count, pool->free.end() );
+    pool->free.resize( pool->free.size() - count );
+  }
+  if ( entry->chunks.empty() ) {
+    pool->misses.fetch_add( 1, std::memory_order_relaxed );
+    return HugePageAllocator::Alloc( size );
+  }
+
+  pool->hits.fetch_add( 1, std::memory_order_relaxed );
+  void* ptr { entry->chunks.back() };
+  entry->chunks.pop_back();
+  return ptr;
+}
+
+void ChunkPool::Dealloc( void* ptr, std::size_t size )
+{
+  if ( !ptr ) {
+    return;
+  }
+  ThreadCache::Entry* entry { t_cache_destroyed ? nullptr : t_cache.get( size ) };
+  SizePool* pool { entry ? entry->pool : nullptr };
+  if ( !pool || !pool->maxFree.load( std::memory_order_relaxed ) ) {
+    HugePageAllocator::Dealloc( ptr, size );
+    return;
+  }
+
+  entry->chunks.push_back( ptr );
+  uint32_t thread_cache { s_thread_cache };
+  if ( entry->chunks.size() > thread_cache ) {
+    ReleaseChunks( pool, entry->chunks, entry->chunks.size() - thread_cache / 2 );
+  }
+}
+
+void ChunkPool::Register( std::size_t size, std::uint32_t max_free )
+{
+  SizePool* pool { FindPool( size ) };
+  Registry& registry { GetRegistry() };
+  if ( !pool ) {
+    if ( !max_free ) {
+      return;
+    }
+    pool = new SizePool;
+    pool->size = size;
+    Mutex::Lock lock( registry.mutex );
+    registry.pools.push_back( pool );
+  }
+
+  pool->maxFree = max_free;
+  std::vector<void*> excess;
+  {
+    Mutex::Lock lock( pool->mutex );
+    while ( pool->free.size() > max_free ) {
+      excess.push_back( pool->free.back() );
+      pool->free.pop_back();
+    }
+  }
+  for ( void* ptr : excess ) {
+    HugePageAllocator::Dealloc( ptr, size );
+  }
+  ++registry.version;
+}
+
+std::vector<ChunkPool::Stats> ChunkPool::GetStats()
+{
+  std::vector<SizePool*> pools;
+  {
+    Registry& registry { GetRegistry() };
+    Mutex::Lock lock( registry.mutex );
+    pools = registry.pools;
+  }
+
+  std::vector<Stats> stats;
+  for ( SizePool* pool : pools ) {
+    Stats s;
+    s.size = pool->size;
+    s.maxFree = pool->maxFree;
+    s.hits = pool->hits;
+    s.misses = pool->misses;
+    Mutex::Lock lock( pool->mutex );
+    s.globalFree = pool->free.size();
+    stats.push_back( s );
+  }
+  return stats;
+}
+
+std::ostream& ChunkPool::Dump( std::ostream& os )
+{
+  os << "[ChunkPool thread_cache=" << s_thread_cache;
+  for ( auto& s : GetStats() ) {
+    os << " {size=" << s.size << " max_free=" << s.maxFree << " hits=" << s.hits << " misses=" << s.misses
+       << " global_free=" << s.globalFree << "}";
+  }
+  os << "]";
+  return os;
+}
+
+} // namespace sylar
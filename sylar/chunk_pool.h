@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace sylar {
+
+// 定长内存块池，供 ByteArray 节点使用：每个线程按块大小缓存一批空闲块，命中时无需加锁；
+// 线程缓存为空时从全局空闲链表批量取回，过多时批量归还，全局也放不下时才交回 HugePageAllocator。
+// 池化的块大小由 bytearray.pool.sizes 配置（块大小 -> 全局最多保留的空闲块数），其余大小直接走 HugePageAllocator
+class ChunkPool
+{
+public:
+  struct Stats
+  {
+    std::size_t size { 0 };
+    std::uint32_t maxFree { 0 };
+    // 从线程缓存或全局空闲链表取得
+    std::uint64_t hits { 0 };
+    // 池中没有空闲块，向 HugePageAllocator 申请
+    std::uint64_t misses { 0 };
+    std::size_t globalFree { 0 };
+  };
+
+  static void* Alloc( std::size_t size );
+
+  static void Dealloc( void* ptr, std::size_t size );
+
+  // 以代码方式池化某个大小，max_free 为 0 表示停止池化
+  static void Register( std::size_t size, std::uint32_t max_free );
+
+  static std::vector<Stats> GetStats();
+
+  static std::ostream& Dump( std::ostream& os );
+};
+
+} // namespace sylar
@@ -54,6 +54,24 @@ public:
   To operator()( const From& v ) { return boost::lexical_cast<To>( v ); }
 };
 
+template<>
+class LexicalCast<std::string, bool>
+{
+public:
+  bool operator()( const std::string& v )
+  {
+    std::string val { v };
+    std::transform( val.begin(), val.end(), val.begin(), ::tolower );
+    if ( val == "true" || val == "yes" || val == "on" ) {
+      return true;
+    }
+    if ( val == "false" || val == "no" || val == "off" ) {
+      return false;
+    }
+    return boost::lexical_cast<bool>( v );
+  }
+};
+
 template<typename T>
 class LexicalCast<std::string, std::vector<T>>
 {
@@ -8,102 +8,123 @@
 
 namespace sylar {
 
-FdCtx::FdCtx( int fd )
-  : m_isInit { false }
-  , m_isSocket { false }
-  , m_sysNonblock { false }
-  , m_userNonblock { false }
-  , m_isClosed { false }
-  , m_fd { fd }
+FdCtx::FdCtx( int fd, bool known_socket, bool sys_nonblock )
+  : m_fd { fd }
   , m_recvTimeout { std::numeric_limits<uint64_t>::max() }
   , m_sendTimeout { std::numeric_limits<uint64_t>::max() }
 {
-  init();
+  if ( known_socket ) {
+    initSocket( sys_nonblock );
+  } else {
+    init();
+  }
 }
 
 FdCtx::~FdCtx() {}
 
 bool FdCtx::init()
 {
-  if ( m_isInit ) {
+  if ( isInit() ) {
     return true;
   }
+  return probe();
+}
 
-  m_recvTimeout = -1;
-  m_sendTimeout = -1;
-
+bool FdCtx::probe()
+{
+  uint8_t flags { 0 };
   struct stat fd_stat;
-  if ( -1 == fstat( m_fd, &fd_stat ) ) {
-    m_isInit = false;
-    m_isSocket = false;
-  } else {
-    m_isInit = true;
-    m_isSocket = S_ISSOCK( fd_stat.st_mode );
-  }
-
-  if ( m_isSocket ) {
-    int flags = fcntl_f( m_fd, F_GETFL, 0 );
-    if ( !( flags & O_NONBLOCK ) ) {
-      fcntl_f( m_fd, F_SETFL, flags | O_NONBLOCK );
+  if ( -1 != fstat( m_fd, &fd_stat ) ) {
+    flags |= INIT;
+    if ( S_ISSOCK( fd_stat.st_mode ) ) {
+      flags |= SOCKET | SYS_NONBLOCK;
+      int fl = fcntl_f( m_fd, F_GETFL, 0 );
+      if ( !( fl & O_NONBLOCK ) ) {
+        fcntl_f( m_fd, F_SETFL, fl | O_NONBLOCK );
+      }
     }
-    m_sysNonblock = true;
-  } else {
-    m_sysNonblock = false;
   }
 
-  m_userNonblock = false;
-  m_isClosed = false;
-  return m_isInit;
+  m_recvTimeout.store( -1, std::memory_order_relaxed );
+  m_sendTimeout.store( -1, std::memory_order_relaxed );
+  m_flags.store( flags, std::memory_order_release );
+  return flags & INIT;
+}
+
+void FdCtx::initSocket( bool sys_nonblock )
+{
+  m_recvTimeout.store( -1, std::memory_order_relaxed );
+  m_sendTimeout.store( -1, std::memory_order_relaxed );
+  m_flags.store( INIT | SOCKET | ( sys_nonblock ? SYS_NONBLOCK : 0 ), std::memory_order_release );
 }
 
 void FdCtx::setTimeout( int type, uint64_t val )
 {
   if ( type == SO_RCVTIMEO ) {
-    m_recvTimeout = val;
+    m_recvTimeout.store( val, std::memory_order_relaxed );
   } else {
-    m_sendTimeout = val;
+    m_sendTimeout.store( val, std::memory_order_relaxed );
   }
 }
 
 uint64_t FdCtx::getTimeout( int type )
 {
   if ( type == SO_RCVTIMEO ) {
-    return m_recvTimeout;
+    return m_recvTimeout.load( std::memory_order_relaxed );
   } else {
-    return m_sendTimeout;
+    return m_sendTimeout.load( std::memory_order_relaxed );
   }
 }
 
-FdManager::FdManager()
+FdManager::FdManager() {}
+
+FdCtx* FdManager::get( int fd, bool auto_create )
 {
-  m_datas.resize( 64 );
+  FdCtx* ctx { m_datas.get( fd ) };
+  if ( ctx && ctx->m_active.load( std::memory_order_acquire ) ) {
+    return ctx;
+  }
+  return auto_create ? create( fd, false, false ) : nullptr;
 }
 
-FdCtx::SPtr FdManager::get( int fd, bool auto_create )
+FdCtx* FdManager::addSocket( int fd, bool sys_nonblock )
 {
-  RWMutexType::ReadLock lock { m_mutex };
-  if ( m_datas.size() <= fd && auto_create == false ) {
-    return nullptr;
-  } else {
-    if ( m_datas[fd] || !auto_create ) {
-      return m_datas[fd];
-    }
+  return create( fd, true, sys_nonblock );
+}
+
+FdCtx* FdManager::create( int fd, bool known_socket, bool sys_nonblock )
+{
+  bool created { false };
+  FdCtx* ctx { m_datas.getOrCreate( fd, [fd, known_socket, sys_nonblock, &created]() {
+    created = true;
+    return new FdCtx( fd, known_socket, sys_nonblock );
+  } ) };
+  if ( !ctx || created ) {
+    return ctx;
+  }
+  // 未 hook 的 close 不会调用 del，新 socket 可能复用仍处于激活状态的旧上下文
+  if ( !known_socket && ctx->m_active.load( std::memory_order_acquire ) ) {
+    return ctx;
   }
-  lock.unlock();
 
-  RWMutexType::WriteLock lock2 { m_mutex };
-  FdCtx::SPtr ctx( new FdCtx( fd ) );
-  m_datas[fd] = ctx;
+  MutexType::Lock lock { m_mutex };
+  if ( known_socket || !ctx->m_active.load( std::memory_order_relaxed ) ) {
+    if ( known_socket ) {
+      ctx->initSocket( sys_nonblock );
+    } else {
+      ctx->probe();
+    }
+    ctx->m_active.store( true, std::memory_order_release );
+  }
   return ctx;
 }
 
 void FdManager::del( int fd )
 {
-  RWMutexType::WriteLock lock { m_mutex };
-  if ( m_datas.size() <= fd ) {
-    return;
+  FdCtx* ctx { m_datas.get( fd ) };
+  if ( ctx ) {
+    ctx->m_active.store( false, std::memory_order_release );
   }
-  m_datas[fd].reset();
 }
 
 }
\ No newline at end of file
@@ -2,57 +2,159 @@
 
 #include "singleton.h"
 #include "thread.h"
-#include <memory>
-#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 
 namespace sylar {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx>
+// 按 fd 下标的只增不减的两级表：查找只有两次 acquire 读，不加锁也不改引用计数
+// 元素一旦创建就常驻到表析构，调用方拿到的裸指针在 fd 被复用后依然有效
+template<typename T>
+class FdTable
 {
 public:
-  using SPtr = std::shared_ptr<FdCtx>;
+  static constexpr std::size_t CHUNK_BITS { 10 };
+  static constexpr std::size_t CHUNK_SIZE { std::size_t( 1 ) << CHUNK_BITS };
+  static constexpr std::size_t MAX_CHUNKS { 1024 };
+  static constexpr std::size_t MAX_FDS { CHUNK_SIZE * MAX_CHUNKS };
 
-  FdCtx( int fd );
+  FdTable() = default;
+  FdTable( const FdTable& ) = delete;
+  FdTable& operator=( const FdTable& ) = delete;
+
+  ~FdTable()
+  {
+    for ( auto& c : m_chunks ) {
+      std::atomic<T*>* chunk { c.load( std::memory_order_acquire ) };
+      if ( !chunk ) {
+        continue;
+      }
+      for ( std::size_t i = 0; i < CHUNK_SIZE; ++i ) {
+        delete chunk[i].load( std::memory_order_acquire );
+      }
+      delete[] chunk;
+    }
+  }
+
+  T* get( int fd ) const
+  {
+    if ( fd < 0 || static_cast<std::size_t>( fd ) >= MAX_FDS ) {
+      return nullptr;
+    }
+    std::atomic<T*>* chunk { m_chunks[fd >> CHUNK_BITS].load( std::memory_order_acquire ) };
+    return chunk ? chunk[fd & ( CHUNK_SIZE - 1 )].load( std::memory_order_acquire ) : nullptr;
+  }
+
+  // 不存在时用 create() 创建；并发创建时只有一个胜出，其余的被删除
+  template<typename Create>
+  T* getOrCreate( int fd, Create&& create )
+  {
+    T* value { get( fd ) };
+    if ( value || fd < 0 || static_cast<std::size_t>( fd ) >= MAX_FDS ) {
+      return value;
+    }
+
+    std::atomic<std::atomic<T*>*>& slot { m_chunks[fd >> CHUNK_BITS] };
+    std::atomic<T*>* chunk { slot.load( std::memory_order_acquire ) };
+    if ( !chunk ) {
+      std::atomic<T*>* fresh { new std::atomic<T*>[CHUNK_SIZE]() };
+      if ( slot.compare_exchange_strong( chunk, fresh, std::memory_order_acq_rel ) ) {
+        chunk = fresh;
+      } else {
+        delete[] fresh;
+      }
+    }
+
+    T* created { create() };
+    if ( !chunk[fd & ( CHUNK_SIZE - 1 )].compare_exchange_strong( value, created, std::memory_order_acq_rel ) ) {
+      delete created;
+      return value;
+    }
+    return created;
+  }
+
+private:
+  std::atomic<std::atomic<T*>*> m_chunks[MAX_CHUNKS] {};
+};
+
+// 同一 fd 号的上下文常驻复用，按缓存行对齐避免与相邻 fd 伪共享
+class alignas( 64 ) FdCtx
+{
+public:
+  // known_socket 为 true 表示 fd 由 accept4 创建，跳过 fstat 和 fcntl，sys_nonblock 为其创建时的阻塞模式
+  FdCtx( int fd, bool known_socket = false, bool sys_nonblock = true );
   ~FdCtx();
 
   bool init();
-  bool isInit() const { return m_isInit; }
-  bool isSocket() const { return m_isSocket; }
-  bool isClose() const { return m_isClosed; }
+  void initSocket( bool sys_nonblock );
+  bool isInit() const { return hasFlag( INIT ); }
+  bool isSocket() const { return hasFlag( SOCKET ); }
+  bool isClose() const { return hasFlag( CLOSED ); }
   bool close();
 
-  void setUserNonblock( bool val ) { m_userNonblock = val; }
-  bool getUserNonblock() const { return m_userNonblock; }
+  void setUserNonblock( bool val ) { setFlag( USER_NONBLOCK, val ); }
+  bool getUserNonblock() const { return hasFlag( USER_NONBLOCK ); }
 
-  void setSysNonblock( bool val ) { m_sysNonblock = val; }
-  bool getSysNonblock() const { return m_sysNonblock; }
+  void setSysNonblock( bool val ) { setFlag( SYS_NONBLOCK, val ); }
+  bool getSysNonblock() const { return hasFlag( SYS_NONBLOCK ); }
 
   void setTimeout( int type, uint64_t val );
   uint64_t getTimeout( int type );
 
 private:
-  bool m_isInit : 1;
-  bool m_isSocket : 1;
-  bool m_sysNonblock : 1;
-  bool m_userNonblock : 1;
-  bool m_isClosed : 1;
+  friend class FdManager;
+
+  enum Flag : uint8_t
+  {
+    INIT = 1 << 0,
+    SOCKET = 1 << 1,
+    SYS_NONBLOCK = 1 << 2,
+    USER_NONBLOCK = 1 << 3,
+    CLOSED = 1 << 4,
+  };
+
+  bool hasFlag( Flag flag ) const { return m_flags.load( std::memory_order_acquire ) & flag; }
+  void setFlag( Flag flag, bool val )
+  {
+    if ( val ) {
+      m_flags.fetch_or( flag, std::memory_order_acq_rel );
+    } else {
+      m_flags.fetch_and( static_cast<uint8_t>( ~flag ), std::memory_order_acq_rel );
+    }
+  }
+
+  // 重新探测 fd 类型并一次性发布全部状态
+  bool probe();
+
+  // fd 关闭后由 FdManager 置为 false，同号 fd 再次创建时重新初始化
+  std::atomic<bool> m_active { true };
+  // 重新初始化时无锁读者可能仍持有本上下文，标志位整体发布，读者只会看到新旧状态之一
+  std::atomic<uint8_t> m_flags { 0 };
   int m_fd;
-  uint64_t m_recvTimeout;
-  uint64_t m_sendTimeout;
+  std::atomic<uint64_t> m_recvTimeout;
+  std::atomic<uint64_t> m_sendTimeout;
 };
 
 class FdManager
 {
 public:
-  using RWMutexType = RWMutex;
+  using MutexType = Mutex;
   FdManager();
 
-  FdCtx::SPtr get( int fd, bool auto_create = false );
+  // 返回的指针由 FdManager 持有，fd 关闭后返回 nullptr
+  FdCtx* get( int fd, bool auto_create = false );
+  // 登记一个刚由内核返回的 socket，覆盖同号 fd 的旧状态，无需额外系统调用
+  FdCtx* addSocket( int fd, bool sys_nonblock );
   void del( int fd );
 
 private:
-  RWMutexType m_mutex;
-  std::vector<FdCtx::SPtr> m_datas;
+  FdCtx* create( int fd, bool known_socket, bool sys_nonblock );
+
+private:
+  // 只保护重新激活已关闭 fd 的慢路径，查找不加锁
+  MutexType m_mutex;
+  FdTable<FdCtx> m_datas;
 };
 
 using FdMgr = Singleton<FdManager>;
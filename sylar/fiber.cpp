@@ -1,6 +1,7 @@
 #include "fiber.h"
 #include "scheduler.h"
 #include "sylar/config.h"
+#include "sylar/hugepage.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
 #include "sylar/util.h"
@@ -9,6 +10,8 @@
 #include <functional>
 #include <string>
 #include <ucontext.h>
+#include <utility>
+#include <vector>
 
 namespace sylar {
 
@@ -25,15 +28,35 @@ static thread_local Fiber::SPtr t_threadFiber { nullptr };
 static ConfigVar<std::uint32_t>::SPtr g_fiber_stack_size {
   Config::Lookup<std::uint32_t>( "fiber.stack.size", 1024 * 1024, "fiber stack size" ) };
 
-class MallocStackAllocator
-{
-public:
-  static void* Alloc( std::size_t size ) { return std::malloc( size ); }
+static ConfigVar<std::uint32_t>::SPtr g_fiber_pool_size {
+  Config::Lookup<std::uint32_t>( "fiber.pool.size", 16, "max terminated fibers cached per thread" ) };
+
+static std::atomic<std::uint32_t> s_fiber_pool_size { 16 };
+static std::atomic<std::uint64_t> s_pool_hits { 0 };
+static std::atomic<std::uint64_t> s_pool_misses { 0 };
+static std::atomic<std::uint64_t> s_pool_recycled { 0 };
+static std::atomic<std::uint64_t> s_pool_dropped { 0 };
+
+static std::atomic<std::size_t> s_local_count { 0 };
+static void ( *s_local_destroys[Fiber::MAX_LOCALS] )( void* ) {};
 
-  static void Dealloc( void* ptr, std::size_t size ) { std::free( ptr ); }
+// 当前线程缓存的已结束协程
+static thread_local std::vector<Fiber::SPtr> t_fiberPool;
+
+struct _FiberIniter
+{
+  _FiberIniter()
+  {
+    s_fiber_pool_size = g_fiber_pool_size->getValue();
+    g_fiber_pool_size->addListener(
+      []( const std::uint32_t& old_value, const std::uint32_t& new_value ) { s_fiber_pool_size = new_value; } );
+  }
 };
 
-using StackAllocator = MallocStackAllocator;
+static _FiberIniter s_fiber_initer;
+
+// hugepage.mode 为 off 时等价于 malloc/free
+using StackAllocator = HugePageAllocator;
 
 std::uint64_t Fiber::GetFiberId()
 {
@@ -57,7 +80,8 @@ Fiber::Fiber()
   SYLAR_LOG_DEBUG( g_logger ) << "Fiber::Fiber";
 }
 
-Fiber::Fiber( std::function<void()> cb, std::size_t stacksize, bool use_caller ) : m_id( ++s_fiber_id ), m_cb( cb )
+Fiber::Fiber( std::function<void()> cb, std::size_t stacksize, bool use_caller )
+  : m_id( ++s_fiber_id ), m_cb( std::move( cb ) )
 {
   ++s_fiber_count;
   m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
@@ -82,6 +106,7 @@ Fiber::Fiber( std::function<void()> cb, std::size_t stacksize, bool use_caller )
 Fiber::~Fiber()
 {
   --s_fiber_count;
+  destroyLocals();
   if ( m_stack ) {
     SYLAR_ASSERT( TERM == m_state || INIT == m_state || EXCEPT == m_state );
     StackAllocator::Dealloc( m_stack, m_stacksize );
@@ -104,7 +129,8 @@ void Fiber::reset( std::function<void()> cb )
 {
   SYLAR_ASSERT( m_stack );
   SYLAR_ASSERT( TERM == m_state || EXCEPT == m_state || INIT == m_state );
-  m_cb = cb;
+  destroyLocals();
+  m_cb = std::move( cb );
   if ( getcontext( &m_ctx ) ) {
     SYLAR_ASSERT2( false, "getcontext" );
   }
@@ -162,30 +188,37 @@ void Fiber::SetThis( Fiber* f )
 
 // 返回当前协程，第一次调用时如果主协程还没初始化，会初始化，所以使用协程前需要显式调用一次
 Fiber::SPtr Fiber::GetThis()
+{
+  return Current()->shared_from_this();
+}
+
+Fiber* Fiber::Current()
 {
   if ( t_fiber ) {
-    return t_fiber->shared_from_this();
+    return t_fiber;
   }
 
   Fiber::SPtr main_fiber { new Fiber };
   SYLAR_ASSERT( t_fiber == main_fiber.get() );
   t_threadFiber = main_fiber;
-  return t_fiber->shared_from_this();
+  return t_fiber;
 }
 
 // 协程切换到后台，并且设置为Ready状态
+// 切出期间协程由调度器队列或事件上下文持有，这里不再额外持有引用
 void Fiber::YieldToReady()
 {
-  Fiber::SPtr cur { GetThis() };
+  Fiber* cur { Current() };
   cur->m_state = READY;
   cur->swapOut();
 }
 
 // 协程切换到后台，并且设置为Hold状态
+// 切换完成前保持 EXEC，由调度线程在 swapIn 返回后置为 HOLD，避免其他线程恢复尚未保存完上下文的协程
+// 挂起期间的所有权约定见 fiber.h
 void Fiber::YieldToHold()
 {
-  Fiber::SPtr cur { GetThis() };
-  cur->m_state = HOLD;
+  Fiber* cur { Current() };
   cur->swapOut();
 }
 
@@ -195,9 +228,72 @@ uint64_t Fiber::TotalFibers()
   return s_fiber_count;
 }
 
+Fiber::SPtr Fiber::Create( std::function<void()> cb )
+{
+  if ( !t_fiberPool.empty() ) {
+    Fiber::SPtr fiber { std::move( t_fiberPool.back() ) };
+    t_fiberPool.pop_back();
+    fiber->reset( std::move( cb ) );
+    ++s_pool_hits;
+    return fiber;
+  }
+
+  ++s_pool_misses;
+  return std::make_shared<Fiber>( std::move( cb ) );
+}
+
+void Fiber::Recycle( Fiber::SPtr&& fiber )
+{
+  if ( !fiber || !fiber->m_stack || fiber.use_count() != 1
+       || ( fiber->m_state != TERM && fiber->m_state != EXCEPT ) ) {
+    return;
+  }
+
+  // 非默认栈大小的协程不入池，避免 Create 拿到尺寸不符的栈
+  if ( t_fiberPool.size() >= s_fiber_pool_size || fiber->m_stacksize != g_fiber_stack_size->getValue() ) {
+    ++s_pool_dropped;
+    fiber.reset();
+    return;
+  }
+
+  fiber->m_cb = nullptr;
+  t_fiberPool.push_back( std::move( fiber ) );
+  ++s_pool_recycled;
+}
+
+std::size_t Fiber::RegisterLocal( void ( *destroy )( void* ) )
+{
+  std::size_t index { s_local_count++ };
+  SYLAR_ASSERT2( index < MAX_LOCALS, "too many FiberLocal slots" );
+  s_local_destroys[index] = destroy;
+  return index;
+}
+
+void Fiber::destroyLocals()
+{
+  std::size_t count { s_local_count };
+  for ( std::size_t i = 0; i < count && i < MAX_LOCALS; ++i ) {
+    if ( m_locals[i] ) {
+      void* ptr { m_locals[i] };
+      m_locals[i] = nullptr;
+      s_local_destroys[i]( ptr );
+    }
+  }
+}
+
+Fiber::PoolStats Fiber::GetPoolStats()
+{
+  PoolStats stats;
+  stats.hits = s_pool_hits;
+  stats.misses = s_pool_misses;
+  stats.recycled = s_pool_recycled;
+  stats.dropped = s_pool_dropped;
+  return stats;
+}
+
 void Fiber::MainFunc()
 {
-  Fiber::SPtr cur { GetThis() };
+  Fiber* cur { Current() };
   SYLAR_ASSERT( cur );
   try {
     cur->m_cb();
@@ -213,16 +309,15 @@ void Fiber::MainFunc()
                                 << sylar::BacktraceToString();
   }
 
-  auto raw_ptr { cur.get() };
-  cur.reset();
-  raw_ptr->swapOut();
+  cur->destroyLocals();
+  cur->swapOut();
 
-  SYLAR_ASSERT2( false, "never reach fiber_id = " + std::to_string( raw_ptr->getId() ) );
+  SYLAR_ASSERT2( false, "never reach fiber_id = " + std::to_string( cur->getId() ) );
 }
 
 void Fiber::CallerMainFunc()
 {
-  Fiber::SPtr cur { GetThis() };
+  Fiber* cur { Current() };
   SYLAR_ASSERT( cur );
   try {
     cur->m_cb();
@@ -238,11 +333,10 @@ void Fiber::CallerMainFunc()
                                 << sylar::BacktraceToString();
   }
 
-  auto raw_ptr = cur.get();
-  cur.reset();
-  raw_ptr->back();
+  cur->destroyLocals();
+  cur->back();
 
-  SYLAR_ASSERT2( false, "never reach fiber_id = " + std::to_string( raw_ptr->getId() ) );
+  SYLAR_ASSERT2( false, "never reach fiber_id = " + std::to_string( cur->getId() ) );
 }
 
 }
\ No newline at end of file
@@ -8,13 +8,21 @@
 namespace sylar {
 
 class Scheduler;
+template<typename T>
+class FiberLocal;
+
 class Fiber : public std::enable_shared_from_this<Fiber>
 {
   friend class Scheduler;
+  template<typename T>
+  friend class FiberLocal;
 
 public:
   using SPtr = std::shared_ptr<Fiber>;
 
+  // 协程局部存储的槽位上限
+  static constexpr std::size_t MAX_LOCALS { 8 };
+
   enum State
   {
     INIT,
@@ -25,6 +33,14 @@ public:
     EXCEPT
   };
 
+  struct PoolStats
+  {
+    std::uint64_t hits { 0 };
+    std::uint64_t misses { 0 };
+    std::uint64_t recycled { 0 };
+    std::uint64_t dropped { 0 };
+  };
+
 private:
   Fiber();  // 用于初始化当前线程的主协程
 
@@ -44,14 +60,30 @@ public:
 
   static void SetThis( Fiber* f );
   static Fiber::SPtr GetThis();
+  // 返回当前协程的裸指针，不产生引用计数开销；调用方不持有所有权
+  static Fiber* Current();
+  // 切出期间不持有自身引用：YieldToReady 由调度器重新入队持有；YieldToHold 之前调用方必须已把
+  // Fiber::SPtr 交给唤醒者（IO 事件、定时器、调度队列或其他代码），否则调度器会断言失败而不是析构挂起中的协程
   static void YieldToReady();
   static void YieldToHold();
   static uint64_t TotalFibers();
 
+  // 优先从当前线程的协程池取出已结束的协程复用其栈，未命中时新建
+  static Fiber::SPtr Create( std::function<void()> cb );
+  // 回收已结束且无其他持有者的默认栈协程，池满时丢弃
+  static void Recycle( Fiber::SPtr&& fiber );
+  static PoolStats GetPoolStats();
+
+  // 注册一个协程局部存储槽位，返回槽位下标，槽位注册后不会释放
+  static std::size_t RegisterLocal( void ( *destroy )( void* ) );
+
   static void MainFunc();
   static void CallerMainFunc();
   static std::uint64_t GetFiberId();
 
+private:
+  void destroyLocals();
+
 private:
   std::uint64_t m_id { 0 };
   std::uint32_t m_stacksize { 0 };
@@ -61,6 +93,49 @@ private:
   void* m_stack { nullptr };
 
   std::function<void()> m_cb;
+  void* m_locals[MAX_LOCALS] {};
+};
+
+// 协程局部变量，首次访问时在当前协程内默认构造，协程结束（TERM/EXCEPT）时析构
+// 每个 FiberLocal 占用一个全局槽位，应定义为静态或全局对象
+template<typename T>
+class FiberLocal
+{
+public:
+  FiberLocal() : m_index( Fiber::RegisterLocal( &FiberLocal::Destroy ) ) {}
+
+  FiberLocal( const FiberLocal& ) = delete;
+  FiberLocal& operator=( const FiberLocal& ) = delete;
+
+  T& get()
+  {
+    void*& slot { Fiber::Current()->m_locals[m_index] };
+    if ( !slot ) {
+      slot = new T();
+    }
+    return *static_cast<T*>( slot );
+  }
+
+  // 当前协程是否已创建该变量
+  bool has() const { return Fiber::Current()->m_locals[m_index] != nullptr; }
+
+  void reset()
+  {
+    void*& slot { Fiber::Current()->m_locals[m_index] };
+    if ( slot ) {
+      Destroy( slot );
+      slot = nullptr;
+    }
+  }
+
+  T& operator*() { return get(); }
+  T* operator->() { return &get(); }
+
+private:
+  static void Destroy( void* ptr ) { delete static_cast<T*>( ptr ); }
+
+private:
+  std::size_t m_index;
 };
 
 }
\ No newline at end of file
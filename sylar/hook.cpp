@@ -37,6 +37,7 @@ static thread_local bool t_hook_enable { false };
   XX( socket )                                                                                                     \
   XX( connect )                                                                                                    \
   XX( accept )                                                                                                     \
+  XX( accept4 )                                                                                                    \
   XX( read )                                                                                                       \
   XX( readv )                                                                                                      \
   XX( recv )                                                                                                       \
@@ -47,6 +48,7 @@ static thread_local bool t_hook_enable { false };
   XX( send )                                                                                                       \
   XX( sendto )                                                                                                     \
   XX( sendmsg )                                                                                                    \
+  XX( splice )                                                                                                     \
   XX( close )                                                                                                      \
   XX( fcntl )                                                                                                      \
   XX( ioctl )                                                                                                      \
@@ -109,7 +111,7 @@ static ssize_t do_io( int fd,
     return fun( fd, std::forward<Args>( args )... );
   }
 
-  sylar::FdCtx::SPtr ctx { sylar::FdMgr::GetInstance().get( fd ) };
+  sylar::FdCtx* ctx { sylar::FdMgr::GetInstance().get( fd ) };
   if ( !ctx ) {
     return fun( fd, std::forward<Args>( args )... );
   }
@@ -189,10 +191,12 @@ unsigned int sleep( unsigned int seconds )
   sylar::IOManager* iom = sylar::IOManager::GetThis();
   iom->addTimer(
     seconds * 1000,
-    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread ) ) & sylar::IOManager::schedule,
+    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread, sylar::Scheduler::Priority ) )
+                 & sylar::IOManager::schedule,
                iom,
                fiber,
-               -1 ) );
+               -1,
+               sylar::Scheduler::NORMAL ) );
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -207,10 +211,12 @@ int usleep( useconds_t usec )
   sylar::IOManager* iom = sylar::IOManager::GetThis();
   iom->addTimer(
     usec / 1000,
-    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread ) ) & sylar::IOManager::schedule,
+    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread, sylar::Scheduler::Priority ) )
+                 & sylar::IOManager::schedule,
                iom,
                fiber,
-               -1 ) );
+               -1,
+               sylar::Scheduler::NORMAL ) );
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -226,10 +232,12 @@ int nanosleep( const struct timespec* req, struct timespec* rem )
   sylar::IOManager* iom = sylar::IOManager::GetThis();
   iom->addTimer(
     timeout_ms,
-    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread ) ) & sylar::IOManager::schedule,
+    std::bind( ( void( sylar::Scheduler::* )( sylar::Fiber::SPtr, int thread, sylar::Scheduler::Priority ) )
+                 & sylar::IOManager::schedule,
                iom,
                fiber,
-               -1 ) );
+               -1,
+               sylar::Scheduler::NORMAL ) );
   sylar::Fiber::YieldToHold();
   return 0;
 }
@@ -253,7 +261,7 @@ int connect_with_timeout( int fd, const struct sockaddr* addr, socklen_t addrlen
     return connect_f( fd, addr, addrlen );
   }
 
-  sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( fd );
+  sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( fd );
   if ( !ctx || ctx->isClose() ) {
     errno = EBADF;
     return -1;
@@ -331,9 +339,27 @@ int connect( int fd, const struct sockaddr* addr, socklen_t len )
 
 int accept( int sockfd, struct sockaddr* __restrict addr, socklen_t* __restrict addr_len )
 {
-  int fd = do_io( sockfd, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addr_len );
+  return accept4( sockfd, addr, addr_len, 0 );
+}
+
+// 开启 hook 时新连接直接以 SOCK_NONBLOCK 创建，FdCtx 据此跳过 fstat 和 fcntl
+// 未开启时保持调用方要求的阻塞模式，否则未 hook 的读写会直接返回 EAGAIN
+int accept4( int sockfd, struct sockaddr* __restrict addr, socklen_t* __restrict addr_len, int flags )
+{
+  bool sys_nonblock { sylar::t_hook_enable || ( flags & SOCK_NONBLOCK ) };
+  int fd = do_io( sockfd,
+                  accept4_f,
+                  "accept4",
+                  sylar::IOManager::READ,
+                  SO_RCVTIMEO,
+                  addr,
+                  addr_len,
+                  sys_nonblock ? flags | SOCK_NONBLOCK : flags );
   if ( fd >= 0 ) {
-    sylar::FdMgr::GetInstance().get( fd, true );
+    sylar::FdCtx* ctx { sylar::FdMgr::GetInstance().addSocket( fd, sys_nonblock ) };
+    if ( ctx && ( flags & SOCK_NONBLOCK ) ) {
+      ctx->setUserNonblock( true );
+    }
   }
   return fd;
 }
@@ -389,13 +415,27 @@ ssize_t sendmsg( int s, const struct msghdr* msg, int flags )
   return do_io( s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags );
 }
 
+// 输入端是 socket 时等待可读，否则等待输出端可写；管道和文件端由调用方保证不会阻塞
+ssize_t splice( int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags )
+{
+  sylar::FdCtx* ctx { sylar::t_hook_enable ? sylar::FdMgr::GetInstance().get( fd_in ) : nullptr };
+  if ( ctx && ctx->isSocket() ) {
+    return do_io(
+      fd_in, splice_f, "splice", sylar::IOManager::READ, SO_RCVTIMEO, off_in, fd_out, off_out, len, flags );
+  }
+  auto fun = [fd_in, off_in]( int out, loff_t* off_out, size_t len, unsigned int flags ) {
+    return splice_f( fd_in, off_in, out, off_out, len, flags );
+  };
+  return do_io( fd_out, fun, "splice", sylar::IOManager::WRITE, SO_SNDTIMEO, off_out, len, flags );
+}
+
 int close( int fd )
 {
   if ( !sylar::t_hook_enable ) {
     return close_f( fd );
   }
 
-  sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( fd );
+  sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( fd );
   if ( ctx ) {
     auto iom = sylar::IOManager::GetThis();
     if ( iom ) {
@@ -415,7 +455,7 @@ int fcntl( int fd, int cmd, ... )
     case F_SETFL: {
       int arg = va_arg( va, int );
       va_end( va );
-      sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( fd );
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( fd );
       if ( !ctx || ctx->isClose() || !ctx->isSocket() ) {
         return fcntl_f( fd, cmd, arg );
       }
@@ -431,7 +471,7 @@ int fcntl( int fd, int cmd, ... )
     case F_GETFL: {
       va_end( va );
       int arg = fcntl_f( fd, cmd );
-      sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( fd );
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( fd );
       if ( !ctx || ctx->isClose() || !ctx->isSocket() ) {
         return arg;
       }
@@ -488,7 +528,7 @@ int ioctl( int d, unsigned long int request, ... )
 
   if ( FIONBIO == request ) {
     bool user_nonblock = *(int*)arg;
-    sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( d );
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( d );
     if ( !ctx || ctx->isClose() || !ctx->isSocket() ) {
       return ioctl_f( d, request, arg );
     }
@@ -510,7 +550,7 @@ int setsockopt( int sockfd, int level, int optname, const void* optval, socklen_
 
   if ( level == SOL_SOCKET ) {
     if ( optname == SO_RCVTIMEO || optname == SO_SNDTIMEO ) {
-      sylar::FdCtx::SPtr ctx = sylar::FdMgr::GetInstance().get( sockfd );
+      sylar::FdCtx* ctx = sylar::FdMgr::GetInstance().get( sockfd );
       if ( ctx ) {
         const timeval* val = (const timeval*)optval;
         ctx->setTimeout( optname, val->tv_sec * 1000 + val->tv_usec / 1000 );
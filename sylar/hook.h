@@ -35,6 +35,9 @@ extern connect_fun connect_f;
 using accept_fun = int ( * )( int s, struct sockaddr* addr, socklen_t* addrlen );
 extern accept_fun accept_f;
 
+using accept4_fun = int ( * )( int s, struct sockaddr* addr, socklen_t* addrlen, int flags );
+extern accept4_fun accept4_f;
+
 // read
 using read_fun = ssize_t ( * )( int fd, void* buf, size_t count );
 extern read_fun read_f;
@@ -69,6 +72,11 @@ extern sendto_fun sendto_f;
 using sendmsg_fun = ssize_t ( * )( int s, const struct msghdr* msg, int flags );
 extern sendmsg_fun sendmsg_f;
 
+// splice
+using splice_fun
+  = ssize_t ( * )( int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags );
+extern splice_fun splice_f;
+
 using close_fun = int ( * )( int fd );
 extern close_fun close_f;
 
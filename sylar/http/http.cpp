@@ -57,7 +57,7 @@ const char* HttpStatusToString( const HttpStatus& status )
 
 bool CaseInsensitiveLess::operator()( const std::string& lhs, const std::string& rhs ) const
 {
-  return strcasecmp( lhs.c_str(), rhs.c_str() );
+  return strcasecmp( lhs.c_str(), rhs.c_str() ) < 0;
 }
 
 HttpRequest::HttpRequest( uint8_t version, bool close )
@@ -155,7 +155,7 @@ std::string HttpRequest::toString() const
 void HttpRequest::init()
 {
   std::string conn = getHeader( "connection" );
-  if ( conn.empty() ) {
+  if ( !conn.empty() ) {
     if ( strcasecmp( conn.c_str(), "keep-alive" ) == 0 ) {
       m_close = false;
     } else {
@@ -165,6 +165,11 @@ void HttpRequest::init()
 }
 
 std::ostream& HttpRequest::dump( std::ostream& os ) const
+{
+  return dumpHead( os ) << m_body;
+}
+
+std::ostream& HttpRequest::dumpHead( std::ostream& os ) const
 {
   // GET /uri HTTP/1.1
   // Host: wwww.sylar.top
@@ -182,11 +187,9 @@ std::ostream& HttpRequest::dump( std::ostream& os ) const
   }
 
   if ( !m_body.empty() ) {
-    os << "content-length: " << m_body.size() << "\r\n\r\n" << m_body;
-  } else {
-    os << "\r\n";
+    os << "content-length: " << m_body.size() << "\r\n";
   }
-  return os;
+  return os << "\r\n";
 }
 
 HttpResponse::HttpResponse( uint8_t version, bool close )
@@ -217,6 +220,11 @@ std::string HttpResponse::toString() const
 }
 
 std::ostream& HttpResponse::dump( std::ostream& os ) const
+{
+  return dumpHead( os ) << m_body;
+}
+
+std::ostream& HttpResponse::dumpHead( std::ostream& os ) const
 {
   os << "HTTP/" << ( (uint32_t)( m_version >> 4 ) ) << "." << ( (uint32_t)( m_version & 0x0F ) ) << " "
      << (uint32_t)m_status << " " << ( m_reason.empty() ? HttpStatusToString( m_status ) : m_reason ) << "\r\n";
@@ -230,11 +238,9 @@ std::ostream& HttpResponse::dump( std::ostream& os ) const
   os << "connection: " << ( m_close ? "close" : "keep-alive" ) << "\r\n";
 
   if ( !m_body.empty() ) {
-    os << "content-length: " << m_body.size() << "\r\n\r\n";
-  } else {
-    os << "\r\n";
+    os << "content-length: " << m_body.size() << "\r\n";
   }
-  return os;
+  return os << "\r\n";
 }
 
 std::ostream& operator<<( std::ostream& os, const HttpRequest& req )
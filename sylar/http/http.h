@@ -223,6 +223,8 @@ public:
   }
 
   std::ostream& dump( std::ostream& os ) const;
+  // 只输出起始行和头部（含 content-length 与空行），正文由调用方另行发送
+  std::ostream& dumpHead( std::ostream& os ) const;
   std::string toString() const;
 
   void init();
@@ -280,6 +282,8 @@ public:
   }
 
   std::ostream& dump( std::ostream& os ) const;
+  // 只输出起始行和头部（含 content-length 与空行），正文由调用方另行发送
+  std::ostream& dumpHead( std::ostream& os ) const;
   std::string toString() const;
 
 private:
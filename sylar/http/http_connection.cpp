@@ -73,10 +73,15 @@ HttpResponse::SPtr HttpConnection::recvResponse()
 
 int HttpConnection::sendRequest( HttpRequest::SPtr rsp )
 {
+  // 头部与正文一起排队，以一次 sendmsg 发出；正文不拷贝，由 rsp 保持存活
   std::stringstream ss;
-  ss << *rsp;
-  std::string data = ss.str();
-  return writeFixSize( data.c_str(), data.size() );
+  rsp->dumpHead( ss );
+  std::string head = ss.str();
+  const std::string& body { rsp->getBody() };
+  if ( queue( head.data(), head.size() ) < 0 || queue( body.data(), body.size(), rsp ) < 0 || flush() < 0 ) {
+    return -1;
+  }
+  return head.size() + body.size();
 }
 
 HttpResult::SPtr HttpConnection::DoGet( const std::string& url,
@@ -269,6 +274,9 @@ HttpConnection::SPtr HttpConnectionPool::getConnection()
       // SYLAR_LOG_ERROR(g_logger) < "create sock fail: " << *addr;
       return nullptr;
     }
+    if ( socketProfile_ ) {
+      socketProfile_->apply( *sock, SocketProfile::CONNECT );
+    }
     if ( !sock->connect( addr ) ) {
       // SYLAR_LOG_ERROR(g_logger) << "sock connect fail: " << *addr;
       return nullptr;
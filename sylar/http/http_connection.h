@@ -2,6 +2,7 @@
 
 #include "sylar/http/http.h"
 #include "sylar/socket.h"
+#include "sylar/socket_profile.h"
 #include "sylar/socket_stream.h"
 #include "sylar/thread.h"
 #include "sylar/uri.h"
@@ -114,6 +115,9 @@ public:
 
   HttpConnection::SPtr getConnection();
 
+  // 引用 socket.profiles 中的调优配置，新建连接在 connect 之前应用
+  void setSocketProfile( const std::string& name ) { socketProfile_ = SocketProfile::Get( name ); }
+
   HttpResult::SPtr doGet( const std::string& url,
                           uint64_t timeout_ms,
                           const std::map<std::string, std::string>& headers = {},
@@ -161,6 +165,7 @@ private:
   MutexType mutex_;
   std::list<HttpConnection*> conns_;
   std::atomic<int32_t> total_ { 0 };
+  SocketProfile::SPtr socketProfile_;
 };
 
 }
@@ -20,6 +20,14 @@ static sylar::ConfigVar<uint64_t>::SPtr g_http_request_max_body_size
                            (uint64_t)( 64 * 1024 * 1024 ),
                            "http request max body size" );
 
+static sylar::ConfigVar<uint64_t>::SPtr g_http_response_buffer_size
+  = sylar::Config::Lookup( "http.response.buffer_size", (uint64_t)( 4 * 1024 ), "http response buffer size" );
+
+static sylar::ConfigVar<uint64_t>::SPtr g_http_response_max_body_size
+  = sylar::Config::Lookup( "http.response.max_body_size",
+                           (uint64_t)( 64 * 1024 * 1024 ),
+                           "http response max body size" );
+
 static uint64_t s_http_request_buffer_size = 0;
 static uint64_t s_http_request_max_body_size = 0;
 static uint64_t s_http_response_buffer_size = 0;
@@ -56,6 +64,15 @@ struct RequestSizeIniter
 
     g_http_request_max_body_size->addListener(
       []( const uint64_t& oldVal, const uint64_t newVal ) { s_http_request_max_body_size = newVal; } );
+
+    s_http_response_buffer_size = g_http_response_buffer_size->getValue();
+    s_http_response_max_body_size = g_http_response_max_body_size->getValue();
+
+    g_http_response_buffer_size->addListener(
+      []( const uint64_t& oldVal, const uint64_t& newVal ) { s_http_response_buffer_size = newVal; } );
+
+    g_http_response_max_body_size->addListener(
+      []( const uint64_t& oldVal, const uint64_t newVal ) { s_http_response_max_body_size = newVal; } );
   }
 };
 
@@ -1,4 +1,5 @@
 #include "sylar/http/http_server.h"
+#include "sylar/config.h"
 #include "sylar/http/http.h"
 #include "sylar/http/http_servlet.h"
 #include "sylar/http/http_session.h"
@@ -6,6 +7,8 @@
 #include "sylar/log.h"
 #include "sylar/socket.h"
 #include "sylar/tcp_server.h"
+#include "sylar/timer.h"
+#include <atomic>
 #include <memory>
 
 namespace sylar {
@@ -13,12 +16,16 @@ namespace http {
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_NAME( "system" );
 
+static sylar::ConfigVar<bool>::SPtr g_http_server_release_idle_fiber = sylar::Config::Lookup(
+  "http.server.release_idle_fiber", false, "release the fiber of idle keep-alive connections" );
+
 HttpServer::HttpServer( bool keepAlive,
                         sylar::IOManager* worker,
                         sylar::IOManager* ioWorker,
                         sylar::IOManager* acceptWorker )
   : TcpServer { ioWorker, acceptWorker }
   , isKeepAlive_( keepAlive )
+  , releaseIdleFiber_( g_http_server_release_idle_fiber->getValue() )
   , dispatch_ { std::make_shared<ServletDispatch>() }
 {
   m_type = "http";
@@ -34,26 +41,101 @@ void HttpServer::handleClient( Socket::SPtr client )
 {
   SYLAR_LOG_DEBUG( g_logger ) << "handleClient " << *client;
   HttpSession::SPtr session( std::make_shared<HttpSession>( client ) );
+  if ( releaseIdleFiber_ && isKeepAlive_ ) {
+    waitRequest( session );
+    return;
+  }
+
+  while ( handleRequest( session ) ) {
+  }
+
+  session->close();
+}
+
+// 处理一个请求，返回连接是否需要保持
+bool HttpServer::handleRequest( HttpSession::SPtr session )
+{
+  auto req = session->recvRequest();
+  if ( !req ) {
+    SYLAR_LOG_DEBUG( g_logger ) << "recv http request fail, errno=" << errno << " errstr=" << strerror( errno )
+                                << "client:" << *session->getSocket() << "keep_alive=" << isKeepAlive_;
+    return false;
+  }
+
+  HttpResponse::SPtr rsp { std::make_shared<HttpResponse>( req->getVersion(), req->isClose() || !isKeepAlive_ ) };
+  rsp->setHeader( "Server", getName() );
+  dispatch_->handle( req, rsp, session );
+  session->sendResponse( rsp );
+
+  return isKeepAlive_ && !req->isClose();
+}
 
-  do {
-    auto req = session->recvRequest();
-    if ( !req ) {
-      SYLAR_LOG_DEBUG( g_logger ) << "recv http request fail, errno=" << errno << " errstr=" << strerror( errno )
-                                  << "client:" << *client << "keep_alive=" << isKeepAlive_;
-      break;
+// 等待下一个请求的首字节：只保留读事件回调和超时定时器，回调触发时由调度器分配（池化的）协程处理请求
+void HttpServer::waitRequest( HttpSession::SPtr session )
+{
+  enum WaitState
+  {
+    WAITING,
+    READY,
+    TIMEOUT
+  };
+
+  // 读事件与超时谁先把状态从 WAITING 改掉谁生效
+  struct IdleWait
+  {
+    std::atomic<int> state { WAITING };
+    Timer::SPtr timer;
+  };
+
+  int fd { session->getSocket()->getSocket() };
+  IOManager* iom { m_worker };
+  auto self = std::static_pointer_cast<HttpServer>( shared_from_this() );
+  auto wait = std::make_shared<IdleWait>();
+
+  if ( m_recvTimeout != (uint64_t)-1 ) {
+    std::weak_ptr<IdleWait> weak_wait( wait );
+    wait->timer = iom->addConditionTimer(
+      m_recvTimeout,
+      [weak_wait, fd, iom]() {
+        auto w = weak_wait.lock();
+        int expected { WAITING };
+        if ( w && w->state.compare_exchange_strong( expected, TIMEOUT ) ) {
+          iom->cancelEvent( fd, IOManager::READ );
+        }
+      },
+      weak_wait );
+  }
+
+  int rt = iom->addEvent( fd, IOManager::READ, [self, session, wait]() {
+    int expected { WAITING };
+    if ( !wait->state.compare_exchange_strong( expected, READY ) ) {
+      session->close();
+      return;
     }
 
-    HttpResponse::SPtr rsp { std::make_shared<HttpResponse>( req->getVersion(), req->isClose() || !isKeepAlive_ ) };
-    rsp->setHeader( "Server", getName() );
-    dispatch_->handle( req, rsp, session );
-    session->sendResponse( rsp );
+    if ( wait->timer ) {
+      wait->timer->cancel();
+    }
 
-    if ( !isKeepAlive_ || req->isClose() ) {
-      break;
+    if ( self->isStop() || !self->handleRequest( session ) ) {
+      session->close();
+      return;
     }
-  } while ( true );
-  
-  session->close();
+    self->waitRequest( session );
+  } );
+  if ( rt ) {
+    SYLAR_LOG_ERROR( g_logger ) << "wait http request addEvent fail, client:" << *session->getSocket();
+    if ( wait->timer ) {
+      wait->timer->cancel();
+    }
+    session->close();
+    return;
+  }
+
+  // 定时器在注册事件之前已超时
+  if ( wait->state == TIMEOUT ) {
+    iom->cancelEvent( fd, IOManager::READ );
+  }
 }
 
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "sylar/http/http_servlet.h"
+#include "sylar/http/http_session.h"
 #include "sylar/iomanager.h"
 #include "sylar/socket.h"
 #include "sylar/tcp_server.h"
@@ -24,11 +25,20 @@ public:
 
   virtual void setName( const std::string& val ) override;
 
+  // 空闲的长连接不占用协程，等待下一个请求时只注册读事件，有数据到达才分配协程处理
+  bool isReleaseIdleFiber() const { return releaseIdleFiber_; }
+  void setReleaseIdleFiber( bool val ) { releaseIdleFiber_ = val; }
+
 protected:
   virtual void handleClient( Socket::SPtr client ) override;
 
+private:
+  bool handleRequest( HttpSession::SPtr session );
+  void waitRequest( HttpSession::SPtr session );
+
 private:
   bool isKeepAlive_;
+  bool releaseIdleFiber_;
   ServletDispatch::SPtr dispatch_;
 };
 
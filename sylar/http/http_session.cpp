@@ -49,10 +49,15 @@ HttpRequest::SPtr HttpSession::recvRequest()
 
 int HttpSession::sendResponse( HttpResponse::SPtr rsp )
 {
+  // 头部与正文一起排队，以一次 sendmsg 发出；正文不拷贝，由 rsp 保持存活
   std::stringstream ss;
-  ss << *rsp;
-  std::string data = ss.str();
-  return writeFixSize( data.c_str(), data.size() );
+  rsp->dumpHead( ss );
+  std::string head = ss.str();
+  const std::string& body { rsp->getBody() };
+  if ( queue( head.data(), head.size() ) < 0 || queue( body.data(), body.size(), rsp ) < 0 || flush() < 0 ) {
+    return -1;
+  }
+  return head.size() + body.size();
 }
 
 }
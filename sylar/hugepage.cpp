@@ -0,0 +1,295 @@
+#include "hugepage.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <string>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <vector>
+
+namespace sylar {
+
+static Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+// thp/hugetlb 下协程栈按大页整体驻留：1MiB 的栈即使只用到几 KiB 也占满 1MiB 物理内存，
+// 且释放的块只回到空闲链表、区域不归还内核，这会抵消 http.server.release_idle_fiber 节省的空闲内存，
+// 适合协程数有限、看重 TLB 命中的场景；大量空闲长连接时应保持 off
+static ConfigVar<std::string>::SPtr g_hugepage_mode { Config::Lookup(
+  "hugepage.mode",
+  std::string( "off" ),
+  "fiber stack and buffer backing: off, thp or hugetlb; thp/hugetlb keep every fiber stack fully resident" ) };
+
+static std::atomic<int> s_hugepage_mode { HugePageAllocator::OFF };
+// 已映射的区域数，为 0 时释放直接走 free，无需加锁查找
+static std::atomic<std::size_t> s_region_count { 0 };
+
+static HugePageAllocator::Mode ParseMode( const std::string& mode )
+{
+  if ( mode == "thp" ) {
+    return HugePageAllocator::THP;
+  }
+  if ( mode == "hugetlb" ) {
+    return HugePageAllocator::HUGETLB;
+  }
+  if ( mode != "off" ) {
+    SYLAR_LOG_ERROR( g_logger ) << "unknown hugepage.mode=" << mode << ", use off";
+  }
+  return HugePageAllocator::OFF;
+}
+
+struct _HugePageIniter
+{
+  _HugePageIniter()
+  {
+    s_hugepage_mode = ParseMode( g_hugepage_mode->getValue() );
+    g_hugepage_mode->addListener( []( const std::string& old_value, const std::string& new_value ) {
+      s_hugepage_mode = ParseMode( new_value );
+    } );
+  }
+};
+
+static _HugePageIniter s_hugepage_initer;
+
+namespace {
+
+// 大页区域的切分状态，按线程分片以减少锁竞争；释放的块按大小挂回所属分片的空闲链表复用
+struct Arena
+{
+  Mutex mutex;
+  std::unordered_map<std::size_t, std::vector<void*>> freeBlocks;
+  char* cur { nullptr };
+  std::size_t left { 0 };
+  HugePageAllocator::Stats stats;
+};
+
+struct Region
+{
+  std::size_t size;
+  // 切分该区域的分片
+  std::size_t shard;
+};
+
+struct Arenas
+{
+  static constexpr std::size_t SHARDS { 8 };
+
+  Arena shards[SHARDS];
+  // 区域起始地址 -> 区域，只在映射、解除映射时加写锁
+  RWMutex mutex;
+  std::map<std::uintptr_t, Region> regions;
+};
+
+} // namespace
+
+// 进程退出时仍可能有协程栈归还，故不析构
+static Arenas& GetArenas()
+{
+  static Arenas* s_arenas { new Arenas };
+  return *s_arenas;
+}
+
+static std::size_t CurrentShard()
+{
+  static thread_local std::size_t t_shard { static_cast<std::size_t>( GetThreadId() ) % Arenas::SHARDS };
+  return t_shard;
+}
+
+static std::size_t RoundUp( std::size_t size, std::size_t align )
+{
+  return ( size + align - 1 ) / align * align;
+}
+
+// 小块按缓存行对齐，页大小以上按页对齐，保证协程栈起始地址页对齐
+static std::size_t BlockSize( std::size_t size )
+{
+  return size < 4096 ? RoundUp( size ? size : 1, 64 ) : RoundUp( size, 4096 );
+}
+
+// 映射一个 2MiB 对齐的区域并登记到 regions，调用方持有分片锁
+static char* MapRegion( Arena& arena, std::size_t shard, std::size_t size, HugePageAllocator::Mode mode )
+{
+  static std::atomic<bool> s_hugetlb_warned { false };
+  const std::size_t pages { size / HugePageAllocator::HUGE_PAGE_SIZE };
+  char* ptr { nullptr };
+  if ( mode == HugePageAllocator::HUGETLB ) {
+    void* raw = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( raw != MAP_FAILED ) {
+      arena.stats.hugetlbPages += pages;
+      ptr = static_cast<char*>( raw );
+    } else {
+      ++arena.stats.hugetlbFailures;
+      if ( !s_hugetlb_warned.exchange( true ) ) {
+        SYLAR_LOG_WARN( g_logger ) << "mmap MAP_HUGETLB fail, errno=" << errno << " errstr=" << strerror( errno )
+                                   << ", fall back to transparent huge pages";
+      }
+    }
+  }
+
+  if ( !ptr ) {
+    // 多映射一个大页用于对齐，再裁掉首尾
+    const std::size_t map_size { size + HugePageAllocator::HUGE_PAGE_SIZE };
+    void* raw = mmap( nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( raw == MAP_FAILED ) {
+      SYLAR_LOG_ERROR( g_logger ) << "mmap hugepage region fail, size=" << size << " errno=" << errno
+                                  << " errstr=" << strerror( errno );
+      return nullptr;
+    }
+    std::uintptr_t begin { reinterpret_cast<std::uintptr_t>( raw ) };
+    std::uintptr_t aligned { RoundUp( begin, HugePageAllocator::HUGE_PAGE_SIZE ) };
+    if ( aligned > begin ) {
+      munmap( raw, aligned - begin );
+    }
+    std::size_t tail { begin + map_size - ( aligned + size ) };
+    if ( tail ) {
+      munmap( reinterpret_cast<void*>( aligned + size ), tail );
+    }
+
+    ptr = reinterpret_cast<char*>( aligned );
+    if ( madvise( ptr, size, MADV_HUGEPAGE ) == 0 ) {
+      arena.stats.thpPages += pages;
+    } else {
+      arena.stats.fallbackPages += pages;
+    }
+  }
+
+  Arenas& arenas { GetArenas() };
+  RWMutex::WriteLock lock( arenas.mutex );
+  arenas.regions[reinterpret_cast<std::uintptr_t>( ptr )] = { size, shard };
+  s_region_count = arenas.regions.size();
+  return ptr;
+}
+
+void* HugePageAllocator::Alloc( std::size_t size )
+{
+  Mode mode { static_cast<Mode>( s_hugepage_mode.load( std::memory_order_relaxed ) ) };
+  if ( mode == OFF ) {
+    return std::malloc( size );
+  }
+
+  const std::size_t block { BlockSize( size ) };
+  const std::size_t shard { CurrentShard() };
+  Arena& arena { GetArenas().shards[shard] };
+  Mutex::Lock lock( arena.mutex );
+  auto it = arena.freeBlocks.find( block );
+  if ( it != arena.freeBlocks.end() && !it->second.empty() ) {
+    void* ptr { it->second.back() };
+    it->second.pop_back();
+    ++arena.stats.allocs;
+    ++arena.stats.reused;
+    arena.stats.bytesInUse += block;
+    return ptr;
+  }
+
+  char* ptr { nullptr };
+  if ( block > HUGE_PAGE_SIZE ) {
+    // 超过一个大页的块单独映射，释放时解除映射
+    ptr = MapRegion( arena, shard, RoundUp( block, HUGE_PAGE_SIZE ), mode );
+  } else {
+    if ( block > arena.left ) {
+      // 当前区域剩余的尾部不足以容纳该块，直接丢弃
+      char* region { MapRegion( arena, shard, HUGE_PAGE_SIZE, mode ) };
+      if ( region ) {
+        arena.cur = region;
+        arena.left = HUGE_PAGE_SIZE;
+      }
+    }
+    if ( block <= arena.left ) {
+      ptr = arena.cur;
+      arena.cur += block;
+      arena.left -= block;
+    }
+  }
+
+  if ( !ptr ) {
+    return std::malloc( size );
+  }
+  ++arena.stats.allocs;
+  arena.stats.bytesInUse += block;
+  return ptr;
+}
+
+void HugePageAllocator::Dealloc( void* ptr, std::size_t size )
+{
+  if ( !ptr ) {
+    return;
+  }
+  if ( s_region_count.load( std::memory_order_relaxed ) == 0 ) {
+    std::free( ptr );
+    return;
+  }
+
+  Arenas& arenas { GetArenas() };
+  std::uintptr_t addr { reinterpret_cast<std::uintptr_t>( ptr ) };
+  const std::size_t block { BlockSize( size ) };
+  std::size_t shard { 0 };
+  {
+    RWMutex::ReadLock lock( arenas.mutex );
+    auto it = arenas.regions.upper_bound( addr );
+    if ( it == arenas.regions.begin() || addr >= std::prev( it )->first + std::prev( it )->second.size ) {
+      // 关闭大页前或映射失败时由 malloc 分配的块
+      lock.unlock();
+      std::free( ptr );
+      return;
+    }
+    shard = std::prev( it )->second.shard;
+  }
+
+  Arena& arena { arenas.shards[shard] };
+  if ( block > HUGE_PAGE_SIZE ) {
+    const std::size_t region_size { RoundUp( block, HUGE_PAGE_SIZE ) };
+    {
+      RWMutex::WriteLock lock( arenas.mutex );
+      arenas.regions.erase( addr );
+      s_region_count = arenas.regions.size();
+    }
+    munmap( ptr, region_size );
+    Mutex::Lock lock( arena.mutex );
+    arena.stats.bytesInUse -= block;
+    return;
+  }
+
+  Mutex::Lock lock( arena.mutex );
+  arena.freeBlocks[block].push_back( ptr );
+  arena.stats.bytesInUse -= block;
+}
+
+HugePageAllocator::Mode HugePageAllocator::GetMode()
+{
+  return static_cast<Mode>( s_hugepage_mode.load( std::memory_order_relaxed ) );
+}
+
+HugePageAllocator::Stats HugePageAllocator::GetStats()
+{
+  Stats total;
+  for ( Arena& arena : GetArenas().shards ) {
+    Mutex::Lock lock( arena.mutex );
+    total.hugetlbPages += arena.stats.hugetlbPages;
+    total.thpPages += arena.stats.thpPages;
+    total.fallbackPages += arena.stats.fallbackPages;
+    total.hugetlbFailures += arena.stats.hugetlbFailures;
+    total.allocs += arena.stats.allocs;
+    total.reused += arena.stats.reused;
+    total.bytesInUse += arena.stats.bytesInUse;
+  }
+  return total;
+}
+
+std::ostream& HugePageAllocator::Dump( std::ostream& os )
+{
+  static const char* s_mode_names[] { "off", "thp", "hugetlb" };
+  Stats stats { GetStats() };
+  os << "[HugePage mode=" << s_mode_names[GetMode()] << " hugetlb_pages=" << stats.hugetlbPages
+     << " thp_pages=" << stats.thpPages << " fallback_pages=" << stats.fallbackPages
+     << " hugetlb_failures=" << stats.hugetlbFailures << " allocs=" << stats.allocs << " reused=" << stats.reused
+     << " bytes_in_use=" << stats.bytesInUse << "]";
+  return os;
+}
+
+} // namespace sylar
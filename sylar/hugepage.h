@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace sylar {
+
+// 从 2MiB 大页区域中切分内存，供协程栈和 ByteArray 节点使用以降低 TLB 缺失
+// hugepage.mode: off 直接使用 malloc；thp 使用 madvise(MADV_HUGEPAGE)；hugetlb 使用 MAP_HUGETLB，失败时回退到 thp
+// 2MiB 区域切分后不再归还，释放的块留在空闲链表复用；超过一个大页的块单独映射，释放时解除映射
+class HugePageAllocator
+{
+public:
+  enum Mode
+  {
+    OFF = 0,
+    THP = 1,
+    HUGETLB = 2
+  };
+
+  static constexpr std::size_t HUGE_PAGE_SIZE { 2 * 1024 * 1024 };
+
+  struct Stats
+  {
+    // 通过 MAP_HUGETLB 映射的大页数
+    std::uint64_t hugetlbPages { 0 };
+    // 通过 madvise(MADV_HUGEPAGE) 申请透明大页的区域数（是否真正合并由内核决定）
+    std::uint64_t thpPages { 0 };
+    // 大页映射失败后退回普通页的区域数
+    std::uint64_t fallbackPages { 0 };
+    // MAP_HUGETLB 失败次数（通常是未预留 nr_hugepages）
+    std::uint64_t hugetlbFailures { 0 };
+    std::uint64_t allocs { 0 };
+    std::uint64_t reused { 0 };
+    std::uint64_t bytesInUse { 0 };
+  };
+
+  static void* Alloc( std::size_t size );
+
+  static void Dealloc( void* ptr, std::size_t size );
+
+  static Mode GetMode();
+
+  static Stats GetStats();
+
+  static std::ostream& Dump( std::ostream& os );
+};
+
+} // namespace sylar
@@ -0,0 +1,239 @@
+#include "sylar/iobuf.h"
+#include "sylar/chunk_pool.h"
+#include "sylar/config.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+
+namespace sylar {
+
+static ConfigVar<uint32_t>::SPtr g_iobuf_block_size = Config::Lookup(
+  "iobuf.block_size", (uint32_t)4096, "IOBuf block size, pooled when listed in bytearray.pool.sizes" );
+
+static std::atomic<uint32_t> s_block_size { 4096 };
+
+struct _IOBufIniter
+{
+  _IOBufIniter()
+  {
+    s_block_size = g_iobuf_block_size->getValue();
+    g_iobuf_block_size->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_block_size = new_value; } );
+  }
+};
+
+static _IOBufIniter s_iobuf_initer;
+
+// 块归还给 ChunkPool 时需要申请时的大小
+static std::shared_ptr<char> make_block( char* ptr, std::size_t size )
+{
+  return std::shared_ptr<char>( ptr, [size]( char* p ) { ChunkPool::Dealloc( p, size ); } );
+}
+
+std::size_t IOBuf::tailSpace() const
+{
+  if ( !m_tailEnd || m_segments.empty() || m_segments.back().block.use_count() != 1 ) {
+    return 0;
+  }
+  const Segment& tail { m_segments.back() };
+  return m_tailEnd - ( tail.data + tail.length );
+}
+
+void IOBuf::allocTail()
+{
+  uint32_t size { s_block_size };
+  if ( size == 0 ) {
+    size = 4096;
+  }
+  char* ptr { static_cast<char*>( ChunkPool::Alloc( size ) ) };
+  m_segments.push_back( { make_block( ptr, size ), ptr, 0 } );
+  m_tailEnd = ptr + size;
+}
+
+void IOBuf::append( const void* data, std::size_t length )
+{
+  const char* src { static_cast<const char*>( data ) };
+  while ( length > 0 ) {
+    std::size_t space { tailSpace() };
+    if ( space == 0 ) {
+      allocTail();
+      space = tailSpace();
+    }
+    Segment& tail { m_segments.back() };
+    std::size_t len { std::min( length, space ) };
+    std::memcpy( tail.data + tail.length, src, len );
+    tail.length += len;
+    m_size += len;
+    src += len;
+    length -= len;
+  }
+}
+
+void IOBuf::append( const IOBuf& other )
+{
+  if ( &other == this ) {
+    IOBuf copy { other };
+    append( std::move( copy ) );
+    return;
+  }
+  m_segments.insert( m_segments.end(), other.m_segments.begin(), other.m_segments.end() );
+  m_size += other.m_size;
+  // 尾块已与 other 共享
+  m_tailEnd = nullptr;
+}
+
+void IOBuf::append( IOBuf&& other )
+{
+  if ( other.empty() ) {
+    return;
+  }
+  if ( &other == this ) {
+    append( static_cast<const IOBuf&>( other ) );
+    return;
+  }
+  std::move( other.m_segments.begin(), other.m_segments.end(), std::back_inserter( m_segments ) );
+  m_size += other.m_size;
+  // other 独占的尾块转给本对象
+  m_tailEnd = other.m_tailEnd;
+  other.clear();
+}
+
+void IOBuf::append( ByteArray&& ba )
+{
+  std::size_t position { ba.m_position };
+  std::size_t remain { ba.getReadSize() };
+  ByteArray::Node* node { ba.m_root };
+  for ( std::size_t skip = position / ba.m_baseSize; skip > 0; --skip ) {
+    node = node->next;
+  }
+  std::size_t offset { position % ba.m_baseSize };
+  while ( remain > 0 && node ) {
+    std::size_t len { std::min( remain, node->size - offset ) };
+    m_segments.push_back( { make_block( node->ptr, node->size ), node->ptr + offset, len } );
+    node->ptr = nullptr;
+    m_size += len;
+    remain -= len;
+    offset = 0;
+    node = node->next;
+  }
+  // 节点内存可能被其他对象共享，不再向尾块追加
+  m_tailEnd = nullptr;
+
+  ba.clear();
+  if ( !ba.m_root->ptr ) {
+    ba.m_root->ptr = static_cast<char*>( ChunkPool::Alloc( ba.m_root->size ) );
+  }
+}
+
+int IOBuf::appendFrom( Stream& stream, std::size_t length )
+{
+  std::size_t space { tailSpace() };
+  if ( space == 0 ) {
+    allocTail();
+    space = tailSpace();
+  }
+  Segment& tail { m_segments.back() };
+  int ret = stream.read( tail.data + tail.length, std::min( length, space ) );
+  if ( ret > 0 ) {
+    tail.length += ret;
+    m_size += ret;
+  } else if ( tail.length == 0 ) {
+    m_segments.pop_back();
+    m_tailEnd = nullptr;
+  }
+  return ret;
+}
+
+IOBuf IOBuf::slice( std::size_t offset, std::size_t length ) const
+{
+  IOBuf buf;
+  for ( auto& seg : m_segments ) {
+    if ( length == 0 ) {
+      break;
+    }
+    if ( offset >= seg.length ) {
+      offset -= seg.length;
+      continue;
+    }
+    std::size_t len { std::min( length, seg.length - offset ) };
+    buf.m_segments.push_back( { seg.block, seg.data + offset, len } );
+    buf.m_size += len;
+    length -= len;
+    offset = 0;
+  }
+  return buf;
+}
+
+void IOBuf::consume( std::size_t length )
+{
+  length = std::min( length, m_size );
+  m_size -= length;
+  while ( length > 0 ) {
+    Segment& head { m_segments.front() };
+    if ( length < head.length ) {
+      head.data += length;
+      head.length -= length;
+      break;
+    }
+    length -= head.length;
+    m_segments.pop_front();
+  }
+  if ( m_segments.empty() ) {
+    m_tailEnd = nullptr;
+  }
+}
+
+void IOBuf::clear()
+{
+  m_segments.clear();
+  m_size = 0;
+  m_tailEnd = nullptr;
+}
+
+std::size_t IOBuf::copyTo( void* buffer, std::size_t length, std::size_t offset ) const
+{
+  char* dst { static_cast<char*>( buffer ) };
+  std::size_t copied { 0 };
+  for ( auto& seg : m_segments ) {
+    if ( copied == length ) {
+      break;
+    }
+    if ( offset >= seg.length ) {
+      offset -= seg.length;
+      continue;
+    }
+    std::size_t len { std::min( length - copied, seg.length - offset ) };
+    std::memcpy( dst + copied, seg.data + offset, len );
+    copied += len;
+    offset = 0;
+  }
+  return copied;
+}
+
+std::string IOBuf::toString() const
+{
+  std::string str( m_size, '\0' );
+  if ( m_size ) {
+    copyTo( &str[0], m_size );
+  }
+  return str;
+}
+
+std::size_t IOBuf::getReadBuffers( std::vector<iovec>& buffers, std::size_t length ) const
+{
+  std::size_t total { 0 };
+  for ( auto& seg : m_segments ) {
+    if ( total == length ) {
+      break;
+    }
+    std::size_t len { std::min( length - total, seg.length ) };
+    if ( len ) {
+      buffers.push_back( { seg.data, len } );
+      total += len;
+    }
+  }
+  return total;
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "sylar/bytearray.h"
+#include "sylar/stream.h"
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <vector>
+
+namespace sylar {
+
+// 由引用计数内存块拼接成的缓冲区：拷贝、slice、追加另一个 IOBuf 或 ByteArray 都只复制块引用，不复制数据。
+// 块被多个 IOBuf 共享后只读，只有独占尾块时 append 才会写入其剩余空间
+class IOBuf
+{
+public:
+  using SPtr = std::shared_ptr<IOBuf>;
+
+  struct Segment
+  {
+    std::shared_ptr<char> block;
+    char* data;
+    std::size_t length;
+  };
+
+  // 按块遍历，每块为一个 string_view
+  class const_iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view*;
+    using reference = std::string_view;
+
+    explicit const_iterator( std::deque<Segment>::const_iterator it ) : m_it { it } {}
+
+    std::string_view operator*() const { return { m_it->data, m_it->length }; }
+    const_iterator& operator++()
+    {
+      ++m_it;
+      return *this;
+    }
+    const_iterator operator++( int ) { return const_iterator { m_it++ }; }
+    bool operator==( const const_iterator& rhs ) const { return m_it == rhs.m_it; }
+    bool operator!=( const const_iterator& rhs ) const { return m_it != rhs.m_it; }
+
+  private:
+    std::deque<Segment>::const_iterator m_it;
+  };
+
+  IOBuf() = default;
+
+  // 拷贝数据，优先写入独占尾块的剩余空间，不够时从 ChunkPool 申请 iobuf.block_size 大小的新块
+  void append( const void* data, std::size_t length );
+  void append( const std::string& data ) { append( data.data(), data.size() ); }
+  // 共享 other 的块
+  void append( const IOBuf& other );
+  void append( IOBuf&& other );
+  // 接管 ba 中可读部分所在节点的内存，之后 ba 被清空
+  void append( ByteArray&& ba );
+  // 从 stream 读至多 length 字节追加到尾部，返回值同 Stream::read
+  int appendFrom( Stream& stream, std::size_t length );
+
+  // 与本对象共享块的子区间，超出部分被截断
+  IOBuf slice( std::size_t offset, std::size_t length ) const;
+  // 丢弃开头 length 字节
+  void consume( std::size_t length );
+  void clear();
+
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  std::size_t getSegmentCount() const { return m_segments.size(); }
+
+  const_iterator begin() const { return const_iterator { m_segments.begin() }; }
+  const_iterator end() const { return const_iterator { m_segments.end() }; }
+
+  // 从 offset 起拷贝至多 length 字节，返回拷贝的字节数
+  std::size_t copyTo( void* buffer, std::size_t length, std::size_t offset = 0 ) const;
+  std::string toString() const;
+  // 直接指向块内存的 iovec，可交给 writev/sendmsg，返回覆盖的字节数
+  std::size_t getReadBuffers( std::vector<iovec>& buffers,
+                              std::size_t length = std::numeric_limits<std::size_t>::max() ) const;
+
+private:
+  // 尾块剩余的可写空间，尾块不是本对象独占时为 0
+  std::size_t tailSpace() const;
+  // 追加一个新申请的块，之后可写入其剩余空间
+  void allocTail();
+
+private:
+  std::deque<Segment> m_segments;
+  std::size_t m_size { 0 };
+  // 尾块的容量末尾，尾块不是本对象申请的时为 nullptr
+  const char* m_tailEnd { nullptr };
+};
+
+}
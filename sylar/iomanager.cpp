@@ -1,4 +1,5 @@
 #include "iomanager.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "sylar/fiber.h"
@@ -7,6 +8,7 @@
 
 #include <cassert>
 #include <cerrno>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -14,6 +16,7 @@
 #include <functional>
 #include <limits>
 #include <memory>
+#include <pthread.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <vector>
@@ -22,6 +25,43 @@ namespace sylar {
 
 static sylar::Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
 
+static sylar::ConfigVar<bool>::SPtr g_iomanager_direct_resume { sylar::Config::Lookup(
+  "iomanager.direct_resume", true, "resume the first woken fiber of an epoll batch on the polling thread" ) };
+
+static std::atomic<bool> s_direct_resume { true };
+
+// 定向唤醒 epoll_pwait 中的指定线程；共享 epfd 上的 tickle 管道只能唤醒任意一个空闲线程
+static const int s_wake_signal { SIGRTMIN };
+
+static void OnWakeSignal( int )
+{
+}
+
+struct _IOManagerIniter
+{
+  _IOManagerIniter()
+  {
+    // 不设置 SA_RESTART，epoll_pwait 收到信号后以 EINTR 返回
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = OnWakeSignal;
+    sigemptyset( &action.sa_mask );
+    sigaction( s_wake_signal, &action, nullptr );
+    // 在创建任何线程和协程之前屏蔽唤醒信号：swapcontext 会恢复协程创建时的信号掩码，
+    // 只在 idle 里屏蔽的话切到其他协程时信号会被提前消费掉
+    sigset_t wake_set;
+    sigemptyset( &wake_set );
+    sigaddset( &wake_set, s_wake_signal );
+    pthread_sigmask( SIG_BLOCK, &wake_set, nullptr );
+
+    s_direct_resume = g_iomanager_direct_resume->getValue();
+    g_iomanager_direct_resume->addListener(
+      []( const bool& old_value, const bool& new_value ) { s_direct_resume = new_value; } );
+  }
+};
+
+static _IOManagerIniter s_iomanager_initer;
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext( IOManager::Event event )
 {
   switch ( event ) {
@@ -37,21 +77,30 @@ IOManager::FdContext::EventContext& IOManager::FdContext::getContext( IOManager:
 void IOManager::FdContext::resetContext( EventContext& ctx )
 {
   ctx.scheduler = nullptr;
+  ctx.thread = -1;
   ctx.fiber.reset();
   ctx.cb = nullptr;
 }
 
-void IOManager::FdContext::triggerEvent( IOManager::Event event )
+void IOManager::FdContext::triggerEvent( IOManager::Event event, IOManager* direct )
 {
   SYLAR_ASSERT( events & event );
   events = (Event)( events & ~event );
   EventContext& ctx = getContext( event );
+  if ( direct && ctx.scheduler == direct && ctx.thread == sylar::GetThreadId()
+       && ( ctx.cb ? direct->scheduleNext( &ctx.cb ) : direct->scheduleNext( &ctx.fiber ) ) ) {
+    ctx.scheduler = nullptr;
+    ctx.thread = -1;
+    return;
+  }
+
   if ( ctx.cb ) {
-    ctx.scheduler->schedule( &ctx.cb );
+    ctx.scheduler->schedulePrefer( &ctx.cb, ctx.thread );
   } else {
-    ctx.scheduler->schedule( &ctx.fiber );
+    ctx.scheduler->schedulePrefer( &ctx.fiber, ctx.thread );
   }
   ctx.scheduler = nullptr;
+  ctx.thread = -1;
 }
 
 IOManager::IOManager( std::size_t threads, bool user_caller, const std::string& name )
@@ -73,8 +122,6 @@ IOManager::IOManager( std::size_t threads, bool user_caller, const std::string&
   ret = epoll_ctl( m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event );
   SYLAR_ASSERT( !ret );
 
-  contextResize( 32 );
-
   start();
 }
 
@@ -84,38 +131,18 @@ IOManager::~IOManager()
   close( m_epfd );
   close( m_tickleFds[0] );
   close( m_tickleFds[1] );
-
-  for ( std::size_t i { 0 }; i < m_fdContexts.size(); ++i ) {
-    if ( m_fdContexts[i] ) {
-      delete m_fdContexts[i];
-    }
-  }
-}
-
-void IOManager::contextResize( std::size_t size )
-{
-  m_fdContexts.resize( size );
-
-  for ( std::size_t i { 0 }; i < m_fdContexts.size(); ++i ) {
-    if ( !m_fdContexts[i] ) {
-      m_fdContexts[i] = new FdContext;
-      m_fdContexts[i]->fd = i;
-    }
-  }
 }
 
 int IOManager::addEvent( int fd, Event event, std::function<void()> cb )
 {
-  FdContext* fd_ctx { nullptr };
-  RWMutexType::ReadLock lock { m_mutex };
-  if ( static_cast<int>( m_fdContexts.size() ) > fd ) {
-    fd_ctx = m_fdContexts[fd];
-    lock.unlock();
-  } else {
-    lock.unlock();
-    RWMutexType::WriteLock writeLock { m_mutex };
-    contextResize( fd * 1.5 );
-    fd_ctx = m_fdContexts[fd];
+  FdContext* fd_ctx { m_fdContexts.getOrCreate( fd, [fd]() {
+    FdContext* ctx { new FdContext };
+    ctx->fd = fd;
+    return ctx;
+  } ) };
+  if ( !fd_ctx ) {
+    SYLAR_LOG_ERROR( g_logger ) << "addEvent fd = " << fd << " out of range";
+    return -1;
   }
 
   FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
@@ -125,7 +152,7 @@ int IOManager::addEvent( int fd, Event event, std::function<void()> cb )
     SYLAR_ASSERT( !( fd_ctx->events & event ) );
   }
 
-  int op { fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD };
+  int op { fd_ctx->events || fd_ctx->errorCb ? EPOLL_CTL_MOD : EPOLL_CTL_ADD };
   epoll_event epevent;
   epevent.events = EPOLLET | fd_ctx->events | event;
   epevent.data.ptr = fd_ctx;
@@ -143,6 +170,7 @@ int IOManager::addEvent( int fd, Event event, std::function<void()> cb )
   SYLAR_ASSERT( !event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb );
 
   event_ctx.scheduler = Scheduler::GetThis();
+  event_ctx.thread = sylar::GetThreadId();
   if ( cb ) {
     event_ctx.cb.swap( cb );
   } else {
@@ -155,12 +183,10 @@ int IOManager::addEvent( int fd, Event event, std::function<void()> cb )
 
 bool IOManager::delEvent( int fd, Event event )
 {
-  RWMutexType::ReadLock lock { m_mutex };
-  if ( static_cast<int>( m_fdContexts.size() ) < fd ) {
+  FdContext* fd_ctx { m_fdContexts.get( fd ) };
+  if ( !fd_ctx ) {
     return false;
   }
-  FdContext* fd_ctx { m_fdContexts[fd] };
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
   if ( !( fd_ctx->events & event ) ) {
@@ -168,7 +194,7 @@ bool IOManager::delEvent( int fd, Event event )
   }
 
   Event new_events { (Event)( fd_ctx->events & ~event ) };
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+  int op = new_events || fd_ctx->errorCb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
   epevent.events = EPOLLET | new_events;
   epevent.data.ptr = fd_ctx;
@@ -189,12 +215,10 @@ bool IOManager::delEvent( int fd, Event event )
 
 bool IOManager::cancelEvent( int fd, Event event )
 {
-  RWMutexType::ReadLock lock { m_mutex };
-  if ( static_cast<int>( m_fdContexts.size() ) <= fd ) {
+  FdContext* fd_ctx { m_fdContexts.get( fd ) };
+  if ( !fd_ctx ) {
     return false;
   }
-  FdContext* fd_ctx { m_fdContexts[fd] };
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
   if ( !( fd_ctx->events & event ) ) {
@@ -202,7 +226,7 @@ bool IOManager::cancelEvent( int fd, Event event )
   }
 
   Event new_events { (Event)( fd_ctx->events & ~event ) };
-  int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+  int op = new_events || fd_ctx->errorCb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
   epevent.events = EPOLLET | new_events;
   epevent.data.ptr = fd_ctx;
@@ -221,21 +245,19 @@ bool IOManager::cancelEvent( int fd, Event event )
 
 bool IOManager::cancelAll( int fd )
 {
-  RWMutexType::ReadLock lock { m_mutex };
-  if ( (int)m_fdContexts.size() <= fd ) {
+  FdContext* fd_ctx { m_fdContexts.get( fd ) };
+  if ( !fd_ctx ) {
     return false;
   }
-  FdContext* fd_ctx { m_fdContexts[fd] };
-  lock.unlock();
 
   FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
   if ( !fd_ctx->events ) {
     return false;
   }
 
-  int op = EPOLL_CTL_DEL;
+  int op = fd_ctx->errorCb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
   epoll_event epevent;
-  epevent.events = 0;
+  epevent.events = EPOLLET;
   epevent.data.ptr = fd_ctx;
 
   int ret = epoll_ctl( m_epfd, op, fd, &epevent );
@@ -260,6 +282,56 @@ bool IOManager::cancelAll( int fd )
   return true;
 }
 
+bool IOManager::watchErrorQueue( int fd, std::function<void()> cb )
+{
+  FdContext* fd_ctx { m_fdContexts.getOrCreate( fd, [fd]() {
+    FdContext* ctx { new FdContext };
+    ctx->fd = fd;
+    return ctx;
+  } ) };
+  if ( !fd_ctx || !cb ) {
+    return false;
+  }
+
+  FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
+  if ( !fd_ctx->events && !fd_ctx->errorCb ) {
+    // EPOLLERR 总会上报，无需订阅读写事件
+    epoll_event epevent;
+    epevent.events = EPOLLET;
+    epevent.data.ptr = fd_ctx;
+    int ret = epoll_ctl( m_epfd, EPOLL_CTL_ADD, fd, &epevent );
+    if ( ret ) {
+      SYLAR_LOG_ERROR( g_logger ) << "epoll_ctl(" << m_epfd << ", " << EPOLL_CTL_ADD << "," << fd << ","
+                                  << epevent.events << "):" << ret << " (" << errno << ") (" << strerror( errno )
+                                  << ")";
+      return false;
+    }
+  }
+  fd_ctx->errorCb.swap( cb );
+  return true;
+}
+
+bool IOManager::unwatchErrorQueue( int fd )
+{
+  FdContext* fd_ctx { m_fdContexts.get( fd ) };
+  if ( !fd_ctx ) {
+    return false;
+  }
+
+  FdContext::MutexType::Lock lock2 { fd_ctx->mutex };
+  if ( !fd_ctx->errorCb ) {
+    return false;
+  }
+  fd_ctx->errorCb = nullptr;
+  if ( !fd_ctx->events ) {
+    epoll_event epevent;
+    epevent.events = 0;
+    epevent.data.ptr = fd_ctx;
+    epoll_ctl( m_epfd, EPOLL_CTL_DEL, fd, &epevent );
+  }
+  return true;
+}
+
 IOManager* IOManager::GetThis()
 {
   return dynamic_cast<IOManager*>( Scheduler::GetThis() );
@@ -274,6 +346,17 @@ void IOManager::tickle()
   SYLAR_ASSERT( ret == 1 );
 }
 
+void IOManager::tickle( int thread )
+{
+  RWMutexType::ReadLock lock { m_pollerMutex };
+  auto it = m_pollers.find( thread );
+  if ( it == m_pollers.end() ) {
+    // 尚未进入 idle 的线程会先回到调度循环重新取任务，无需唤醒
+    return;
+  }
+  pthread_kill( it->second, s_wake_signal );
+}
+
 bool IOManager::stopping( std::uint64_t& timeout )
 {
   timeout = getNextTimer();
@@ -291,26 +374,35 @@ void IOManager::idle()
   epoll_event* events = new epoll_event[64] {};
   std::shared_ptr<epoll_event> shared_events { events, []( epoll_event* ptr ) { delete[] ptr; } };
 
+  // 唤醒信号平时屏蔽，只在 epoll_pwait 期间放开，等待前到达的信号挂起到下一次等待，不会丢失
+  sigset_t wait_mask;
+  pthread_sigmask( SIG_SETMASK, nullptr, &wait_mask );
+  sigdelset( &wait_mask, s_wake_signal );
+  {
+    RWMutexType::WriteLock lock { m_pollerMutex };
+    m_pollers[sylar::GetThreadId()] = pthread_self();
+  }
+  // 登记前入队的软亲和任务收不到定向唤醒，先回调度循环取一次
+  Fiber::Current()->swapOut();
+
   while ( true ) {
     std::uint64_t next_timeout { 0 };
-    if ( stopping( next_timeout ) ) {
+    if ( stopping( next_timeout ) || isRetiring() ) {
       SYLAR_LOG_INFO( g_logger ) << "name = " << getName() << " idle stopping exit";
       break;
     }
 
-    int ret { 0 };
-    do {
-      static constexpr const int MAX_TIMEOUT { 3000 };
-      if ( next_timeout != std::numeric_limits<std::uint64_t>::max() ) {
-        next_timeout = next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
-      } else {
-        next_timeout = MAX_TIMEOUT;
-      }
-      ret = epoll_wait( m_epfd, events, 64, next_timeout );
-      if ( !( ret < 0 && errno == EINTR ) ) {
-        break;
-      }
-    } while ( true );
+    static constexpr const int MAX_TIMEOUT { 3000 };
+    if ( next_timeout != std::numeric_limits<std::uint64_t>::max() ) {
+      next_timeout = next_timeout > MAX_TIMEOUT ? MAX_TIMEOUT : next_timeout;
+    } else {
+      next_timeout = MAX_TIMEOUT;
+    }
+    // 被定向唤醒时以 EINTR 返回，回到调度循环取留给本线程的任务
+    int ret { epoll_pwait( m_epfd, events, 64, next_timeout, &wait_mask ) };
+    if ( ret < 0 ) {
+      ret = 0;
+    }
 
     std::vector<std::function<void()>> cbs;
     listExpiredCb( cbs );
@@ -330,8 +422,12 @@ void IOManager::idle()
 
       FdContext* fd_ctx = (FdContext*)event.data.ptr;
       FdContext::MutexType::Lock lock { fd_ctx->mutex };
+      if ( ( event.events & EPOLLERR ) && fd_ctx->errorCb ) {
+        schedule( fd_ctx->errorCb );
+      }
+      // 只唤醒已注册的事件，否则只等读的 fd 挂断时会触发未注册的写事件
       if ( event.events & ( EPOLLERR | EPOLLHUP ) ) {
-        event.events |= EPOLLIN | EPOLLOUT;
+        event.events |= ( EPOLLIN | EPOLLOUT ) & fd_ctx->events;
       }
 
       int real_events { NONE };
@@ -348,7 +444,7 @@ void IOManager::idle()
       }
 
       int left_events { fd_ctx->events & ~real_events };
-      int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+      int op = left_events || fd_ctx->errorCb ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
       event.events = EPOLLET | left_events;
 
       int ret2 { epoll_ctl( m_epfd, op, fd_ctx->fd, &event ) };
@@ -359,23 +455,24 @@ void IOManager::idle()
         continue;
       }
 
+      // 批次中第一个被唤醒的任务放入本线程 next 槽位，其余溢出到共享队列
+      IOManager* direct { s_direct_resume ? this : nullptr };
       if ( real_events & READ ) {
-        fd_ctx->triggerEvent( READ );
+        fd_ctx->triggerEvent( READ, direct );
         --m_pendingEventCount;
       }
 
       if ( real_events & WRITE ) {
-        fd_ctx->triggerEvent( WRITE );
+        fd_ctx->triggerEvent( WRITE, direct );
         --m_pendingEventCount;
       }
     }
 
-    Fiber::SPtr cur { Fiber::GetThis() };
-    auto raw_ptr { cur.get() };
-    cur.reset();
-
-    raw_ptr->swapOut();
+    Fiber::Current()->swapOut();
   }
+
+  RWMutexType::WriteLock lock { m_pollerMutex };
+  m_pollers.erase( sylar::GetThreadId() );
 }
 
 void IOManager::onTimerInsertedAtFront()
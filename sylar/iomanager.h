@@ -1,7 +1,10 @@
 #pragma once
 
+#include "sylar/fd_manager.h"
 #include "sylar/scheduler.h"
 #include "sylar/timer.h"
+#include <pthread.h>
+#include <unordered_map>
 
 namespace sylar {
 
@@ -27,16 +30,19 @@ private:
     struct EventContext
     {
       Scheduler* scheduler { nullptr };
+      int thread { -1 };  // 注册事件的线程，唤醒时优先回到该线程
       Fiber::SPtr fiber;
       std::function<void()> cb;
     };
 
     EventContext& getContext( Event event );
     void resetContext( EventContext& ctx );
-    void triggerEvent( Event event );
+    void triggerEvent( Event event, IOManager* direct = nullptr );
 
     EventContext read;
     EventContext write;
+    // 错误队列回调，EPOLLERR 时调度，常驻直到 unwatchErrorQueue
+    std::function<void()> errorCb;
     int fd { 0 };
     Event events { NONE };
     MutexType mutex;
@@ -52,15 +58,19 @@ public:
 
   bool cancelAll( int fd );
 
+  // 在 fd 的 EPOLLERR 上调度 cb，不占用读写事件也不阻止 IOManager 退出；用于 MSG_ZEROCOPY 完成通知
+  bool watchErrorQueue( int fd, std::function<void()> cb );
+  bool unwatchErrorQueue( int fd );
+
   static IOManager* GetThis();
 
 protected:
   void tickle() override;
+  void tickle( int thread ) override;
   bool stopping() override;
   void idle() override;
   void onTimerInsertedAtFront() override;
 
-  void contextResize( std::size_t size );
   bool stopping( std::uint64_t& timeout );
 
 private:
@@ -68,8 +78,11 @@ private:
   int m_tickleFds[2];
 
   std::atomic<std::size_t> m_pendingEventCount { 0 };
-  RWMutexType m_mutex;
-  std::vector<FdContext*> m_fdContexts;
+  // 按需创建、不加锁查找的 fd 上下文表
+  FdTable<FdContext> m_fdContexts;
+  // 正在 idle 中轮询的线程 id -> pthread，tickle(thread) 据此投递唤醒信号
+  RWMutexType m_pollerMutex;
+  std::unordered_map<int, pthread_t> m_pollers;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "sylar/offload.h"
+#include "sylar/config.h"
+#include "sylar/fiber.h"
+#include "sylar/log.h"
+#include "sylar/scheduler.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <string>
+
+namespace sylar {
+
+static sylar::Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_offload_threads {
+  sylar::Config::Lookup( "offload.threads", (std::uint32_t)4, "blocking offload pool threads" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_offload_max_queue { sylar::Config::Lookup(
+  "offload.max_queue", (std::uint32_t)1024, "queued offload jobs above which offload() runs inline" ) };
+
+OffloadPool::OffloadPool() {}
+
+OffloadPool::~OffloadPool()
+{
+  std::vector<Thread::SPtr> thrs;
+  {
+    MutexType::Lock lock { m_mutex };
+    m_stopping = true;
+    thrs.swap( m_threads );
+  }
+
+  for ( std::size_t i = 0; i < thrs.size(); ++i ) {
+    m_semaphore.notify();
+  }
+  for ( auto& thr : thrs ) {
+    thr->join();
+  }
+}
+
+bool OffloadPool::CanSuspend()
+{
+  return Scheduler::GetThis() && Scheduler::GetMainFiber() && Fiber::GetFiberId() != 0
+         && Fiber::Current() != Scheduler::GetMainFiber();
+}
+
+bool OffloadPool::submit( std::function<void()> job )
+{
+  {
+    MutexType::Lock lock { m_mutex };
+    if ( m_threads.empty() && !m_stopping ) {
+      std::size_t count { std::max<std::size_t>( g_offload_threads->getValue(), 1 ) };
+      for ( std::size_t i = 0; i < count; ++i ) {
+        m_threads.emplace_back(
+          new Thread( std::bind( &OffloadPool::run, this ), "offload_" + std::to_string( i ) ) );
+      }
+      m_stats.threads = count;
+      SYLAR_LOG_INFO( g_logger ) << "offload pool started, threads=" << count;
+    }
+
+    if ( m_jobs.size() >= g_offload_max_queue->getValue() ) {
+      ++m_stats.rejected;
+      return false;
+    }
+    m_jobs.push_back( Job { std::move( job ), sylar::GetCurrentUS() } );
+    ++m_stats.submitted;
+  }
+  m_semaphore.notify();
+  return true;
+}
+
+void OffloadPool::run()
+{
+  while ( true ) {
+    m_semaphore.wait();
+
+    Job job;
+    {
+      MutexType::Lock lock { m_mutex };
+      if ( m_jobs.empty() ) {
+        if ( m_stopping ) {
+          break;
+        }
+        continue;
+      }
+      job = std::move( m_jobs.front() );
+      m_jobs.pop_front();
+      ++m_stats.running;
+
+      std::uint64_t now_us { sylar::GetCurrentUS() };
+      std::uint64_t wait_us { now_us > job.enqueueUs ? now_us - job.enqueueUs : 0 };
+      m_stats.totalWaitUs += wait_us;
+      m_stats.maxWaitUs = std::max( m_stats.maxWaitUs, wait_us );
+    }
+
+    std::uint64_t begin_us { sylar::GetCurrentUS() };
+    try {
+      job.cb();
+    } catch ( std::exception& ex ) {
+      SYLAR_LOG_ERROR( g_logger ) << "offload job except: " << ex.what();
+    } catch ( ... ) {
+      SYLAR_LOG_ERROR( g_logger ) << "offload job except";
+    }
+    std::uint64_t end_us { sylar::GetCurrentUS() };
+
+    MutexType::Lock lock { m_mutex };
+    --m_stats.running;
+    ++m_stats.completed;
+    m_stats.totalRunUs += end_us > begin_us ? end_us - begin_us : 0;
+  }
+}
+
+OffloadPool::Stats OffloadPool::getStats()
+{
+  MutexType::Lock lock { m_mutex };
+  Stats stats { m_stats };
+  stats.queued = m_jobs.size();
+  return stats;
+}
+
+std::ostream& OffloadPool::dump( std::ostream& os )
+{
+  Stats stats { getStats() };
+  os << "[OffloadPool threads=" << stats.threads << " queued=" << stats.queued << " running=" << stats.running
+     << " submitted=" << stats.submitted << " rejected=" << stats.rejected << " completed=" << stats.completed
+     << " avg_wait_us=" << ( stats.completed ? stats.totalWaitUs / stats.completed : 0 )
+     << " max_wait_us=" << stats.maxWaitUs
+     << " avg_run_us=" << ( stats.completed ? stats.totalRunUs / stats.completed : 0 ) << "]";
+  return os;
+}
+
+}
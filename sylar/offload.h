@@ -0,0 +1,118 @@
+#pragma once
+
+#include "sylar/fiber.h"
+#include "sylar/scheduler.h"
+#include "sylar/singleton.h"
+#include "sylar/thread.h"
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+namespace sylar {
+
+// 执行无法 hook 的阻塞调用（getaddrinfo、文件读写、fsync、压缩等）的专用线程池
+class OffloadPool
+{
+public:
+  using MutexType = Mutex;
+
+  struct Stats
+  {
+    std::size_t threads { 0 };
+    std::size_t queued { 0 };
+    std::size_t running { 0 };
+    std::uint64_t submitted { 0 };
+    std::uint64_t rejected { 0 };
+    std::uint64_t completed { 0 };
+    std::uint64_t totalWaitUs { 0 };
+    std::uint64_t maxWaitUs { 0 };
+    std::uint64_t totalRunUs { 0 };
+  };
+
+  OffloadPool();
+  ~OffloadPool();
+
+  // 排队任务数已达 offload.max_queue 时拒绝并返回 false，由调用方决定如何处理
+  bool submit( std::function<void()> job );
+
+  Stats getStats();
+  std::ostream& dump( std::ostream& os );
+
+  // 当前是否运行在可以挂起的调度协程中
+  static bool CanSuspend();
+
+private:
+  struct Job
+  {
+    std::function<void()> cb;
+    std::uint64_t enqueueUs { 0 };
+  };
+
+  void run();
+
+private:
+  MutexType m_mutex;
+  Semaphore m_semaphore;
+  std::list<Job> m_jobs;
+  std::vector<Thread::SPtr> m_threads;
+  bool m_stopping { false };
+  Stats m_stats;
+};
+
+using OffloadMgr = Singleton<OffloadPool>;
+
+// 在阻塞线程池中执行 fn，期间挂起当前协程，完成后优先在原线程恢复并返回结果
+// 不在调度协程中或线程池队列已满时直接在当前线程同步执行
+template<typename Fn>
+auto offload( Fn fn ) -> decltype( fn() )
+{
+  using Result = decltype( fn() );
+  if ( !OffloadPool::CanSuspend() ) {
+    return fn();
+  }
+
+  Scheduler* scheduler { Scheduler::GetThis() };
+  Fiber::SPtr fiber { Fiber::GetThis() };
+  int thread { sylar::GetThreadId() };
+  std::exception_ptr error;
+  std::conditional_t<std::is_void_v<Result>, bool, std::optional<Result>> result {};
+
+  // 软亲和回原线程：原线程在弹性模式下可能已退休，此时由其他线程恢复。
+  // 协程切出完成前保持 EXEC，其他线程不会提前取走
+  scheduler->addPendingTask();
+  bool submitted { OffloadMgr::GetInstance().submit( [&fn, &error, &result, scheduler, fiber, thread]() {
+    try {
+      if constexpr ( std::is_void_v<Result> ) {
+        fn();
+      } else {
+        result.emplace( fn() );
+      }
+    } catch ( ... ) {
+      error = std::current_exception();
+    }
+    scheduler->schedulePrefer( fiber, thread );
+    scheduler->delPendingTask();
+  } ) };
+  if ( !submitted ) {
+    scheduler->delPendingTask();
+    return fn();
+  }
+  fiber.reset();
+  Fiber::YieldToHold();
+
+  if ( error ) {
+    std::rethrow_exception( error );
+  }
+  if constexpr ( !std::is_void_v<Result> ) {
+    return std::move( *result );
+  }
+}
+
+}
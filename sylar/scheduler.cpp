@@ -1,22 +1,111 @@
 #include "scheduler.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "sylar/fiber.h"
 #include "sylar/thread.h"
 #include "sylar/util.h"
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <functional>
+#include <map>
+#include <sched.h>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace sylar {
 
 static sylar::Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
 
+static sylar::ConfigVar<std::vector<std::uint32_t>>::SPtr g_scheduler_priority_weights {
+  sylar::Config::Lookup( "scheduler.priority.weights",
+                         std::vector<std::uint32_t> { 8, 4, 1 },
+                         "scheduler dequeue weights of high/normal/low priority" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_starvation_ms { sylar::Config::Lookup(
+  "scheduler.priority.starvation_ms", (std::uint32_t)100, "scheduler max wait before a task is promoted" ) };
+
+static sylar::ConfigVar<std::string>::SPtr g_scheduler_affinity_policy { sylar::Config::Lookup(
+  "scheduler.affinity.policy", std::string( "none" ), "scheduler thread placement: none, pin or core" ) };
+
+static sylar::ConfigVar<std::map<std::string, std::vector<int>>>::SPtr g_scheduler_affinity_cpus {
+  sylar::Config::Lookup( "scheduler.affinity.cpus",
+                         std::map<std::string, std::vector<int>> {},
+                         "scheduler name to cpu list used by the pin policy" ) };
+
+static sylar::ConfigVar<bool>::SPtr g_scheduler_affinity_numa { sylar::Config::Lookup(
+  "scheduler.affinity.numa", false, "bind scheduler thread memory to the numa node of its cpu" ) };
+
+static sylar::ConfigVar<bool>::SPtr g_scheduler_elastic_enable {
+  sylar::Config::Lookup( "scheduler.elastic.enable", false, "grow and shrink scheduler threads with load" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_elastic_min_threads { sylar::Config::Lookup(
+  "scheduler.elastic.min_threads", (std::uint32_t)1, "elastic scheduler minimum worker threads" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_elastic_max_threads { sylar::Config::Lookup(
+  "scheduler.elastic.max_threads", (std::uint32_t)16, "elastic scheduler maximum worker threads" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_elastic_target_wait_ms { sylar::Config::Lookup(
+  "scheduler.elastic.target_wait_ms", (std::uint32_t)10, "queue wait above which the pool grows" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_elastic_sustain_ms { sylar::Config::Lookup(
+  "scheduler.elastic.sustain_ms", (std::uint32_t)100, "how long the queue wait must stay above target" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_elastic_cooldown_ms { sylar::Config::Lookup(
+  "scheduler.elastic.cooldown_ms", (std::uint32_t)30000, "idle time before an extra worker retires" ) };
+
+static sylar::ConfigVar<std::uint32_t>::SPtr g_scheduler_affinity_steal_backlog {
+  sylar::Config::Lookup( "scheduler.affinity.steal_backlog",
+                         (std::uint32_t)4,
+                         "queued tasks preferring one worker at which other workers may take them" ) };
+
 static thread_local Scheduler* t_scheduler { nullptr };
 static thread_local Fiber* t_fiber { nullptr };
+static thread_local bool t_retiring { false };
+static thread_local bool t_idle { false };
+static thread_local Fiber::SPtr t_nextFiber;
+static thread_local std::function<void()> t_nextCb;
+static thread_local Scheduler::Priority t_nextPriority { Scheduler::NORMAL };
+
+static std::atomic<std::uint32_t> s_priority_weights[Scheduler::PRIORITY_COUNT] { { 8 }, { 4 }, { 1 } };
+static std::atomic<std::uint64_t> s_starvation_us { 100 * 1000 };
+static std::atomic<std::size_t> s_steal_backlog { 4 };
+
+static void SetPriorityWeights( const std::vector<std::uint32_t>& weights )
+{
+  for ( std::size_t i = 0; i < Scheduler::PRIORITY_COUNT && i < weights.size(); ++i ) {
+    s_priority_weights[i] = weights[i] ? weights[i] : 1;
+  }
+}
+
+struct _SchedulerIniter
+{
+  _SchedulerIniter()
+  {
+    SetPriorityWeights( g_scheduler_priority_weights->getValue() );
+    s_starvation_us = g_scheduler_starvation_ms->getValue() * 1000ul;
+    s_steal_backlog = std::max<std::uint32_t>( g_scheduler_affinity_steal_backlog->getValue(), 1 );
+
+    g_scheduler_priority_weights->addListener(
+      []( const std::vector<std::uint32_t>& old_value, const std::vector<std::uint32_t>& new_value ) {
+        SetPriorityWeights( new_value );
+      } );
+    g_scheduler_starvation_ms->addListener( []( const std::uint32_t& old_value, const std::uint32_t& new_value ) {
+      SYLAR_LOG_INFO( g_logger ) << "scheduler starvation changed from " << old_value << "ms to " << new_value
+                                 << "ms";
+      s_starvation_us = new_value * 1000ul;
+    } );
+    g_scheduler_affinity_steal_backlog->addListener(
+      []( const std::uint32_t& old_value, const std::uint32_t& new_value ) {
+        s_steal_backlog = std::max<std::uint32_t>( new_value, 1 );
+      } );
+  }
+};
+
+static _SchedulerIniter s_scheduler_initer;
 
 Scheduler::Scheduler( std::size_t threads, bool use_caller, const std::string& name ) : m_name( name )
 {
@@ -69,11 +158,27 @@ void Scheduler::start()
   m_stopping = false;
   SYLAR_ASSERT( m_threads.empty() );
 
+  m_elastic = g_scheduler_elastic_enable->getValue();
+  if ( m_elastic ) {
+    m_minThreads = std::max<std::size_t>( g_scheduler_elastic_min_threads->getValue(), 1 );
+    m_maxThreads = std::max<std::size_t>( g_scheduler_elastic_max_threads->getValue(), m_minThreads );
+    m_targetWaitUs = g_scheduler_elastic_target_wait_ms->getValue() * 1000ul;
+    m_sustainUs = g_scheduler_elastic_sustain_ms->getValue() * 1000ul;
+    m_cooldownUs = g_scheduler_elastic_cooldown_ms->getValue() * 1000ul;
+    m_threadCount = std::min( std::max( m_threadCount, m_minThreads ), m_maxThreads );
+  }
+
   m_threads.resize( m_threadCount );
   for ( std::size_t i = 0; i < m_threadCount; ++i ) {
-    m_threads[i].reset( new Thread( std::bind( &Scheduler::run, this ), m_name + "_" + std::to_string( i ) ) );
+    m_threads[i].reset( new Thread(
+      [this, i]() {
+        placeThread( i );
+        run();
+      },
+      m_name + "_" + std::to_string( i ) ) );
     m_threadIds.push_back( m_threads[i]->getId() );
   }
+  m_nextThreadIndex = m_threadCount;
   lock.unlock();
 }
 
@@ -112,6 +217,8 @@ void Scheduler::stop()
   {
     MutexType::Lock lock { m_mutex };
     thrs.swap( m_threads );
+    thrs.insert( thrs.end(), m_retiredThreads.begin(), m_retiredThreads.end() );
+    m_retiredThreads.clear();
   }
 
   for ( auto& i : thrs ) {
@@ -119,6 +226,66 @@ void Scheduler::stop()
   }
 }
 
+// 在工作线程分配协程栈之前完成绑核，使栈内存按首次访问落在本地 NUMA 节点
+void Scheduler::placeThread( std::size_t index )
+{
+  const std::string policy { g_scheduler_affinity_policy->getValue() };
+  std::vector<int> cpus;
+  if ( policy == "pin" ) {
+    auto pins = g_scheduler_affinity_cpus->getValue();
+    auto it = pins.find( m_name );
+    if ( it != pins.end() ) {
+      cpus = it->second;
+    } else {
+      for ( int i = 0; i < sylar::GetCpuCount(); ++i ) {
+        cpus.push_back( i );
+      }
+    }
+  } else if ( policy == "core" ) {
+    cpus = sylar::GetPhysicalCoreCpus();
+  } else {
+    if ( policy != "none" ) {
+      SYLAR_LOG_ERROR( g_logger ) << "unknown scheduler.affinity.policy: " << policy;
+    }
+    return;
+  }
+
+  // 去掉不存在或不在进程可用集合中的 cpu，全部无效时退回不绑核
+  cpu_set_t allowed;
+  CPU_ZERO( &allowed );
+  if ( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 ) {
+    std::size_t count { cpus.size() };
+    cpus.erase( std::remove_if( cpus.begin(),
+                                cpus.end(),
+                                [&allowed]( int cpu ) {
+                                  return cpu < 0 || cpu >= CPU_SETSIZE || !CPU_ISSET( cpu, &allowed );
+                                } ),
+                cpus.end() );
+    if ( cpus.size() != count && index == 0 ) {
+      SYLAR_LOG_ERROR( g_logger ) << "scheduler " << m_name << " ignored " << count - cpus.size()
+                                  << " unavailable cpus in affinity list";
+    }
+  }
+  if ( cpus.empty() ) {
+    return;
+  }
+
+  int cpu { cpus[index % cpus.size()] };
+  if ( !Thread::SetAffinity( { cpu } ) ) {
+    return;
+  }
+
+  int node { -1 };
+  if ( g_scheduler_affinity_numa->getValue() ) {
+    node = sylar::GetNumaNodeOfCpu( cpu );
+    if ( node >= 0 ) {
+      Thread::BindNumaNode( node );
+    }
+  }
+  SYLAR_LOG_INFO( g_logger ) << "scheduler " << m_name << " thread " << index << " placed on cpu " << cpu
+                             << " numa node " << node;
+}
+
 void Scheduler::setThis()
 {
   t_scheduler = this;
@@ -129,11 +296,12 @@ void Scheduler::run()
   SYLAR_LOG_INFO( g_logger ) << "run";
   setThis();
   if ( sylar::GetThreadId() != m_rootThread ) {
-    t_fiber = Fiber::GetThis().get();
+    t_fiber = Fiber::Current();
   }
 
   Fiber::SPtr idle_fiber { std::make_shared<Fiber>( std::bind( &Scheduler::idle, this ) ) };
   Fiber::SPtr cb_fiber;
+  std::uint64_t last_active_us { sylar::GetCurrentUS() };
 
   FiberAndThread ft;
   while ( true ) {
@@ -141,27 +309,20 @@ void Scheduler::run()
     bool tickle_me { false };
     bool is_active { false };
 
-    {
+    bool need_grow { false };
+    if ( takeNext( ft ) ) {
+      ++m_activeThreadCount;
+      is_active = true;
+    } else {
+      // 取任务失败与登记空闲在同一临界区内，之后入队的软亲和任务都能看到本线程空闲
       MutexType::Lock lock { m_mutex };
-      auto it { m_fibers.begin() };
-      while ( it != m_fibers.end() ) {
-        if ( it->thread != -1 && it->thread != sylar::GetThreadId() ) {
-          ++it;
-          tickle_me = true;
-          continue;
-        }
-
-        SYLAR_ASSERT( it->fiber || it->cb );
-        if ( it->fiber && it->fiber->getState() == Fiber::EXEC ) {
-          ++it;
-          continue;
-        }
-
-        ft = *it;
-        m_fibers.erase( it );
+      if ( takeNoLock( ft, tickle_me ) ) {
         ++m_activeThreadCount;
         is_active = true;
-        break;
+        need_grow = shouldGrowNoLock();
+        setIdleNoLock( false );
+      } else {
+        setIdleNoLock( true );
       }
     }
 
@@ -169,31 +330,48 @@ void Scheduler::run()
       tickle();
     }
 
+    if ( is_active ) {
+      last_active_us = sylar::GetCurrentUS();
+    }
+
+    if ( need_grow ) {
+      addThread();
+    }
+
     if ( ft.fiber && ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT ) {
       ft.fiber->swapIn();
       --m_activeThreadCount;
 
       if ( ft.fiber->getState() == Fiber::READY ) {
-        schedule( ft.fiber );
+        schedulePrefer( &ft.fiber, sylar::GetThreadId(), ft.priority );
       } else if ( ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT ) {
+        SYLAR_ASSERT2( ft.fiber.use_count() > 1,
+                       "fiber id=" << ft.fiber->getId()
+                                   << " yielded to HOLD with no owner, it would be destroyed while suspended" );
         ft.fiber->m_state = Fiber::HOLD;
+      } else {
+        Fiber::Recycle( std::move( ft.fiber ) );
       }
       ft.reset();
     } else if ( ft.cb ) {
+      // 上一个回调协程挂起后 cb_fiber 被交出，此时从协程池取
       if ( cb_fiber ) {
-        cb_fiber->reset( ft.cb );
+        cb_fiber->reset( std::move( ft.cb ) );
       } else {
-        cb_fiber.reset( new Fiber( ft.cb ) );
+        cb_fiber = Fiber::Create( std::move( ft.cb ) );
       }
+      Priority priority { ft.priority };
       ft.reset();
       cb_fiber->swapIn();
       --m_activeThreadCount;
       if ( cb_fiber->getState() == Fiber::READY ) {
-        schedule( cb_fiber );
-        cb_fiber.reset();
+        schedulePrefer( &cb_fiber, sylar::GetThreadId(), priority );
       } else if ( cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM ) {
         cb_fiber->reset( nullptr );
       } else {
+        SYLAR_ASSERT2( cb_fiber.use_count() > 1,
+                       "fiber id=" << cb_fiber->getId()
+                                   << " yielded to HOLD with no owner, it would be destroyed while suspended" );
         cb_fiber->m_state = Fiber::HOLD;
         cb_fiber.reset();
       }
@@ -208,6 +386,15 @@ void Scheduler::run()
         break;
       }
 
+      if ( m_elastic && !t_retiring && sylar::GetThreadId() != m_rootThread
+           && sylar::GetCurrentUS() - last_active_us >= m_cooldownUs ) {
+        MutexType::Lock lock { m_mutex };
+        if ( !m_stopping && m_threadCount > m_minThreads ) {
+          --m_threadCount;
+          t_retiring = true;
+        }
+      }
+
       ++m_idleThreadCount;
       idle_fiber->swapIn();
       --m_idleThreadCount;
@@ -216,6 +403,333 @@ void Scheduler::run()
       }
     }
   }
+
+  {
+    MutexType::Lock lock { m_mutex };
+    setIdleNoLock( false );
+  }
+
+  bool need_tickle { false };
+  if ( t_retiring ) {
+    MutexType::Lock lock { m_mutex };
+    for ( auto it = m_threads.begin(); it != m_threads.end(); ++it ) {
+      if ( it->get() == Thread::GetThis() ) {
+        m_retiredThreads.push_back( *it );
+        m_threads.erase( it );
+        break;
+      }
+    }
+    m_threadIds.erase( std::remove( m_threadIds.begin(), m_threadIds.end(), sylar::GetThreadId() ),
+                       m_threadIds.end() );
+    t_retiring = false;
+    // 以本线程为 hint 的任务此后任何线程都可取走；钉在本线程上的任务改为任意线程执行
+    need_tickle = m_hintBacklog.count( sylar::GetThreadId() ) > 0;
+    for ( auto& queue : m_fibers ) {
+      for ( auto& ft : queue ) {
+        if ( ft.thread == sylar::GetThreadId() ) {
+          ft.thread = -1;
+          need_tickle = true;
+        }
+      }
+    }
+    SYLAR_LOG_INFO( g_logger ) << "scheduler " << m_name << " worker retired, threads=" << m_threadCount;
+  }
+  if ( need_tickle ) {
+    tickle();
+  }
+}
+
+bool Scheduler::scheduleNext( Fiber::SPtr* fiber, Priority priority )
+{
+  if ( t_scheduler != this || t_nextFiber || t_nextCb || !*fiber ) {
+    return false;
+  }
+  t_nextFiber.swap( *fiber );
+  t_nextPriority = priority;
+  return true;
+}
+
+bool Scheduler::scheduleNext( std::function<void()>* cb, Priority priority )
+{
+  if ( t_scheduler != this || t_nextFiber || t_nextCb || !*cb ) {
+    return false;
+  }
+  t_nextCb.swap( *cb );
+  t_nextPriority = priority;
+  return true;
+}
+
+bool Scheduler::takeNext( FiberAndThread& ft )
+{
+  if ( t_nextFiber ) {
+    // 协程尚未切出（事件在其 YieldToHold 之前触发），按原优先级交回共享队列并优先留在本线程
+    if ( t_nextFiber->getState() == Fiber::EXEC ) {
+      Fiber::SPtr fiber;
+      fiber.swap( t_nextFiber );
+      schedulePrefer( &fiber, sylar::GetThreadId(), t_nextPriority );
+      return false;
+    }
+    ft.fiber.swap( t_nextFiber );
+  } else if ( t_nextCb ) {
+    ft.cb.swap( t_nextCb );
+  } else {
+    return false;
+  }
+  ft.priority = t_nextPriority;
+
+  ++m_directResumeCount;
+  return true;
+}
+
+bool Scheduler::isRetiring() const
+{
+  return t_retiring;
+}
+
+bool Scheduler::shouldGrowNoLock()
+{
+  if ( !m_elastic || m_stopping || m_idleThreadCount > 0 || m_threadCount >= m_maxThreads ) {
+    return false;
+  }
+
+  std::uint64_t now_us { sylar::GetCurrentUS() };
+  std::uint64_t oldest_wait_us { 0 };
+  for ( const auto& queue : m_fibers ) {
+    if ( !queue.empty() && now_us > queue.front().enqueueUs ) {
+      oldest_wait_us = std::max( oldest_wait_us, now_us - queue.front().enqueueUs );
+    }
+  }
+
+  if ( oldest_wait_us < m_targetWaitUs ) {
+    m_overloadSinceUs = 0;
+    return false;
+  }
+
+  if ( m_overloadSinceUs == 0 ) {
+    m_overloadSinceUs = now_us;
+    return false;
+  }
+  return now_us - m_overloadSinceUs >= m_sustainUs;
+}
+
+// 在持锁状态下创建线程，保证与 stop() 交换 m_threads 互斥
+void Scheduler::addThread()
+{
+  std::vector<Thread::SPtr> retired;
+  {
+    MutexType::Lock lock { m_mutex };
+    if ( m_stopping || m_threadCount >= m_maxThreads ) {
+      return;
+    }
+    retired.swap( m_retiredThreads );
+
+    std::size_t index { m_nextThreadIndex++ };
+    Thread::SPtr thread { new Thread(
+      [this, index]() {
+        placeThread( index );
+        run();
+      },
+      m_name + "_" + std::to_string( index ) ) };
+    m_threads.push_back( thread );
+    m_threadIds.push_back( thread->getId() );
+    ++m_threadCount;
+    m_overloadSinceUs = 0;
+    SYLAR_LOG_INFO( g_logger ) << "scheduler " << m_name << " worker added, threads=" << m_threadCount;
+  }
+
+  for ( auto& thread : retired ) {
+    thread->join();
+  }
+}
+
+bool Scheduler::emptyNoLock() const
+{
+  for ( const auto& queue : m_fibers ) {
+    if ( !queue.empty() ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Scheduler::hasThreadNoLock( int thread ) const
+{
+  return std::find( m_threadIds.begin(), m_threadIds.end(), thread ) != m_threadIds.end();
+}
+
+bool Scheduler::isIdleNoLock( int thread ) const
+{
+  return std::find( m_idleThreadIds.begin(), m_idleThreadIds.end(), thread ) != m_idleThreadIds.end();
+}
+
+// 经 next 槽位直接恢复时不加锁，空闲标记留到下一次取共享队列时清除，期间其他线程可能多取走几个软亲和任务
+void Scheduler::setIdleNoLock( bool idle )
+{
+  if ( idle == t_idle ) {
+    return;
+  }
+  if ( idle ) {
+    m_idleThreadIds.push_back( sylar::GetThreadId() );
+  } else {
+    m_idleThreadIds.erase( std::remove( m_idleThreadIds.begin(), m_idleThreadIds.end(), sylar::GetThreadId() ),
+                           m_idleThreadIds.end() );
+  }
+  t_idle = idle;
+}
+
+std::size_t Scheduler::queuedNoLock() const
+{
+  std::size_t count { 0 };
+  for ( const auto& queue : m_fibers ) {
+    count += queue.size();
+  }
+  return count;
+}
+
+bool Scheduler::canStealNoLock( int hint ) const
+{
+  // hint 线程积压的软亲和任务达到阈值视为过载；hint 线程已退出或不属于本调度器时直接放行
+  auto it = m_hintBacklog.find( hint );
+  if ( it != m_hintBacklog.end() && it->second >= s_steal_backlog ) {
+    return true;
+  }
+  return !hasThreadNoLock( hint );
+}
+
+int Scheduler::preferWakeNoLock( int hint, bool& need_tickle, std::size_t count )
+{
+  if ( hint == -1 ) {
+    return -1;
+  }
+  if ( canStealNoLock( hint ) ) {
+    // 本次入队的 count 个任务使积压刚越过过载阈值时唤醒其他线程来分担
+    auto it = m_hintBacklog.find( hint );
+    need_tickle = need_tickle
+                  || ( it != m_hintBacklog.end() && it->second >= s_steal_backlog
+                       && it->second < s_steal_backlog + count );
+    return -1;
+  }
+  need_tickle = false;
+  return hint != sylar::GetThreadId() && isIdleNoLock( hint ) ? hint : -1;
+}
+
+std::list<Scheduler::FiberAndThread>::iterator
+Scheduler::findNoLock( Priority priority, std::uint64_t now_us, bool& tickle_me )
+{
+  auto& queue { m_fibers[priority] };
+  auto it { queue.begin() };
+  while ( it != queue.end() ) {
+    if ( it->thread != -1 && it->thread != sylar::GetThreadId() ) {
+      ++it;
+      tickle_me = true;
+      continue;
+    }
+
+    // 留给未过载 hint 线程的任务不设置 tickle_me：hint 线程空闲时入队方已定向唤醒它
+    if ( it->hint != -1 && it->hint != sylar::GetThreadId() && !canStealNoLock( it->hint ) ) {
+      ++it;
+      continue;
+    }
+
+    SYLAR_ASSERT( it->fiber || it->cb );
+    if ( it->fiber && it->fiber->getState() == Fiber::EXEC ) {
+      ++it;
+      continue;
+    }
+    break;
+  }
+  return it;
+}
+
+void Scheduler::popNoLock( Priority priority,
+                           std::list<FiberAndThread>::iterator it,
+                           FiberAndThread& ft,
+                           std::uint64_t now_us )
+{
+  ft = std::move( *it );
+  m_fibers[priority].erase( it );
+  if ( ft.hint != -1 ) {
+    auto backlog = m_hintBacklog.find( ft.hint );
+    if ( --backlog->second == 0 ) {
+      m_hintBacklog.erase( backlog );
+    }
+    --m_hintedTaskCount;
+    if ( ft.hint != sylar::GetThreadId() ) {
+      ++m_crossResumeCount;
+    }
+  }
+
+  std::uint64_t wait_us { now_us > ft.enqueueUs ? now_us - ft.enqueueUs : 0 };
+  PriorityStats& stats { m_priorityStats[priority] };
+  ++stats.dequeued;
+  stats.totalWaitUs += wait_us;
+  if ( wait_us > stats.maxWaitUs ) {
+    stats.maxWaitUs = wait_us;
+  }
+}
+
+bool Scheduler::takeNoLock( FiberAndThread& ft, bool& tickle_me )
+{
+  std::uint64_t now_us { sylar::GetCurrentUS() };
+
+  // 饥饿保护：本线程可取的最早任务等待超过阈值时直接提升，检查的与取走的是同一个任务
+  for ( int p = PRIORITY_COUNT - 1; p > HIGH; --p ) {
+    auto it { findNoLock( (Priority)p, now_us, tickle_me ) };
+    if ( it != m_fibers[p].end() && now_us > it->enqueueUs && now_us - it->enqueueUs >= s_starvation_us ) {
+      popNoLock( (Priority)p, it, ft, now_us );
+      return true;
+    }
+  }
+
+  // 加权轮转：每轮每个优先级最多出队 weight 次，额度用完后重新补充
+  for ( int round = 0; round < 2; ++round ) {
+    for ( int p = HIGH; p < PRIORITY_COUNT; ++p ) {
+      if ( m_credits[p] == 0 ) {
+        continue;
+      }
+      auto it { findNoLock( (Priority)p, now_us, tickle_me ) };
+      if ( it != m_fibers[p].end() ) {
+        popNoLock( (Priority)p, it, ft, now_us );
+        --m_credits[p];
+        return true;
+      }
+    }
+
+    for ( int p = HIGH; p < PRIORITY_COUNT; ++p ) {
+      m_credits[p] = s_priority_weights[p];
+    }
+  }
+  return false;
+}
+
+Scheduler::PriorityStats Scheduler::getPriorityStats( Priority priority )
+{
+  MutexType::Lock lock { m_mutex };
+  PriorityStats stats { m_priorityStats[priority] };
+  stats.depth = m_fibers[priority].size();
+  return stats;
+}
+
+std::vector<int> Scheduler::getThreadIds()
+{
+  MutexType::Lock lock { m_mutex };
+  return m_threadIds;
+}
+
+std::ostream& Scheduler::dump( std::ostream& os )
+{
+  static const char* s_names[PRIORITY_COUNT] { "high", "normal", "low" };
+  os << "[Scheduler name=" << m_name << " threads=" << m_threadCount << " active=" << m_activeThreadCount
+     << " idle=" << m_idleThreadCount << " direct_resume=" << m_directResumeCount
+     << " cross_resume=" << m_crossResumeCount;
+  for ( int p = HIGH; p < PRIORITY_COUNT; ++p ) {
+    PriorityStats stats { getPriorityStats( (Priority)p ) };
+    os << " " << s_names[p] << "={depth=" << stats.depth << " dequeued=" << stats.dequeued
+       << " avg_wait_us=" << ( stats.dequeued ? stats.totalWaitUs / stats.dequeued : 0 )
+       << " max_wait_us=" << stats.maxWaitUs << "}";
+  }
+  os << "]";
+  return os;
 }
 
 void Scheduler::tickle()
@@ -223,16 +737,21 @@ void Scheduler::tickle()
   SYLAR_LOG_INFO( g_logger ) << "tickle";
 }
 
+void Scheduler::tickle( int thread )
+{
+  tickle();
+}
+
 bool Scheduler::stopping()
 {
   MutexType::Lock lock { m_mutex };
-  return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+  return m_autoStop && m_stopping && emptyNoLock() && m_activeThreadCount == 0 && m_pendingTaskCount == 0;
 }
 
 void Scheduler::idle()
 {
   SYLAR_LOG_INFO( g_logger ) << "idle";
-  while ( !stopping() ) {
+  while ( !stopping() && !isRetiring() ) {
     sylar::Fiber::YieldToHold();
   }
 }
@@ -2,11 +2,16 @@
 
 #include "sylar/fiber.h"
 #include "sylar/thread.h"
+#include "sylar/util.h"
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <list>
 #include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace sylar {
@@ -17,6 +22,23 @@ public:
   using SPtr = std::shared_ptr<Scheduler>;
   using MutexType = Mutex;
 
+  // 任务优先级，数值越小越优先
+  enum Priority
+  {
+    HIGH = 0,
+    NORMAL = 1,
+    LOW = 2,
+    PRIORITY_COUNT = 3
+  };
+
+  struct PriorityStats
+  {
+    std::size_t depth { 0 };
+    std::uint64_t dequeued { 0 };
+    std::uint64_t totalWaitUs { 0 };
+    std::uint64_t maxWaitUs { 0 };
+  };
+
   Scheduler( std::size_t threads = 1, bool use_caller = true, const std::string& name = "" );
   virtual ~Scheduler();
 
@@ -29,38 +51,120 @@ public:
   void stop();
 
   template<typename FiberOrCb>
-  void schedule( FiberOrCb fc, int thread = -1 )
+  void schedule( FiberOrCb fc, int thread = -1, Priority priority = NORMAL )
   {
     bool need_tickle { false };
+    bool need_grow { false };
     {
       MutexType::Lock lock { m_mutex };
-      need_tickle = scheduleNoLock( fc, thread );
+      need_tickle = scheduleNoLock( fc, thread, priority );
+      need_grow = shouldGrowNoLock();
     }
 
     if ( need_tickle ) {
       tickle();
     }
+
+    if ( need_grow ) {
+      addThread();
+    }
   }
 
   template<typename InputIterator>
-  void schedule( InputIterator begin, InputIterator end )
+  void schedule( InputIterator begin, InputIterator end, Priority priority = NORMAL )
   {
     bool need_tickle { false };
+    bool need_grow { false };
     {
       MutexType::Lock lock { m_mutex };
       while ( begin != end ) {
-        need_tickle = scheduleNoLock( &*begin, -1 ) || need_tickle;
+        need_tickle = scheduleNoLock( &*begin, -1, priority ) || need_tickle;
         ++begin;
       }
 
       if ( need_tickle ) {
         tickle();
       }
+      need_grow = shouldGrowNoLock();
+    }
+
+    if ( need_grow ) {
+      addThread();
+    }
+  }
+
+  // 软亲和：优先在 hint 线程上恢复。hint 线程排队的软亲和任务达到 scheduler.affinity.steal_backlog（过载）
+  // 或 hint 线程已不在本调度器时其他线程可取走；否则只留给 hint 线程，它空闲时定向唤醒它
+  template<typename FiberOrCb>
+  void schedulePrefer( FiberOrCb fc, int hint, Priority priority = NORMAL )
+  {
+    bool need_tickle { false };
+    bool need_grow { false };
+    int wake_thread { -1 };
+    {
+      MutexType::Lock lock { m_mutex };
+      need_tickle = scheduleNoLock( fc, -1, priority, hint );
+      wake_thread = preferWakeNoLock( hint, need_tickle );
+      need_grow = shouldGrowNoLock();
+    }
+
+    if ( wake_thread != -1 ) {
+      tickle( wake_thread );
+    } else if ( need_tickle ) {
+      tickle();
+    }
+
+    if ( need_grow ) {
+      addThread();
+    }
+  }
+
+  // 同一批任务以同一个 hint 入队，只加一次锁、至多唤醒一次
+  template<typename InputIterator>
+  void schedulePrefer( InputIterator begin, InputIterator end, int hint, Priority priority = NORMAL )
+  {
+    bool need_tickle { false };
+    bool need_grow { false };
+    int wake_thread { -1 };
+    std::size_t count { 0 };
+    {
+      MutexType::Lock lock { m_mutex };
+      while ( begin != end ) {
+        need_tickle = scheduleNoLock( &*begin, -1, priority, hint ) || need_tickle;
+        ++begin;
+        ++count;
+      }
+      if ( count == 0 ) {
+        return;
+      }
+      wake_thread = preferWakeNoLock( hint, need_tickle, count );
+      need_grow = shouldGrowNoLock();
+    }
+
+    if ( wake_thread != -1 ) {
+      tickle( wake_thread );
+    } else if ( need_tickle ) {
+      tickle();
+    }
+
+    if ( need_grow ) {
+      addThread();
     }
   }
 
+  // 挂起在调度器之外（如阻塞线程池）的任务数，未归零前调度器不会停止
+  void addPendingTask() { ++m_pendingTaskCount; }
+  void delPendingTask() { --m_pendingTaskCount; }
+
+  PriorityStats getPriorityStats( Priority priority );
+  // 当前参与调度的线程 id，可用作 schedule 的 thread 参数
+  std::vector<int> getThreadIds();
+  std::ostream& dump( std::ostream& os );
+
 protected:
   virtual void tickle();
+  // 唤醒指定线程，默认退化为 tickle()
+  virtual void tickle( int thread );
   void run();
   virtual bool stopping();
   virtual void idle();
@@ -69,24 +173,60 @@ protected:
 
   bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
+  void placeThread( std::size_t index );
+  bool isRetiring() const;
+
+  // 放入当前线程的 next 槽位，下一轮直接执行而不经过共享队列；槽位已占用时返回 false
+  bool scheduleNext( Fiber::SPtr* fiber, Priority priority = NORMAL );
+  bool scheduleNext( std::function<void()>* cb, Priority priority = NORMAL );
+
 private:
+  // 队列中没有其他线程可取的任务时才需要唤醒；只留给 hint 线程的软亲和任务不算。
+  // 指定的线程已退休（或不属于本调度器）时改为任意线程执行，避免任务永远无人认领
   template<typename FiberOrCb>
-  bool scheduleNoLock( FiberOrCb fc, int thread )
+  bool scheduleNoLock( FiberOrCb fc, int thread, Priority priority, int hint = -1 )
   {
-    bool need_tickle { m_fibers.empty() };
+    bool need_tickle { queuedNoLock() == m_hintedTaskCount };
+    if ( thread != -1 && !hasThreadNoLock( thread ) ) {
+      thread = -1;
+    }
     FiberAndThread ft { fc, thread };
     if ( ft.fiber || ft.cb ) {
-      m_fibers.push_back( ft );
+      if ( priority < HIGH || priority >= PRIORITY_COUNT ) {
+        priority = NORMAL;
+      }
+      ft.priority = priority;
+      ft.hint = hint;
+      if ( hint != -1 ) {
+        ++m_hintBacklog[hint];
+        ++m_hintedTaskCount;
+      }
+      ft.enqueueUs = sylar::GetCurrentUS();
+      m_fibers[priority].push_back( std::move( ft ) );
     }
     return need_tickle;
   }
 
+  // count 个软亲和任务入队后要唤醒的线程：hint 线程未过载时不唤醒其他线程，hint 线程空闲则返回它
+  int preferWakeNoLock( int hint, bool& need_tickle, std::size_t count = 1 );
+
+  bool emptyNoLock() const;
+  bool hasThreadNoLock( int thread ) const;
+  std::size_t queuedNoLock() const;
+  bool isIdleNoLock( int thread ) const;
+  void setIdleNoLock( bool idle );
+  bool shouldGrowNoLock();
+  void addThread();
+
 private:
   struct FiberAndThread
   {
     Fiber::SPtr fiber;
     std::function<void()> cb;
     int thread;
+    int hint { -1 };
+    Priority priority { NORMAL };
+    std::uint64_t enqueueUs { 0 };
 
     FiberAndThread( Fiber::SPtr f, int thr ) : fiber( f ), thread( thr ) {}
     FiberAndThread( Fiber::SPtr* f, int thr ) : thread( thr ) { fiber.swap( *f ); }
@@ -99,13 +239,33 @@ private:
       fiber = nullptr;
       cb = nullptr;
       thread = -1;
+      hint = -1;
+      priority = NORMAL;
+      enqueueUs = 0;
     }
   };
 
+  bool takeNext( FiberAndThread& ft );
+  bool takeNoLock( FiberAndThread& ft, bool& tickle_me );
+  bool canStealNoLock( int hint ) const;
+  // 本线程在该优先级队列中可取的第一个任务，没有时返回 end()
+  std::list<FiberAndThread>::iterator findNoLock( Priority priority, std::uint64_t now_us, bool& tickle_me );
+  void popNoLock( Priority priority,
+                  std::list<FiberAndThread>::iterator it,
+                  FiberAndThread& ft,
+                  std::uint64_t now_us );
+
 private:
   MutexType m_mutex;
   std::vector<Thread::SPtr> m_threads;
-  std::list<FiberAndThread> m_fibers;
+  std::list<FiberAndThread> m_fibers[PRIORITY_COUNT];
+  // 在共享队列中找不到任务、进入 idle 的线程，软亲和任务入队时据此定向唤醒 hint 线程
+  std::vector<int> m_idleThreadIds;
+  // 线程 id -> 队列中以它为 hint 的任务数，达到 steal_backlog 视为过载
+  std::unordered_map<int, std::size_t> m_hintBacklog;
+  std::size_t m_hintedTaskCount { 0 };
+  std::uint32_t m_credits[PRIORITY_COUNT] {};
+  PriorityStats m_priorityStats[PRIORITY_COUNT];
   Fiber::SPtr m_rootFiber;
   std::string m_name;
 
@@ -114,9 +274,23 @@ protected:
   std::size_t m_threadCount { 0 };
   std::atomic<std::size_t> m_activeThreadCount { 0 };
   std::atomic<std::size_t> m_idleThreadCount { 0 };
+  std::atomic<std::size_t> m_pendingTaskCount { 0 };
+  std::atomic<std::uint64_t> m_directResumeCount { 0 };
+  std::atomic<std::uint64_t> m_crossResumeCount { 0 };
+  std::size_t m_nextThreadIndex { 0 };
+  std::vector<Thread::SPtr> m_retiredThreads;
   bool m_stopping { true };
   bool m_autoStop { false };
   int m_rootThread { 0 };
+
+  // 弹性线程池，参数在 start() 时从配置读取
+  bool m_elastic { false };
+  std::size_t m_minThreads { 1 };
+  std::size_t m_maxThreads { 1 };
+  std::uint64_t m_targetWaitUs { 0 };
+  std::uint64_t m_sustainUs { 0 };
+  std::uint64_t m_cooldownUs { 0 };
+  std::uint64_t m_overloadSinceUs { 0 };
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "sylar/shm_stream.h"
+#include "sylar/config.h"
+#include "sylar/fiber.h"
+#include "sylar/hook.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace sylar {
+
+static Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+static ConfigVar<uint32_t>::SPtr g_shm_stream_capacity = Config::Lookup(
+  "shm_stream.capacity", (uint32_t)( 1024 * 1024 ), "ring bytes per direction, rounded up to a power of 2" );
+
+static ConfigVar<uint32_t>::SPtr g_shm_stream_peer_check_interval = Config::Lookup(
+  "shm_stream.peer_check_interval", (uint32_t)1000, "ms between peer liveness checks while waiting" );
+
+static const uint32_t s_handshake_magic { 0x73686d31 }; // "shm1"
+// 两个 RingHeader 占用的区域，按页对齐使数据区从页边界开始
+static const std::size_t s_header_size { 4096 };
+
+// 放在共享内存中的环形缓冲区状态，读写位置单调递增，下标为位置对容量取模
+struct ShmStream::RingHeader
+{
+  alignas( 64 ) std::atomic<uint64_t> head;
+  alignas( 64 ) std::atomic<uint64_t> tail;
+  alignas( 64 ) std::atomic<uint32_t> readerWaiting;
+  std::atomic<uint32_t> writerWaiting;
+  // 写端关闭后读端读完即 EOF，读端关闭后写端返回 EPIPE
+  std::atomic<uint32_t> closed;
+};
+
+static_assert( std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+               "ShmStream needs address-free atomics in shared memory" );
+
+namespace {
+
+struct Handshake
+{
+  uint32_t magic;
+  uint32_t headerSize;
+  uint64_t capacity;
+};
+
+// memfd 和 4 个 eventfd：创建方的数据、空间通知，打开方的数据、空间通知
+constexpr int s_fd_count { 5 };
+
+} // namespace
+
+static std::size_t RoundUpPow2( std::size_t val )
+{
+  std::size_t cap { 4096 };
+  while ( cap < val ) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+// 对端在等待时才写 eventfd，避免每次读写都产生系统调用
+static void Notify( std::atomic<uint32_t>& waiting, int fd )
+{
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  if ( waiting.load( std::memory_order_relaxed ) && waiting.exchange( 0 ) ) {
+    eventfd_write( fd, 1 );
+  }
+}
+
+static void CloseFds( const int* fds, int count )
+{
+  for ( int i = 0; i < count; ++i ) {
+    if ( fds[i] != -1 ) {
+      ::close( fds[i] );
+    }
+  }
+}
+
+ShmStream::SPtr ShmStream::Create( Socket::SPtr sock, std::size_t capacity )
+{
+  capacity = RoundUpPow2( capacity ? capacity : g_shm_stream_capacity->getValue() );
+  const std::size_t map_size { s_header_size + capacity * 2 };
+  int fds[s_fd_count] { -1, -1, -1, -1, -1 };
+  fds[0] = memfd_create( "sylar_shm_stream", MFD_CLOEXEC );
+  for ( int i = 1; i < s_fd_count; ++i ) {
+    fds[i] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  }
+  if ( std::find( fds, fds + s_fd_count, -1 ) != fds + s_fd_count || ftruncate( fds[0], map_size ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream create fail errno=" << errno << " errstr=" << strerror( errno );
+    CloseFds( fds, s_fd_count );
+    return nullptr;
+  }
+
+  void* mem = mmap( nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0 );
+  if ( mem == MAP_FAILED ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream mmap fail errno=" << errno << " errstr=" << strerror( errno );
+    CloseFds( fds, s_fd_count );
+    return nullptr;
+  }
+
+  Handshake hs { s_handshake_magic, (uint32_t)s_header_size, capacity };
+  iovec iov { &hs, sizeof( hs ) };
+  char control[CMSG_SPACE( sizeof( fds ) )];
+  msghdr msg;
+  std::memset( &msg, 0, sizeof( msg ) );
+  std::memset( control, 0, sizeof( control ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+  cmsghdr* cm { CMSG_FIRSTHDR( &msg ) };
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN( sizeof( fds ) );
+  std::memcpy( CMSG_DATA( cm ), fds, sizeof( fds ) );
+  if ( ::sendmsg( sock->getSocket(), &msg, MSG_NOSIGNAL ) != (ssize_t)sizeof( hs ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream handshake send fail errno=" << errno
+                                << " errstr=" << strerror( errno );
+    munmap( mem, map_size );
+    CloseFds( fds, s_fd_count );
+    return nullptr;
+  }
+
+  // memfd 映射后即可关闭，eventfd 由流持有
+  ::close( fds[0] );
+  return SPtr( new ShmStream( sock, static_cast<char*>( mem ), map_size, capacity, true, fds + 1 ) );
+}
+
+ShmStream::SPtr ShmStream::Open( Socket::SPtr sock )
+{
+  Handshake hs;
+  iovec iov { &hs, sizeof( hs ) };
+  int fds[s_fd_count] { -1, -1, -1, -1, -1 };
+  char control[CMSG_SPACE( sizeof( fds ) )];
+  msghdr msg;
+  std::memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof( control );
+  ssize_t n = ::recvmsg( sock->getSocket(), &msg, MSG_CMSG_CLOEXEC );
+  cmsghdr* cm { n == (ssize_t)sizeof( hs ) ? CMSG_FIRSTHDR( &msg ) : nullptr };
+  if ( cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS
+       && cm->cmsg_len == CMSG_LEN( sizeof( fds ) ) ) {
+    std::memcpy( fds, CMSG_DATA( cm ), sizeof( fds ) );
+  }
+  if ( fds[0] == -1 || hs.magic != s_handshake_magic || hs.headerSize != s_header_size
+       || hs.capacity != RoundUpPow2( hs.capacity ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream handshake recv fail, ret=" << n << " errno=" << errno
+                                << " errstr=" << strerror( errno );
+    CloseFds( fds, s_fd_count );
+    return nullptr;
+  }
+
+  const std::size_t map_size { s_header_size + hs.capacity * 2 };
+  struct stat st;
+  if ( fstat( fds[0], &st ) || (std::size_t)st.st_size < map_size ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream memfd size mismatch, capacity=" << hs.capacity;
+    CloseFds( fds, s_fd_count );
+    return nullptr;
+  }
+  void* mem = mmap( nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0 );
+  ::close( fds[0] );
+  if ( mem == MAP_FAILED ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream mmap fail errno=" << errno << " errstr=" << strerror( errno );
+    CloseFds( fds + 1, s_fd_count - 1 );
+    return nullptr;
+  }
+  return SPtr( new ShmStream( sock, static_cast<char*>( mem ), map_size, hs.capacity, false, fds + 1 ) );
+}
+
+ShmStream::SPtr ShmStream::Connect( UnixAddress::SPtr addr, std::size_t capacity )
+{
+  Socket::SPtr sock { Socket::CreateUnixTCPSocket() };
+  if ( !sock->connect( addr ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "ShmStream connect " << addr->toString() << " fail errno=" << errno
+                                << " errstr=" << strerror( errno );
+    return nullptr;
+  }
+  return Create( sock, capacity );
+}
+
+// 共享区域前 HeaderSize 字节放两个 RingHeader，之后依次是创建方、打开方发出数据的缓冲区
+ShmStream::ShmStream(
+  Socket::SPtr sock, char* mem, std::size_t map_size, std::size_t capacity, bool creator, const int* fds )
+  : m_sock { sock }
+  , m_mem { mem }
+  , m_mapSize { map_size }
+  , m_capacity { capacity }
+  , m_closed { false }
+{
+  static_assert( sizeof( RingHeader ) * 2 <= s_header_size, "RingHeader too large" );
+  RingHeader* headers { reinterpret_cast<RingHeader*>( mem ) };
+  char* data { mem + s_header_size };
+  const int self { creator ? 0 : 1 };
+  const int peer { 1 - self };
+  m_tx = &headers[self];
+  m_txData = data + self * capacity;
+  m_rx = &headers[peer];
+  m_rxData = data + peer * capacity;
+  m_dataFd = fds[self * 2];
+  m_spaceFd = fds[self * 2 + 1];
+  m_peerDataFd = fds[peer * 2];
+  m_peerSpaceFd = fds[peer * 2 + 1];
+}
+
+ShmStream::~ShmStream()
+{
+  close();
+}
+
+int ShmStream::read( void* buffer, size_t length )
+{
+  iovec iov { buffer, length };
+  return readv( &iov, 1 );
+}
+
+int ShmStream::read( ByteArray::SPtr ba, size_t length )
+{
+  std::vector<iovec> iovs;
+  ba->getWriteBuffers( iovs, length );
+  int ret = readv( iovs.data(), iovs.size() );
+  if ( ret > 0 ) {
+    ba->setPosition( ba->getPosition() + ret );
+  }
+  return ret;
+}
+
+int ShmStream::write( const void* buffer, size_t length )
+{
+  iovec iov { const_cast<void*>( buffer ), length };
+  return writev( &iov, 1 );
+}
+
+int ShmStream::write( ByteArray::SPtr ba, size_t length )
+{
+  std::vector<iovec> iovs;
+  ba->getReadBuffers( iovs, length );
+  int ret = writev( iovs.data(), iovs.size() );
+  if ( ret > 0 ) {
+    ba->setPosition( ba->getPosition() + ret );
+  }
+  return ret;
+}
+
+int ShmStream::readv( const iovec* buffers, std::size_t count )
+{
+  if ( m_closed ) {
+    errno = EBADF;
+    return -1;
+  }
+  const uint64_t mask { m_capacity - 1 };
+  while ( true ) {
+    uint64_t tail { m_rx->tail.load( std::memory_order_relaxed ) };
+    uint64_t head { m_rx->head.load( std::memory_order_acquire ) };
+    if ( head != tail ) {
+      uint64_t pos { tail };
+      for ( std::size_t i = 0; i < count && pos != head; ++i ) {
+        char* dst { static_cast<char*>( buffers[i].iov_base ) };
+        std::size_t len { std::min<std::size_t>( buffers[i].iov_len, head - pos ) };
+        std::size_t first { std::min<std::size_t>( len, m_capacity - ( pos & mask ) ) };
+        std::memcpy( dst, m_rxData + ( pos & mask ), first );
+        std::memcpy( dst + first, m_rxData, len - first );
+        pos += len;
+      }
+      m_rx->tail.store( pos, std::memory_order_release );
+      Notify( m_rx->writerWaiting, m_peerSpaceFd );
+      return (int)( pos - tail );
+    }
+    if ( m_rx->closed.load( std::memory_order_acquire ) ) {
+      return 0;
+    }
+
+    m_rx->readerWaiting.store( 1 );
+    if ( m_rx->head.load() != tail || m_rx->closed.load() ) {
+      continue;
+    }
+    bool alive { wait( m_dataFd ) };
+    // 挂起期间本端可能已被 close，共享区域已解除映射
+    if ( m_closed ) {
+      errno = EBADF;
+      return -1;
+    }
+    if ( !alive ) {
+      return 0;
+    }
+  }
+}
+
+int ShmStream::writev( const iovec* buffers, std::size_t count )
+{
+  if ( m_closed ) {
+    errno = EBADF;
+    return -1;
+  }
+  const uint64_t mask { m_capacity - 1 };
+  while ( true ) {
+    if ( m_tx->closed.load( std::memory_order_acquire ) ) {
+      errno = EPIPE;
+      return -1;
+    }
+    uint64_t head { m_tx->head.load( std::memory_order_relaxed ) };
+    uint64_t tail { m_tx->tail.load( std::memory_order_acquire ) };
+    uint64_t end { tail + m_capacity };
+    if ( head != end ) {
+      uint64_t pos { head };
+      for ( std::size_t i = 0; i < count && pos != end; ++i ) {
+        const char* src { static_cast<const char*>( buffers[i].iov_base ) };
+        std::size_t len { std::min<std::size_t>( buffers[i].iov_len, end - pos ) };
+        std::size_t first { std::min<std::size_t>( len, m_capacity - ( pos & mask ) ) };
+        std::memcpy( m_txData + ( pos & mask ), src, first );
+        std::memcpy( m_txData, src + first, len - first );
+        pos += len;
+      }
+      m_tx->head.store( pos, std::memory_order_release );
+      Notify( m_tx->readerWaiting, m_peerDataFd );
+      return (int)( pos - head );
+    }
+
+    m_tx->writerWaiting.store( 1 );
+    if ( m_tx->tail.load() != tail || m_tx->closed.load() ) {
+      continue;
+    }
+    bool alive { wait( m_spaceFd ) };
+    if ( m_closed ) {
+      errno = EBADF;
+      return -1;
+    }
+    if ( !alive ) {
+      errno = EPIPE;
+      return -1;
+    }
+  }
+}
+
+bool ShmStream::wait( int fd )
+{
+  const uint64_t interval { g_shm_stream_peer_check_interval->getValue() };
+  IOManager* iom { IOManager::GetThis() };
+  bool notified { false };
+  if ( iom ) {
+    // 与 hook 中的超时做法相同：定时器取消读事件把协程唤醒
+    Timer::SPtr timer { iom->addTimer( interval, [iom, fd]() { iom->cancelEvent( fd, IOManager::READ ); } ) };
+    if ( iom->addEvent( fd, IOManager::READ ) ) {
+      timer->cancel();
+      return false;
+    }
+    Fiber::YieldToHold();
+    timer->cancel();
+  } else {
+    pollfd pfd { fd, POLLIN, 0 };
+    poll( &pfd, 1, interval );
+  }
+  if ( m_closed ) {
+    return false;
+  }
+
+  eventfd_t val;
+  notified = eventfd_read( fd, &val ) == 0;
+  return notified || isPeerAlive();
+}
+
+// 对端进程退出后 Unix socket 读到 EOF
+bool ShmStream::isPeerAlive()
+{
+  char c;
+  ssize_t n = recv_f( m_sock->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT );
+  if ( n == 0 || ( n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) {
+    SYLAR_LOG_INFO( g_logger ) << "ShmStream peer gone, sock=" << m_sock->getSocket();
+    return false;
+  }
+  return true;
+}
+
+void ShmStream::close()
+{
+  if ( m_closed ) {
+    return;
+  }
+  m_closed = true;
+  m_tx->closed.store( 1 );
+  m_rx->closed.store( 1 );
+  // 对端可能正阻塞在读或写上，无条件唤醒
+  eventfd_write( m_peerDataFd, 1 );
+  eventfd_write( m_peerSpaceFd, 1 );
+  // 本端挂起在读写上的协程先被唤醒出队，恢复后看到 m_closed 不再访问共享区域和 eventfd
+  IOManager* iom { IOManager::GetThis() };
+  if ( iom ) {
+    iom->cancelEvent( m_dataFd, IOManager::READ );
+    iom->cancelEvent( m_spaceFd, IOManager::READ );
+  }
+  munmap( m_mem, m_mapSize );
+  int fds[] { m_dataFd, m_spaceFd, m_peerDataFd, m_peerSpaceFd };
+  CloseFds( fds, 4 );
+  m_sock->close();
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "sylar/address.h"
+#include "sylar/bytearray.h"
+#include "sylar/socket.h"
+#include "sylar/stream.h"
+#include <cstddef>
+#include <memory>
+#include <sys/uio.h>
+
+namespace sylar {
+
+// 同机进程间的共享内存流：一块 memfd 中放两个单生产者单消费者环形缓冲区，每个方向一个，
+// 通过 eventfd 通知对端有数据或有空间，在 IOManager 中以读事件挂起协程，否则阻塞在 poll 上。
+// 握手经由已连接的 Unix socket 以 SCM_RIGHTS 传递 memfd 和 eventfd，之后数据不再经过内核协议栈，
+// 该 socket 保留用于探测对端进程是否退出
+class ShmStream : public Stream
+{
+public:
+  using SPtr = std::shared_ptr<ShmStream>;
+
+  // 创建共享内存并通过 sock 发给对端，capacity 为每个方向的缓冲区大小，0 表示使用 shm_stream.capacity
+  static SPtr Create( Socket::SPtr sock, std::size_t capacity = 0 );
+  // 从 sock 接收对端 Create 发来的共享内存
+  static SPtr Open( Socket::SPtr sock );
+  // 连接 addr 上监听的 Unix socket 并 Create
+  static SPtr Connect( UnixAddress::SPtr addr, std::size_t capacity = 0 );
+
+  ~ShmStream();
+
+  // 至少读到 1 字节前挂起，对端关闭且数据读完时返回 0
+  int read( void* buffer, size_t length ) override;
+  int read( ByteArray::SPtr ba, size_t length ) override;
+  // 至少写入 1 字节前挂起，对端已关闭时返回 -1，errno 为 EPIPE
+  int write( const void* buffer, size_t length ) override;
+  int write( ByteArray::SPtr ba, size_t length ) override;
+  int writev( const iovec* buffers, std::size_t count ) override;
+  void close() override;
+
+  std::size_t getCapacity() const { return m_capacity; }
+  bool isClosed() const { return m_closed; }
+
+private:
+  struct RingHeader;
+
+  ShmStream(
+    Socket::SPtr sock, char* mem, std::size_t map_size, std::size_t capacity, bool creator, const int* fds );
+
+  int readv( const iovec* buffers, std::size_t count );
+  // 等待 fd 上的通知，期间定时检查对端是否存活；对端已退出时返回 false
+  bool wait( int fd );
+  bool isPeerAlive();
+
+private:
+  Socket::SPtr m_sock;
+  char* m_mem;
+  std::size_t m_mapSize;
+  std::size_t m_capacity;
+  RingHeader* m_tx;
+  char* m_txData;
+  RingHeader* m_rx;
+  char* m_rxData;
+  // 本端等待的通知：有数据可读、有空间可写
+  int m_dataFd;
+  int m_spaceFd;
+  // 通知对端的 eventfd
+  int m_peerDataFd;
+  int m_peerSpaceFd;
+  bool m_closed;
+};
+
+}
@@ -1,25 +1,172 @@
 #include "socket.h"
 #include "sylar/address.h"
+#include "sylar/config.h"
 #include "sylar/fd_manager.h"
 #include "sylar/hook.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/thread.h"
+#include "sylar/timer.h"
+#include "sylar/util.h"
 #include <asm-generic/socket.h>
+#include <atomic>
 #include <bits/types/struct_timeval.h>
 #include <cerrno>
 #include <cstddef>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <linux/errqueue.h>
 #include <memory>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <ostream>
+#include <poll.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <vector>
 
 namespace sylar {
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_NAME( "system" );
 
+static sylar::ConfigVar<uint32_t>::SPtr g_socket_zerocopy_threshold = sylar::Config::Lookup(
+  "socket.zerocopy.threshold",
+  (uint32_t)( 16 * 1024 ),
+  "min bytes for Socket::sendZeroCopy to use MSG_ZEROCOPY, smaller sends are copied, 0 disables zero copy" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_socket_zerocopy_close_timeout = sylar::Config::Lookup(
+  "socket.zerocopy.close_timeout",
+  (uint32_t)1000,
+  "ms a closed socket keeps its fd and buffers while zerocopy sends are still in flight" );
+
+static std::atomic<uint32_t> s_zerocopy_threshold { 16 * 1024 };
+static std::atomic<uint32_t> s_zerocopy_close_timeout { 1000 };
+
+struct _SocketIniter
+{
+  _SocketIniter()
+  {
+    s_zerocopy_threshold = g_socket_zerocopy_threshold->getValue();
+    g_socket_zerocopy_threshold->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_zerocopy_threshold = new_value; } );
+    s_zerocopy_close_timeout = g_socket_zerocopy_close_timeout->getValue();
+    g_socket_zerocopy_close_timeout->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_zerocopy_close_timeout = new_value; } );
+  }
+};
+
+static _SocketIniter s_socket_initer;
+
+// 零拷贝发送的在途缓冲区，内核按发送顺序编号，完成通知给出一段编号区间
+// Socket 关闭时仍有在途发送则接管 fd：内核发送队列仍引用这些缓冲区，等通知收齐或超时后才关闭 fd 并释放
+struct ZeroCopyState
+{
+  Mutex mutex;
+  int fd { -1 };
+  IOManager* iom { nullptr };
+  // 不支持 SO_ZEROCOPY，或内核报告实际做了拷贝，此后都走普通 send
+  std::atomic<bool> disabled { false };
+  uint32_t firstId { 0 };
+  // 下标为编号 - firstId，已完成的置空，队首连续完成的部分出队
+  std::deque<std::shared_ptr<const void>> pending;
+  std::atomic<std::size_t> inFlight { 0 };
+  // Socket 已关闭，fd 由本对象延后关闭
+  bool closing { false };
+  Timer::SPtr closeTimer;
+  std::function<void()> closeHook;
+
+  void track( std::shared_ptr<const void> holder )
+  {
+    Mutex::Lock lock( mutex );
+    pending.push_back( holder ? std::move( holder ) : std::make_shared<int>( 0 ) );
+    ++inFlight;
+  }
+
+  // 非阻塞地读取错误队列中的完成通知并释放对应缓冲区；延后关闭的 fd 在收齐通知后关闭
+  void reap()
+  {
+    std::vector<std::shared_ptr<const void>> released;
+    bool drained { false };
+    {
+      Mutex::Lock lock( mutex );
+      while ( fd != -1 ) {
+        char control[128];
+        msghdr msg;
+        std::memset( &msg, 0, sizeof( msg ) );
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        if ( recvmsg_f( fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) == -1 ) {
+          break;
+        }
+        for ( cmsghdr* cm = CMSG_FIRSTHDR( &msg ); cm; cm = CMSG_NXTHDR( &msg, cm ) ) {
+          if ( !( ( cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR )
+                  || ( cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR ) ) ) {
+            continue;
+          }
+          const sock_extended_err* serr { (const sock_extended_err*)CMSG_DATA( cm ) };
+          if ( serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ) {
+            continue;
+          }
+          if ( ( serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) && !disabled ) {
+            // 内核退化为拷贝时零拷贝只剩额外开销，后续发送不再使用
+            disabled = true;
+            SYLAR_LOG_DEBUG( g_logger ) << "zerocopy send copied by kernel, disable on sock=" << fd;
+          }
+          for ( uint32_t id = serr->ee_info; id - serr->ee_info <= serr->ee_data - serr->ee_info; ++id ) {
+            std::size_t index { (std::size_t)( id - firstId ) };
+            if ( index < pending.size() && pending[index] ) {
+              released.push_back( std::move( pending[index] ) );
+              --inFlight;
+            }
+          }
+          while ( !pending.empty() && !pending.front() ) {
+            pending.pop_front();
+            ++firstId;
+          }
+        }
+      }
+      drained = closing && fd != -1 && !inFlight;
+    }
+    if ( drained ) {
+      finishClose();
+    }
+  }
+
+  // 关闭延后的 fd；超时调用时仍在途的缓冲区也一并释放
+  void finishClose()
+  {
+    std::deque<std::shared_ptr<const void>> dropped;
+    std::function<void()> hook;
+    int closing_fd { -1 };
+    {
+      Mutex::Lock lock( mutex );
+      if ( !closing || fd == -1 ) {
+        return;
+      }
+      if ( inFlight ) {
+        SYLAR_LOG_WARN( g_logger ) << "close sock=" << fd << " with " << inFlight
+                                   << " zerocopy sends still in flight after " << s_zerocopy_close_timeout << "ms";
+      }
+      closing_fd = fd;
+      fd = -1;
+      dropped.swap( pending );
+      inFlight = 0;
+      hook.swap( closeHook );
+    }
+    if ( iom ) {
+      iom->unwatchErrorQueue( closing_fd );
+    }
+    if ( closeTimer ) {
+      closeTimer->cancel();
+    }
+    ::close( closing_fd );
+    if ( hook ) {
+      hook();
+    }
+  }
+};
+
 Socket::SPtr Socket::CreateTCP( sylar::Address::SPtr address )
 {
   return std::make_shared<Socket>( address->getFamily(), TCP, 0 );
@@ -66,12 +213,27 @@ Socket::Socket( int family, int type, int protocol )
 
 Socket::~Socket()
 {
-  ::close( m_sock );
+  if ( releaseZeroCopy() ) {
+    return;
+  }
+  if ( m_sock != -1 ) {
+    ::close( m_sock );
+  }
+  runCloseHook();
+}
+
+void Socket::runCloseHook()
+{
+  if ( m_closeHook ) {
+    std::function<void()> hook;
+    hook.swap( m_closeHook );
+    hook();
+  }
 }
 
 int64_t Socket::getSendTimeout()
 {
-  FdCtx::SPtr ctx = FdMgr::GetInstance().get( m_sock );
+  FdCtx* ctx = FdMgr::GetInstance().get( m_sock );
   if ( ctx ) {
     return ctx->getTimeout( SO_SNDTIMEO );
   }
@@ -89,7 +251,7 @@ void Socket::setSendTimeout( int64_t val )
 
 int64_t Socket::getRecvTimeout()
 {
-  FdCtx::SPtr ctx = FdMgr::GetInstance().get( m_sock );
+  FdCtx* ctx = FdMgr::GetInstance().get( m_sock );
   if ( ctx ) {
     return ctx->getTimeout( SO_SNDTIMEO );
   }
@@ -127,30 +289,65 @@ bool Socket::setOption( int level, int option, const void* result, size_t len )
   return true;
 }
 
+bool Socket::setReusePort( bool val )
+{
+  if ( !isValid() ) {
+    newSock();
+    if ( !isValid() ) {
+      return false;
+    }
+  }
+  int flag = val ? 1 : 0;
+  return setOption( SOL_SOCKET, SO_REUSEPORT, flag );
+}
+
 Socket::SPtr Socket::accept()
 {
-  Socket::SPtr sock( std::make_shared<Socket>( m_family, m_type, m_protocol ) );
-  int newSock = ::accept( m_sock, nullptr, nullptr );
+  // 对端地址由 accept4 一并带回，省去 getpeername；本端地址用到时再取
+  sockaddr_storage addr;
+  socklen_t addrlen { sizeof( addr ) };
+  int newSock = ::accept4( m_sock, (sockaddr*)&addr, &addrlen, SOCK_CLOEXEC );
   if ( -1 == newSock ) {
     SYLAR_LOG_ERROR( g_logger ) << "accept(" << m_sock << ") errno=" << errno << " errstr=" << strerror( errno );
     return nullptr;
   }
 
-  if ( sock->init( newSock ) ) {
-    return sock;
+  return Accepted( m_family, m_type, m_protocol, newSock, addr, addrlen );
+}
+
+Socket::SPtr Socket::tryAccept()
+{
+  sockaddr_storage addr;
+  socklen_t addrlen { sizeof( addr ) };
+  bool nonblock { is_hook_enable() };
+  int newSock = accept4_f( m_sock, (sockaddr*)&addr, &addrlen, SOCK_CLOEXEC | ( nonblock ? SOCK_NONBLOCK : 0 ) );
+  if ( -1 == newSock ) {
+    return nullptr;
+  }
+
+  FdMgr::GetInstance().addSocket( newSock, nonblock );
+  return Accepted( m_family, m_type, m_protocol, newSock, addr, addrlen );
+}
+
+Socket::SPtr Socket::Accepted(
+  int family, int type, int protocol, int sock, const sockaddr_storage& addr, socklen_t len )
+{
+  Socket::SPtr result( std::make_shared<Socket>( family, type, protocol ) );
+  if ( result->init( sock ) ) {
+    result->m_remoteAddress = Address::Create( (const sockaddr*)&addr, len );
+    return result;
   }
+  ::close( sock );
   return nullptr;
 }
 
+// 接受的连接从监听 socket 继承 TCP_NODELAY，SO_REUSEADDR 对其无意义，故不再调用 initSock
 bool Socket::init( int sock )
 {
-  FdCtx::SPtr ctx = FdMgr::GetInstance().get( sock );
+  FdCtx* ctx = FdMgr::GetInstance().get( sock );
   if ( ctx && ctx->isSocket() && !ctx->isClose() ) {
     m_sock = sock;
     m_isConnected = true;
-    initSock();
-    getLocalAddress();
-    getRemoteAddress();
     return true;
   }
   return false;
@@ -241,10 +438,15 @@ bool Socket::close()
   }
 
   m_isConnected = false;
+  if ( releaseZeroCopy() ) {
+    m_sock = -1;
+    return false;
+  }
   if ( m_sock != -1 ) {
     ::close( m_sock );
     m_sock = -1;
   }
+  runCloseHook();
 
   return false;
 }
@@ -271,6 +473,138 @@ int Socket::send( const iovec* buffers, size_t length, int flags )
   return -1;
 }
 
+int Socket::sendZeroCopy( const void* buffer, size_t length, std::shared_ptr<const void> holder, int flags )
+{
+  iovec iov { const_cast<void*>( buffer ), length };
+  return sendZeroCopy( &iov, 1, std::move( holder ), flags );
+}
+
+int Socket::sendZeroCopy( const iovec* buffers, size_t length, std::shared_ptr<const void> holder, int flags )
+{
+  if ( !isConnected() ) {
+    return -1;
+  }
+  size_t total { 0 };
+  for ( size_t i = 0; i < length; ++i ) {
+    total += buffers[i].iov_len;
+  }
+  if ( !prepareZeroCopy( total ) ) {
+    return send( buffers, length, flags );
+  }
+
+#ifdef MSG_ZEROCOPY
+  msghdr msg;
+  std::memset( &msg, 0, sizeof( msg ) );
+  msg.msg_iov = (iovec*)buffers;
+  msg.msg_iovlen = length;
+  int ret = ::sendmsg( m_sock, &msg, flags | MSG_ZEROCOPY );
+  if ( ret == -1 && errno == ENOBUFS ) {
+    // 在途通知超过 optmem_max，本次退化为拷贝
+    return send( buffers, length, flags );
+  }
+  if ( ret > 0 ) {
+    m_zeroCopy->track( std::move( holder ) );
+  }
+  return ret;
+#else
+  return send( buffers, length, flags );
+#endif
+}
+
+std::size_t Socket::getZeroCopyPending() const
+{
+  return m_zeroCopy ? m_zeroCopy->inFlight.load() : 0;
+}
+
+bool Socket::prepareZeroCopy( size_t total )
+{
+  uint32_t threshold { s_zerocopy_threshold.load( std::memory_order_relaxed ) };
+  if ( !threshold || total < threshold || m_type != SOCK_STREAM ) {
+    return false;
+  }
+  if ( m_zeroCopy ) {
+    if ( m_zeroCopy->inFlight ) {
+      // 顺带回收，未运行在 IOManager 中时只能靠这里释放
+      m_zeroCopy->reap();
+    }
+    return !m_zeroCopy->disabled;
+  }
+
+  m_zeroCopy = std::make_shared<ZeroCopyState>();
+  m_zeroCopy->fd = m_sock;
+#ifdef SO_ZEROCOPY
+  int val = 1;
+  if ( setsockopt( m_sock, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof( val ) ) ) {
+    SYLAR_LOG_DEBUG( g_logger ) << "SO_ZEROCOPY not supported sock=" << m_sock << " errno=" << errno
+                                << " errstr=" << strerror( errno );
+    m_zeroCopy->disabled = true;
+    return false;
+  }
+#else
+  m_zeroCopy->disabled = true;
+  return false;
+#endif
+
+  IOManager* iom { IOManager::GetThis() };
+  if ( iom ) {
+    std::shared_ptr<ZeroCopyState> state { m_zeroCopy };
+    if ( iom->watchErrorQueue( m_sock, [state]() { state->reap(); } ) ) {
+      m_zeroCopy->iom = iom;
+    }
+  }
+  return true;
+}
+
+// 关闭前回收已完成的通知；仍有在途发送时把 fd 和关闭回调交给 ZeroCopyState，返回 true，调用方不再关闭 fd
+// shutdown 使对端在队列中的数据发完后收到 FIN，本端挂起的读写被唤醒后读到 EOF，fd 在通知收齐或超时后关闭
+bool Socket::releaseZeroCopy()
+{
+  if ( !m_zeroCopy ) {
+    return false;
+  }
+  std::shared_ptr<ZeroCopyState> state { std::move( m_zeroCopy ) };
+  state->reap();
+  {
+    Mutex::Lock lock( state->mutex );
+    if ( state->inFlight && state->iom && state->fd != -1 ) {
+      SYLAR_LOG_DEBUG( g_logger ) << "defer close sock=" << state->fd << " with " << state->inFlight
+                                  << " zerocopy sends in flight";
+      state->closing = true;
+      state->closeHook.swap( m_closeHook );
+      ::shutdown( state->fd, SHUT_RDWR );
+      state->iom->cancelAll( state->fd );
+      state->closeTimer = state->iom->addTimer( s_zerocopy_close_timeout, [state]() { state->finishClose(); } );
+      return true;
+    }
+  }
+
+  // 不在 IOManager 中时收不到错误队列事件，在此有限地等待完成通知
+  if ( state->inFlight && state->fd != -1 ) {
+    ::shutdown( state->fd, SHUT_WR );
+    uint64_t deadline { GetCurrentMS() + s_zerocopy_close_timeout };
+    while ( state->inFlight && GetCurrentMS() < deadline ) {
+      pollfd pfd { state->fd, 0, 0 };
+      poll( &pfd, 1, 10 );
+      state->reap();
+    }
+  }
+  if ( state->iom ) {
+    state->iom->unwatchErrorQueue( state->fd );
+  }
+  std::deque<std::shared_ptr<const void>> pending;
+  {
+    Mutex::Lock lock( state->mutex );
+    if ( state->inFlight ) {
+      SYLAR_LOG_WARN( g_logger ) << "close sock=" << state->fd << " with " << state->inFlight
+                                 << " zerocopy sends still in flight";
+    }
+    state->fd = -1;
+    pending.swap( state->pending );
+    state->inFlight = 0;
+  }
+  return false;
+}
+
 int Socket::sendTo( const void* buffer, size_t length, const Address::SPtr to, int flags )
 {
   if ( isConnected() ) {
@@ -470,7 +804,7 @@ void Socket::initSock()
 {
   int val = 1;
   setOption( SOL_SOCKET, SO_REUSEADDR, val );
-  if ( m_type == SOCK_STREAM ) {
+  if ( m_type == SOCK_STREAM && m_family != AF_UNIX ) {
     setOption( IPPROTO_TCP, TCP_NODELAY, val );
   }
 }
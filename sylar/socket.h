@@ -3,16 +3,23 @@
 #include "address.h"
 #include "noncopyable.h"
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <sys/socket.h>
 
 namespace sylar {
 
+struct SocketProfile;
+struct ZeroCopyState;
+
 class Socket
   : public std::enable_shared_from_this<Socket>
   , Noncopyable
 {
+  // 在 bind/connect 之前设置选项时需要先创建 fd
+  friend struct SocketProfile;
+
 public:
   using SPtr = std::shared_ptr<Socket>;
   using WPtr = std::weak_ptr<Socket>;
@@ -68,7 +75,12 @@ public:
     return setOption( level, option, &value, sizeof( T ) );
   }
 
+  // 在 bind 之前调用，同一地址的多个监听 socket 由内核分摊新连接
+  bool setReusePort( bool val );
+
   SPtr accept();
+  // 不等待：监听 socket 为非阻塞且没有待接受的连接时返回 nullptr，errno 为 EAGAIN
+  SPtr tryAccept();
 
   bool bind( const Address::SPtr& addr );
   bool connect( const Address::SPtr& addr, uint64_t timeout_ms = -1 );
@@ -77,6 +89,12 @@ public:
 
   int send( const void* buffer, size_t length, int flags = 0 );
   int send( const iovec* buffers, size_t length, int flags = 0 );
+  // 长度不小于 socket.zerocopy.threshold 时以 MSG_ZEROCOPY 发送，holder 保持缓冲区存活直到内核通知发送完成，
+  // 期间调用方不得修改缓冲区；数据较小、内核不支持或内核实际做了拷贝（如回环）时退化为普通 send
+  int sendZeroCopy( const void* buffer, size_t length, std::shared_ptr<const void> holder, int flags = 0 );
+  int sendZeroCopy( const iovec* buffers, size_t length, std::shared_ptr<const void> holder, int flags = 0 );
+  // 尚未收到完成通知的零拷贝发送数
+  std::size_t getZeroCopyPending() const;
   int sendTo( const void* buffer, size_t length, const Address::SPtr to, int flags = 0 );
   int sendTo( const iovec* buffers, size_t length, const Address::SPtr to, int flags = 0 );
 
@@ -99,6 +117,9 @@ public:
   std::ostream& dump( std::ostream& os ) const;
   int getSocket() const { return m_sock; }
 
+  // fd 关闭后调用一次，由 close 或析构触发；用于按实际占用的 fd 计数
+  void setCloseHook( std::function<void()> cb ) { m_closeHook = std::move( cb ); }
+
   bool cancelRead();
   bool cancelWrite();
   bool cancelAccept();
@@ -107,7 +128,12 @@ public:
 private:
   void initSock();
   void newSock();
+  // 判断本次发送是否走零拷贝，首次使用时开启 SO_ZEROCOPY 并在 IOManager 上监听错误队列
+  bool prepareZeroCopy( size_t total );
+  bool releaseZeroCopy();
+  void runCloseHook();
   bool init( int sock );
+  static SPtr Accepted( int family, int type, int protocol, int sock, const sockaddr_storage& addr, socklen_t len );
 
 private:
   int m_sock;
@@ -118,6 +144,8 @@ private:
 
   Address::SPtr m_localAddress;
   Address::SPtr m_remoteAddress;
+  std::shared_ptr<ZeroCopyState> m_zeroCopy;
+  std::function<void()> m_closeHook;
 };
 
 std::ostream& operator<<( std::ostream& os, const Socket& sock );
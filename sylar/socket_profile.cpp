@@ -0,0 +1,207 @@
+#include "sylar/socket_profile.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <yaml-cpp/yaml.h>
+
+namespace sylar {
+
+static Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+namespace {
+
+// 配置项名与 SocketProfile 成员的对应关系，布尔项在配置中写 true/false
+struct ProfileField
+{
+  const char* name;
+  int SocketProfile::*member;
+  bool isBool;
+};
+
+const ProfileField s_fields[] {
+  { "send_buffer", &SocketProfile::sendBuffer, false },
+  { "recv_buffer", &SocketProfile::recvBuffer, false },
+  { "no_delay", &SocketProfile::noDelay, true },
+  { "defer_accept", &SocketProfile::deferAccept, false },
+  { "fast_open", &SocketProfile::fastOpen, false },
+  { "quick_ack", &SocketProfile::quickAck, true },
+  { "busy_poll", &SocketProfile::busyPoll, false },
+  { "notsent_lowat", &SocketProfile::notSentLowat, false },
+  { "backlog", &SocketProfile::backlog, false },
+};
+
+} // namespace
+
+template<>
+class LexicalCast<std::string, SocketProfile>
+{
+public:
+  SocketProfile operator()( const std::string& val )
+  {
+    YAML::Node node = YAML::Load( val );
+    SocketProfile profile;
+    if ( !node.IsMap() ) {
+      SYLAR_LOG_ERROR( g_logger ) << "socket profile config error: not a map, " << val;
+      return profile;
+    }
+    for ( auto it = node.begin(); it != node.end(); ++it ) {
+      std::string key { it->first.Scalar() };
+      const ProfileField* field { nullptr };
+      for ( const ProfileField& f : s_fields ) {
+        if ( key == f.name ) {
+          field = &f;
+          break;
+        }
+      }
+      if ( !field ) {
+        SYLAR_LOG_ERROR( g_logger ) << "socket profile config error: unknown option " << key;
+        continue;
+      }
+      int value { field->isBool ? static_cast<int>( it->second.as<bool>() ) : it->second.as<int>() };
+      if ( value < 0 ) {
+        SYLAR_LOG_ERROR( g_logger ) << "socket profile config error: " << key << "=" << value << " is negative";
+        continue;
+      }
+      profile.*field->member = value;
+    }
+    return profile;
+  }
+};
+
+template<>
+class LexicalCast<SocketProfile, std::string>
+{
+public:
+  std::string operator()( const SocketProfile& profile )
+  {
+    YAML::Node node( YAML::NodeType::Map );
+    for ( const ProfileField& field : s_fields ) {
+      int value { profile.*field.member };
+      if ( value < 0 ) {
+        continue;
+      }
+      if ( field.isBool ) {
+        node[field.name] = value != 0;
+      } else {
+        node[field.name] = value;
+      }
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+  }
+};
+
+static ConfigVar<std::map<std::string, SocketProfile>>::SPtr g_socket_profiles { Config::Lookup(
+  "socket.profiles", std::map<std::string, SocketProfile> {}, "named socket tuning profiles" ) };
+
+bool SocketProfile::operator==( const SocketProfile& other ) const
+{
+  for ( const ProfileField& field : s_fields ) {
+    if ( this->*field.member != other.*field.member ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SocketProfile::apply( Socket& sock, Stage stage ) const
+{
+  if ( !sock.isValid() ) {
+    sock.newSock();
+    if ( !sock.isValid() ) {
+      return false;
+    }
+  }
+
+  bool ok { true };
+  std::stringstream report;
+  auto set = [&]( const char* name, int level, int option, int value ) {
+    if ( value < 0 ) {
+      return;
+    }
+    if ( !sock.setOption( level, option, value ) ) {
+      ok = false;
+      report << " " << name << "=" << value << "(fail errno=" << errno << ")";
+      return;
+    }
+    report << " " << name << "=" << value;
+  };
+  // 内核会调整缓冲区大小，读回实际值以便发现被 wmem_max / rmem_max 截断的配置
+  auto set_buffer = [&]( const char* name, int option, int value ) {
+    if ( value < 0 ) {
+      return;
+    }
+    set( name, SOL_SOCKET, option, value );
+    int actual { 0 };
+    if ( sock.getOption( SOL_SOCKET, option, actual ) ) {
+      report << "(actual " << actual << ")";
+    }
+  };
+
+  const bool tcp { sock.getType() == SOCK_STREAM };
+  if ( stage == LISTEN || stage == CONNECT ) {
+    set_buffer( "send_buffer", SO_SNDBUF, sendBuffer );
+    set_buffer( "recv_buffer", SO_RCVBUF, recvBuffer );
+    set( "busy_poll", SOL_SOCKET, SO_BUSY_POLL, busyPoll );
+    if ( tcp ) {
+      set( "no_delay", IPPROTO_TCP, TCP_NODELAY, noDelay );
+    }
+  }
+  if ( tcp && stage == LISTEN ) {
+    set( "defer_accept", IPPROTO_TCP, TCP_DEFER_ACCEPT, deferAccept );
+    set( "fast_open", IPPROTO_TCP, TCP_FASTOPEN, fastOpen );
+  }
+#ifdef TCP_FASTOPEN_CONNECT
+  if ( tcp && stage == CONNECT ) {
+    set( "fast_open", IPPROTO_TCP, TCP_FASTOPEN_CONNECT, fastOpen > 0 ? 1 : fastOpen );
+  }
+#endif
+  if ( tcp && ( stage == ACCEPT || stage == CONNECT ) ) {
+    set( "notsent_lowat", IPPROTO_TCP, TCP_NOTSENT_LOWAT, notSentLowat );
+    set( "quick_ack", IPPROTO_TCP, TCP_QUICKACK, quickAck );
+  }
+
+  std::string applied { report.str() };
+  if ( !ok ) {
+    SYLAR_LOG_ERROR( g_logger ) << "apply socket profile fail, sock=" << sock.getSocket() << applied;
+  } else if ( stage != ACCEPT && !applied.empty() ) {
+    SYLAR_LOG_INFO( g_logger ) << "apply socket profile, sock=" << sock.getSocket() << applied;
+  }
+  return ok;
+}
+
+std::ostream& SocketProfile::dump( std::ostream& os ) const
+{
+  os << "[SocketProfile";
+  for ( const ProfileField& field : s_fields ) {
+    if ( this->*field.member >= 0 ) {
+      os << " " << field.name << "=" << this->*field.member;
+    }
+  }
+  os << "]";
+  return os;
+}
+
+SocketProfile::SPtr SocketProfile::Get( const std::string& name )
+{
+  if ( name.empty() ) {
+    return nullptr;
+  }
+  std::map<std::string, SocketProfile> profiles { g_socket_profiles->getValue() };
+  auto it = profiles.find( name );
+  if ( it == profiles.end() ) {
+    SYLAR_LOG_ERROR( g_logger ) << "socket profile " << name << " not found in socket.profiles";
+    return nullptr;
+  }
+  return std::make_shared<SocketProfile>( it->second );
+}
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "sylar/socket.h"
+#include <memory>
+#include <ostream>
+#include <string>
+
+namespace sylar {
+
+// 一组 socket 调优选项，在配置 socket.profiles 下按名字定义，由 TcpServer 和 HttpConnectionPool 引用
+// 未配置的选项为 -1，保持系统默认值
+struct SocketProfile
+{
+  using SPtr = std::shared_ptr<SocketProfile>;
+
+  // 应用选项的时机
+  enum Stage
+  {
+    // bind 之前，设置在监听 socket 上；缓冲区、TCP_NODELAY、SO_BUSY_POLL 等由接受的连接继承
+    LISTEN = 0,
+    // accept 之后，只设置不会从监听 socket 继承的选项
+    ACCEPT = 1,
+    // connect 之前
+    CONNECT = 2
+  };
+
+  // SO_SNDBUF / SO_RCVBUF，字节，内核会加倍并受 wmem_max / rmem_max 限制
+  int sendBuffer { -1 };
+  int recvBuffer { -1 };
+  // TCP_NODELAY，未配置时保持 initSock 默认开启
+  int noDelay { -1 };
+  // TCP_DEFER_ACCEPT，秒，仅监听端
+  int deferAccept { -1 };
+  // 监听端为 TCP_FASTOPEN 队列长度，连接端非 0 时开启 TCP_FASTOPEN_CONNECT
+  int fastOpen { -1 };
+  // TCP_QUICKACK，仅对已建立的连接有意义
+  int quickAck { -1 };
+  // SO_BUSY_POLL，微秒
+  int busyPoll { -1 };
+  // TCP_NOTSENT_LOWAT，字节
+  int notSentLowat { -1 };
+  // listen 积压队列长度
+  int backlog { -1 };
+
+  bool operator==( const SocketProfile& other ) const;
+
+  int getBacklog() const { return backlog > 0 ? backlog : SOMAXCONN; }
+
+  // 按阶段设置选项，全部成功返回 true；LISTEN 和 CONNECT 记录实际生效的值，ACCEPT 只记录失败
+  bool apply( Socket& sock, Stage stage ) const;
+
+  std::ostream& dump( std::ostream& os ) const;
+
+  // 按名字查找配置中的 profile，名字为空时返回 nullptr，不存在时记录错误并返回 nullptr
+  static SPtr Get( const std::string& name );
+};
+
+}
@@ -1,11 +1,56 @@
 #include "sylar/socket_stream.h"
 #include "sylar/bytearray.h"
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
 #include "sylar/socket.h"
+#include <algorithm>
+#include <atomic>
 #include <bits/types/struct_iovec.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
 #include <vector>
 
 namespace sylar {
 
+static Logger::SPtr g_logger { SYLAR_LOG_NAME( "system" ) };
+
+static ConfigVar<uint32_t>::SPtr g_splice_pipe_size = Config::Lookup(
+  "socket.splice.pipe_size", (uint32_t)0, "kernel pipe size used by SocketStream splice, 0 keeps the default" );
+
+static ConfigVar<uint32_t>::SPtr g_socket_stream_flush_threshold = Config::Lookup(
+  "socket_stream.flush_threshold", (uint32_t)( 64 * 1024 ), "queued bytes that trigger a flush, 0 disables" );
+
+static std::atomic<uint32_t> s_flush_threshold { 64 * 1024 };
+
+struct _SocketStreamIniter
+{
+  _SocketStreamIniter()
+  {
+    s_flush_threshold = g_socket_stream_flush_threshold->getValue();
+    g_socket_stream_flush_threshold->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_flush_threshold = new_value; } );
+  }
+};
+
+static _SocketStreamIniter s_socket_stream_initer;
+
+// splice 的中转管道，每个流惰性创建一个，pending 为已写入管道尚未搬出的字节数
+struct SplicePipe
+{
+  ~SplicePipe()
+  {
+    ::close( fds[0] );
+    ::close( fds[1] );
+  }
+
+  int fds[2] { -1, -1 };
+  size_t capacity { 0 };
+  size_t pending { 0 };
+};
+
 SocketStream::SocketStream( Socket::SPtr sock, bool owner ) : m_socket { sock }, m_owner { owner } {}
 
 SocketStream::~SocketStream()
@@ -49,6 +94,10 @@ int SocketStream::write( const void* buffer, size_t length )
   if ( !isConnected() ) {
     return -1;
   }
+  if ( m_queued ) {
+    iovec iov { const_cast<void*>( buffer ), length };
+    return flushQueue( &iov, 1 );
+  }
   return m_socket->send( buffer, length );
 }
 
@@ -60,7 +109,157 @@ int SocketStream::write( ByteArray::SPtr ba, size_t length )
 
   std::vector<iovec> iovs;
   ba->getReadBuffers( iovs, length );
-  int ret = m_socket->send( iovs.data(), iovs.size() );
+  int ret = m_queued ? flushQueue( iovs.data(), iovs.size() ) : m_socket->send( iovs.data(), iovs.size() );
+  if ( ret > 0 ) {
+    ba->setPosition( ba->getPosition() + ret );
+  }
+
+  return ret;
+}
+
+int SocketStream::writev( const iovec* iov, size_t count )
+{
+  if ( !isConnected() ) {
+    return -1;
+  }
+  return m_queued ? flushQueue( iov, count ) : m_socket->send( iov, count );
+}
+
+int SocketStream::queue( const void* buffer, size_t length, std::shared_ptr<const void> holder )
+{
+  if ( length == 0 ) {
+    return 0;
+  }
+
+  if ( holder ) {
+    m_queue.push_back( { static_cast<const char*>( buffer ), 0, length } );
+    m_queueHolders.push_back( std::move( holder ) );
+  } else if ( !m_queue.empty() && !m_queue.back().data
+              && m_queue.back().offset + m_queue.back().length == m_queueBuf.size() ) {
+    // 连续拷贝的小块合并为一个 iovec
+    m_queue.back().length += length;
+    m_queueBuf.append( static_cast<const char*>( buffer ), length );
+  } else {
+    m_queue.push_back( { nullptr, m_queueBuf.size(), length } );
+    m_queueBuf.append( static_cast<const char*>( buffer ), length );
+  }
+  m_queued += length;
+
+  uint32_t threshold { s_flush_threshold };
+  if ( threshold && m_queued >= threshold && flush() < 0 ) {
+    return -1;
+  }
+  return length;
+}
+
+int SocketStream::queue( ByteArray::SPtr ba, size_t length )
+{
+  std::vector<iovec> iovs;
+  ba->getReadBuffers( iovs, length );
+  size_t total { 0 };
+  for ( auto& iov : iovs ) {
+    if ( iov.iov_len ) {
+      m_queue.push_back( { static_cast<const char*>( iov.iov_base ), 0, iov.iov_len } );
+      total += iov.iov_len;
+    }
+  }
+  m_queueHolders.push_back( ba );
+  ba->setPosition( ba->getPosition() + total );
+  m_queued += total;
+
+  uint32_t threshold { s_flush_threshold };
+  if ( threshold && m_queued >= threshold && flush() < 0 ) {
+    return -1;
+  }
+  return total;
+}
+
+int SocketStream::queue( const IOBuf& buf )
+{
+  if ( buf.empty() ) {
+    return 0;
+  }
+  for ( std::string_view seg : buf ) {
+    m_queue.push_back( { seg.data(), 0, seg.size() } );
+  }
+  m_queueHolders.push_back( std::make_shared<IOBuf>( buf ) );
+  m_queued += buf.size();
+
+  uint32_t threshold { s_flush_threshold };
+  if ( threshold && m_queued >= threshold && flush() < 0 ) {
+    return -1;
+  }
+  return buf.size();
+}
+
+int SocketStream::flush()
+{
+  if ( !m_queued ) {
+    return 0;
+  }
+  if ( !isConnected() ) {
+    return -1;
+  }
+
+  size_t total { m_queued };
+  int ret = flushQueue( nullptr, 0 );
+  return ret < 0 ? ret : total;
+}
+
+int SocketStream::flushQueue( const iovec* iov, size_t count )
+{
+  std::vector<iovec> iovs;
+  iovs.reserve( m_queue.size() + count );
+  for ( auto& chunk : m_queue ) {
+    const char* data { chunk.data ? chunk.data : &m_queueBuf[chunk.offset] };
+    iovs.push_back( { const_cast<char*>( data ), chunk.length } );
+  }
+  size_t extra { 0 };
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( iov[i].iov_len ) {
+      iovs.push_back( iov[i] );
+      extra += iov[i].iov_len;
+    }
+  }
+
+  int ret { 0 };
+  size_t idx { 0 };
+  while ( idx < iovs.size() ) {
+    ret = m_socket->send( &iovs[idx], std::min<size_t>( iovs.size() - idx, IOV_MAX ) );
+    if ( ret <= 0 ) {
+      break;
+    }
+    size_t left = ret;
+    while ( left > 0 && left >= iovs[idx].iov_len ) {
+      left -= iovs[idx].iov_len;
+      ++idx;
+    }
+    if ( left > 0 ) {
+      iovs[idx].iov_base = (char*)iovs[idx].iov_base + left;
+      iovs[idx].iov_len -= left;
+    }
+  }
+
+  m_queue.clear();
+  m_queueBuf.clear();
+  m_queueHolders.clear();
+  m_queued = 0;
+  return idx < iovs.size() ? ( ret < 0 ? ret : -1 ) : extra;
+}
+
+int SocketStream::writeZeroCopy( ByteArray::SPtr ba, size_t length )
+{
+  if ( !isConnected() ) {
+    return -1;
+  }
+
+  if ( flush() < 0 ) {
+    return -1;
+  }
+
+  std::vector<iovec> iovs;
+  ba->getReadBuffers( iovs, length );
+  int ret = m_socket->sendZeroCopy( iovs.data(), iovs.size(), ba );
   if ( ret > 0 ) {
     ba->setPosition( ba->getPosition() + ret );
   }
@@ -70,9 +269,126 @@ int SocketStream::write( ByteArray::SPtr ba, size_t length )
 
 void SocketStream::close()
 {
+  flush();
+  // 未连接或发送失败时排队的数据直接丢弃
+  m_queue.clear();
+  m_queueBuf.clear();
+  m_queueHolders.clear();
+  m_queued = 0;
   if ( m_socket ) {
     m_socket->close();
   }
 }
 
-}
\ No newline at end of file
+bool SocketStream::preparePipe()
+{
+  if ( m_pipe ) {
+    return true;
+  }
+
+  std::unique_ptr<SplicePipe> pipe { new SplicePipe };
+  if ( pipe2( pipe->fds, O_CLOEXEC ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "SocketStream pipe2 fail errno=" << errno << " errstr=" << strerror( errno );
+    return false;
+  }
+
+  int size = fcntl( pipe->fds[1], F_GETPIPE_SZ );
+  uint32_t want { g_splice_pipe_size->getValue() };
+  if ( want && (uint32_t)size != want ) {
+    int ret = fcntl( pipe->fds[1], F_SETPIPE_SZ, (int)want );
+    if ( ret == -1 ) {
+      SYLAR_LOG_ERROR( g_logger ) << "SocketStream F_SETPIPE_SZ(" << want << ") fail errno=" << errno
+                                  << " errstr=" << strerror( errno ) << ", keep " << size;
+    } else {
+      size = ret;
+    }
+  }
+  pipe->capacity = size;
+  m_pipe = std::move( pipe );
+  return true;
+}
+
+int SocketStream::drainPipe( int fd, loff_t* offset )
+{
+  size_t total { m_pipe->pending };
+  while ( m_pipe->pending ) {
+    ssize_t n = ::splice( m_pipe->fds[0], nullptr, fd, offset, m_pipe->pending, SPLICE_F_MOVE );
+    if ( n <= 0 ) {
+      m_pipe.reset();
+      return -1;
+    }
+    m_pipe->pending -= n;
+  }
+  return total;
+}
+
+int SocketStream::spliceTo( SocketStream& dst, size_t length )
+{
+  // dst 队列中的数据先于搬运的数据发出
+  if ( !dst.isConnected() || dst.flush() < 0 ) {
+    return -1;
+  }
+  return spliceTo( dst.m_socket->getSocket(), nullptr, length );
+}
+
+int SocketStream::spliceTo( int fd, loff_t* offset, size_t length )
+{
+  if ( !isConnected() || !preparePipe() ) {
+    return -1;
+  }
+
+  ssize_t n = ::splice(
+    m_socket->getSocket(), nullptr, m_pipe->fds[1], nullptr, std::min( length, m_pipe->capacity ), SPLICE_F_MOVE );
+  if ( n <= 0 ) {
+    return n;
+  }
+  m_pipe->pending = n;
+  return drainPipe( fd, offset );
+}
+
+int SocketStream::spliceFrom( int fd, loff_t* offset, size_t length )
+{
+  if ( !isConnected() || flush() < 0 || !preparePipe() ) {
+    return -1;
+  }
+
+  ssize_t n = ::splice( fd, offset, m_pipe->fds[1], nullptr, std::min( length, m_pipe->capacity ), SPLICE_F_MOVE );
+  if ( n <= 0 ) {
+    return n;
+  }
+  m_pipe->pending = n;
+  return drainPipe( m_socket->getSocket(), nullptr );
+}
+
+// 出错时以 shutdown 代替 close 唤醒另一方向的协程，fd 在两个方向都释放流之后才关闭，不会被复用
+void SocketStream::Pipe( SPtr a, SPtr b, std::function<void()> cb )
+{
+  IOManager* iom { IOManager::GetThis() };
+  if ( !iom ) {
+    SYLAR_LOG_ERROR( g_logger ) << "SocketStream::Pipe must be called inside an IOManager";
+    return;
+  }
+
+  std::shared_ptr<std::atomic<int>> remaining { std::make_shared<std::atomic<int>>( 2 ) };
+  auto forward = [remaining, cb]( SPtr src, SPtr dst ) {
+    int n;
+    while ( ( n = src->spliceTo( *dst, SIZE_MAX ) ) > 0 ) {
+    }
+    if ( n == 0 ) {
+      ::shutdown( dst->getSocket()->getSocket(), SHUT_WR );
+    } else {
+      SYLAR_LOG_DEBUG( g_logger ) << "SocketStream::Pipe " << src->getSocket()->getSocket() << " -> "
+                                  << dst->getSocket()->getSocket() << " fail errno=" << errno
+                                  << " errstr=" << strerror( errno );
+      ::shutdown( src->getSocket()->getSocket(), SHUT_RDWR );
+      ::shutdown( dst->getSocket()->getSocket(), SHUT_RDWR );
+    }
+    if ( --*remaining == 0 && cb ) {
+      cb();
+    }
+  };
+  iom->schedule( std::bind( forward, a, b ) );
+  iom->schedule( std::bind( forward, b, a ) );
+}
+
+}
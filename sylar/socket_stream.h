@@ -1,32 +1,89 @@
 #pragma once
 
 #include "sylar/bytearray.h"
+#include "sylar/iobuf.h"
 #include "sylar/socket.h"
 #include "sylar/stream.h"
+#include <fcntl.h>
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace sylar {
 
+struct SplicePipe;
+
 class SocketStream : public Stream
 {
 public:
   using SPtr = std::shared_ptr<SocketStream>;
 
+  // 双向转发 a、b 之间的数据直到两个方向都结束，每个方向一个协程，均以 splice 经内核管道搬运；
+  // 一方读到 EOF 时对另一方 shutdown 写端，出错时关闭两端，两个方向都结束后调用 cb
+  static void Pipe( SPtr a, SPtr b, std::function<void()> cb = nullptr );
+
   SocketStream( Socket::SPtr sock, bool owner = true );
+  // 析构时不会 flush，输出队列中的数据需要显式 flush 或 close
   ~SocketStream();
 
   virtual int read( void* buffer, size_t length ) override;
   virtual int read( ByteArray::SPtr ba, size_t length ) override;
   virtual int write( const void* buffer, size_t length ) override;
   virtual int write( ByteArray::SPtr ba, size_t length ) override;
+  virtual int writev( const iovec* iov, size_t count ) override;
+  // 先 flush 输出队列再关闭 socket
   virtual void close() override;
 
+  // 以 Socket::sendZeroCopy 发送，ba 在内核完成发送前保持存活，期间不得修改其已发送部分
+  int writeZeroCopy( ByteArray::SPtr ba, size_t length );
+
+  // 经内核管道把本端至多 length 字节搬到 dst，数据不进入用户态；返回搬运的字节数，EOF 返回 0，出错返回 -1。
+  // 写入端的输出队列先 flush，保证发送顺序。同一个流上的 splice 调用不可并发
+  int spliceTo( SocketStream& dst, size_t length );
+  // 搬到文件或管道 fd，offset 为 nullptr 时使用并推进 fd 自身的文件偏移
+  int spliceTo( int fd, loff_t* offset, size_t length );
+  // 从文件或管道 fd 搬运至多 length 字节发送到本端，本端输出队列先 flush
+  int spliceFrom( int fd, loff_t* offset, size_t length );
+
+  // 输出队列：数据先排队，flush 时与之后的 write/writev 一起以一次 sendmsg 发出，排队字节数达到
+  // socket_stream.flush_threshold 时自动 flush。holder 为空时拷贝数据，否则只引用 buffer 并持有 holder 到发出为止。
+  // 返回排队的字节数，自动 flush 失败时返回 -1
+  int queue( const void* buffer, size_t length, std::shared_ptr<const void> holder = nullptr );
+  // 引用 ba 中可读的数据并推进其位置，发出前 ba 的这部分不得修改
+  int queue( ByteArray::SPtr ba, size_t length );
+  // 引用 buf 的全部块，块的引用计数保证发出前数据有效
+  int queue( const IOBuf& buf );
+  // 发出全部排队数据，返回发出的字节数，出错返回 -1 并丢弃队列
+  int flush();
+  size_t getQueued() const { return m_queued; }
+
   Socket::SPtr getSocket() const { return m_socket; }
   bool isConnected() const;
 
+protected:
+  // 把管道中的数据全部写入 fd，失败时丢弃管道以免残留数据串到下一次搬运
+  int drainPipe( int fd, loff_t* offset );
+  bool preparePipe();
+  // 把队列和 iov 依次全部发出，返回 iov 部分的字节数
+  int flushQueue( const iovec* iov, size_t count );
+
+  struct OutputChunk
+  {
+    // 为 nullptr 时数据拷贝在 m_queueBuf 的 offset 处，缓冲区扩容后地址会变，flush 时才转换为指针
+    const char* data;
+    size_t offset;
+    size_t length;
+  };
+
 protected:
   Socket::SPtr m_socket;
   bool m_owner;
+  std::unique_ptr<SplicePipe> m_pipe;
+  std::vector<OutputChunk> m_queue;
+  std::string m_queueBuf;
+  std::vector<std::shared_ptr<const void>> m_queueHolders;
+  size_t m_queued { 0 };
 };
 
 }
\ No newline at end of file
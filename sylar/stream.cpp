@@ -63,4 +63,24 @@ int Stream::writeFixSize( ByteArray::SPtr ba, size_t length )
   return length;
 }
 
-}
\ No newline at end of file
+int Stream::writev( const iovec* iov, size_t count )
+{
+  int total = 0;
+  for ( size_t i = 0; i < count; ++i ) {
+    if ( iov[i].iov_len == 0 ) {
+      continue;
+    }
+    int len = write( iov[i].iov_base, iov[i].iov_len );
+    if ( len <= 0 ) {
+      return total ? total : len;
+    }
+    total += len;
+    if ( (size_t)len < iov[i].iov_len ) {
+      break;
+    }
+  }
+
+  return total;
+}
+
+}
@@ -2,6 +2,7 @@
 
 #include "sylar/bytearray.h"
 #include <memory>
+#include <sys/uio.h>
 
 namespace sylar {
 
@@ -19,6 +20,8 @@ public:
   virtual int write( ByteArray::SPtr ba, size_t length ) = 0;
   virtual int writeFixSize( const void* buffer, size_t length );
   virtual int writeFixSize( ByteArray::SPtr ba, size_t length );
+  // 聚集写，与 write 一样可能只写出一部分；默认逐块调用 write，能一次系统调用写出多块的流应覆盖
+  virtual int writev( const iovec* iov, size_t count );
   virtual void close() = 0;
 };
 
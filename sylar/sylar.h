@@ -1,22 +1,29 @@
 #pragma once
 
 #include "sylar/address.h"
+#include "sylar/buffered_stream.h"
+#include "sylar/chunk_pool.h"
 #include "sylar/config.h"
 #include "sylar/endian.h"
 #include "sylar/fd_manager.h"
 #include "sylar/fiber.h"
 #include "sylar/hook.h"
+#include "sylar/hugepage.h"
 #include "sylar/http/http.h"
 #include "sylar/http/http_connection.h"
 #include "sylar/http/http_parser.h"
 #include "sylar/http/http_server.h"
 #include "sylar/http/http_session.h"
+#include "sylar/iobuf.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
+#include "sylar/offload.h"
 #include "sylar/scheduler.h"
+#include "sylar/shm_stream.h"
 #include "sylar/singleton.h"
 #include "sylar/socket.h"
+#include "sylar/socket_profile.h"
 #include "sylar/stream.h"
 #include "sylar/thread.h"
 #include "sylar/uri.h"
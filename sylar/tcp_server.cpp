@@ -2,10 +2,17 @@
 #include "sylar/log.h"
 #include "sylar/address.h"
 #include "sylar/config.h"
+#include "sylar/fiber.h"
+#include "sylar/hook.h"
 #include "sylar/iomanager.h"
 #include "sylar/socket.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 #include <functional>
+#include <sched.h>
 #include <vector>
 
 namespace sylar {
@@ -13,14 +20,106 @@ namespace sylar {
 static sylar::ConfigVar<uint64_t>::SPtr g_tcp_server_read_timeout
   = sylar::Config::Lookup( "tcp_server.read_timeout", (uint64_t)( 60 * 1000 * 2 ), "tcp server read timeout" );
 
+static sylar::ConfigVar<uint32_t>::SPtr g_tcp_server_accept_batch = sylar::Config::Lookup(
+  "tcp_server.accept_batch", (uint32_t)64, "max connections accepted per wakeup before handing them to workers" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_tcp_server_reuseport_listeners = sylar::Config::Lookup(
+  "tcp_server.reuseport_listeners", (uint32_t)0, "SO_REUSEPORT listeners per address, 0 for a single listener" );
+
+static sylar::ConfigVar<bool>::SPtr g_tcp_server_incoming_cpu = sylar::Config::Lookup(
+  "tcp_server.incoming_cpu",
+  false,
+  "set SO_INCOMING_CPU on each reuseport listener to the cpu of its accept thread, use with pinned threads" );
+
+static sylar::ConfigVar<std::string>::SPtr g_tcp_server_socket_profile = sylar::Config::Lookup(
+  "tcp_server.socket_profile", std::string(), "default socket.profiles entry applied to tcp server sockets" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_tcp_server_max_connections = sylar::Config::Lookup(
+  "tcp_server.max_connections", (uint32_t)0, "max live connections per tcp server, 0 for unlimited" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_tcp_server_global_max_connections = sylar::Config::Lookup(
+  "tcp_server.global_max_connections", (uint32_t)0, "max live connections of all tcp servers, 0 for unlimited" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_tcp_server_low_watermark = sylar::Config::Lookup(
+  "tcp_server.low_watermark",
+  (uint32_t)90,
+  "paused accept resumes once connections drop to this percent of the limit" );
+
+static sylar::ConfigVar<std::string>::SPtr g_tcp_server_overload_policy = sylar::Config::Lookup(
+  "tcp_server.overload_policy",
+  std::string( "pause" ),
+  "when over max connections: pause (stop accepting) or close (accept and close at once)" );
+
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_NAME( "system" );
 
+static std::atomic<std::size_t> s_global_max_connections { 0 };
+static std::atomic<uint32_t> s_low_watermark { 90 };
+static std::atomic<std::size_t> s_global_connections { 0 };
+
+static TcpServer::OverloadPolicy ParsePolicy( const std::string& policy )
+{
+  if ( policy == "close" ) {
+    return TcpServer::CLOSE;
+  }
+  if ( policy != "pause" ) {
+    SYLAR_LOG_ERROR( g_logger ) << "unknown tcp_server.overload_policy=" << policy << ", use pause";
+  }
+  return TcpServer::PAUSE;
+}
+
+struct _TcpServerIniter
+{
+  _TcpServerIniter()
+  {
+    s_global_max_connections = g_tcp_server_global_max_connections->getValue();
+    g_tcp_server_global_max_connections->addListener(
+      []( const uint32_t& old_value, const uint32_t& new_value ) { s_global_max_connections = new_value; } );
+    s_low_watermark = std::min<uint32_t>( g_tcp_server_low_watermark->getValue(), 100 );
+    g_tcp_server_low_watermark->addListener( []( const uint32_t& old_value, const uint32_t& new_value ) {
+      s_low_watermark = std::min<uint32_t>( new_value, 100 );
+    } );
+  }
+};
+
+static _TcpServerIniter s_tcp_server_initer;
+
+namespace {
+
+// 因超限挂起的 accept 协程，连接关闭时检查是否可以恢复
+struct PausedAccept
+{
+  TcpServer::SPtr server;
+  IOManager* iom;
+  Fiber::SPtr fiber;
+  // 恢复时固定调度到的线程，-1 表示不限
+  int thread;
+};
+
+} // namespace
+
+static Mutex s_paused_mutex;
+static std::vector<PausedAccept> s_paused;
+static std::atomic<std::size_t> s_paused_count { 0 };
+
+// 超过 max 即超限；恢复时要求回落到低水位（含）以下
+static bool OverLimit( std::size_t count, std::size_t max, bool resume )
+{
+  if ( !max ) {
+    return false;
+  }
+  return resume ? count > max * s_low_watermark / 100 : count >= max;
+}
+
 TcpServer::TcpServer( sylar::IOManager* worker, sylar::IOManager* accept_worker )
   : m_worker { worker }
   , m_acceptWorker { accept_worker }
   , m_recvTimeout { g_tcp_server_read_timeout->getValue() }
   , m_name { "sylar/1.0.0" }
   , m_isStop { true }
+  , m_reusePortListeners { g_tcp_server_reuseport_listeners->getValue() }
+  , m_socketProfileName { g_tcp_server_socket_profile->getValue() }
+  , m_maxConnections { g_tcp_server_max_connections->getValue() }
+  , m_overloadPolicy { ParsePolicy( g_tcp_server_overload_policy->getValue() ) }
 {}
 
 TcpServer::~TcpServer()
@@ -42,22 +141,38 @@ bool TcpServer::bind( sylar::Address::SPtr addr )
 
 bool TcpServer::bind( const std::vector<Address::SPtr>& addrs, std::vector<Address::SPtr>& fails )
 {
+  // 开启 reuseport 时每个地址的监听 socket 连续存放，start 中按下标分给各个 accept 线程
+  const std::size_t listeners { std::max<std::size_t>( m_reusePortListeners, 1 ) };
+  m_socketProfile = SocketProfile::Get( m_socketProfileName );
   for ( const Address::SPtr& addr : addrs ) {
-    Socket::SPtr sock { Socket::CreateTCP( addr ) };
-    if ( !sock->bind( addr ) ) {
-      SYLAR_LOG_ERROR( g_logger ) << "bind fail errno=" << errno << " errstr=" << strerror( errno ) << " addr=["
-                                  << addr->toString() << "]";
-      fails.push_back( addr );
-      continue;
-    }
+    for ( std::size_t i = 0; i < listeners; ++i ) {
+      Socket::SPtr sock { Socket::CreateTCP( addr ) };
+      if ( m_reusePortListeners && !sock->setReusePort( true ) ) {
+        SYLAR_LOG_ERROR( g_logger ) << "set SO_REUSEPORT fail errno=" << errno << " errstr=" << strerror( errno )
+                                    << " addr=[" << addr->toString() << "]";
+        fails.push_back( addr );
+        break;
+      }
 
-    if ( !sock->listen() ) {
-      SYLAR_LOG_ERROR( g_logger ) << "listen fail errno=" << errno << " errstr=" << strerror( errno ) << " addr=["
-                                  << addr->toString() << "]";
-      fails.push_back( addr );
-      continue;
+      if ( m_socketProfile ) {
+        m_socketProfile->apply( *sock, SocketProfile::LISTEN );
+      }
+
+      if ( !sock->bind( addr ) ) {
+        SYLAR_LOG_ERROR( g_logger ) << "bind fail errno=" << errno << " errstr=" << strerror( errno ) << " addr=["
+                                    << addr->toString() << "]";
+        fails.push_back( addr );
+        break;
+      }
+
+      if ( !sock->listen( m_socketProfile ? m_socketProfile->getBacklog() : SOMAXCONN ) ) {
+        SYLAR_LOG_ERROR( g_logger ) << "listen fail errno=" << errno << " errstr=" << strerror( errno )
+                                    << " addr=[" << addr->toString() << "]";
+        fails.push_back( addr );
+        break;
+      }
+      m_socks.push_back( sock );
     }
-    m_socks.push_back( sock );
   }
 
   if ( !fails.empty() ) {
@@ -71,16 +186,178 @@ bool TcpServer::bind( const std::vector<Address::SPtr>& addrs, std::vector<Addre
   return true;
 }
 
+TcpServer::Overload TcpServer::checkOverload( bool resume ) const
+{
+  if ( OverLimit( m_connections, m_maxConnections, resume ) ) {
+    return SERVER_LIMIT;
+  }
+  if ( OverLimit( s_global_connections, s_global_max_connections, resume ) ) {
+    return GLOBAL_LIMIT;
+  }
+  return NOT_OVERLOADED;
+}
+
+void TcpServer::trackConnection( const Socket::SPtr& client )
+{
+  ++m_connections;
+  ++s_global_connections;
+  std::weak_ptr<TcpServer> weak_server { shared_from_this() };
+  // fd 关闭之后才扣减计数，保证计数不低于实际占用的 fd 数
+  client->setCloseHook( [weak_server]() {
+    TcpServer::SPtr server { weak_server.lock() };
+    if ( server ) {
+      --server->m_connections;
+    }
+    --s_global_connections;
+    if ( s_paused_count ) {
+      ResumePaused();
+    }
+  } );
+}
+
+void TcpServer::pauseAccept( Socket::SPtr sock, Overload reason, int thread )
+{
+  {
+    Mutex::Lock lock( s_paused_mutex );
+    // 登记前再检查一次，避免检查之后连接已全部关闭而错过唤醒
+    if ( m_isStop || checkOverload( true ) == NOT_OVERLOADED ) {
+      return;
+    }
+    s_paused.push_back( { shared_from_this(), IOManager::GetThis(), Fiber::GetThis(), thread } );
+    ++s_paused_count;
+  }
+  ++m_pauses;
+  SYLAR_LOG_WARN( g_logger ) << "pause accept, " << ( reason == SERVER_LIMIT ? "server" : "global" )
+                             << " connection limit reached, sock=" << sock->getSocket()
+                             << " connections=" << m_connections << " global=" << s_global_connections;
+  // 此时监听 socket 不在 epoll 中，新连接留在内核积压队列里，队列满后由内核拒绝
+  Fiber::YieldToHold();
+  SYLAR_LOG_INFO( g_logger ) << "resume accept, sock=" << sock->getSocket() << " connections=" << m_connections
+                             << " global=" << s_global_connections;
+}
+
+void TcpServer::ResumePaused()
+{
+  std::vector<PausedAccept> resumed;
+  {
+    Mutex::Lock lock( s_paused_mutex );
+    for ( auto it = s_paused.begin(); it != s_paused.end(); ) {
+      if ( it->server->m_isStop || it->server->checkOverload( true ) == NOT_OVERLOADED ) {
+        resumed.push_back( std::move( *it ) );
+        it = s_paused.erase( it );
+      } else {
+        ++it;
+      }
+    }
+    s_paused_count = s_paused.size();
+  }
+  // 协程可能尚未完成切出，调度器会跳过仍处于 EXEC 状态的协程直到其挂起
+  for ( PausedAccept& paused : resumed ) {
+    paused.iom->schedule( paused.fiber, paused.thread );
+  }
+}
+
+std::size_t TcpServer::GetGlobalConnectionCount()
+{
+  return s_global_connections;
+}
+
+std::ostream& TcpServer::dumpConnections( std::ostream& os ) const
+{
+  os << "[TcpServer name=" << m_name << " connections=" << m_connections << " max=" << m_maxConnections
+     << " global_connections=" << s_global_connections << " global_max=" << s_global_max_connections
+     << " policy=" << ( m_overloadPolicy == PAUSE ? "pause" : "close" ) << " pauses=" << m_pauses
+     << " rejected_server_limit=" << m_rejected[SERVER_LIMIT]
+     << " rejected_global_limit=" << m_rejected[GLOBAL_LIMIT] << "]";
+  return os;
+}
+
+// 每次唤醒把积压的连接取到 EAGAIN（至多 tcp_server.accept_batch 个），再一次性交给工作线程；
+// 工作线程从共享队列取任务，空闲的线程先取到，相当于按负载分配
 void TcpServer::startAccept( Socket::SPtr sock )
 {
+  // 排空积压要求监听 socket 为非阻塞，等待改由 IOManager 的读事件完成
+  int flags = fcntl_f( sock->getSocket(), F_GETFL, 0 );
+  if ( flags != -1 && !( flags & O_NONBLOCK ) ) {
+    fcntl_f( sock->getSocket(), F_SETFL, flags | O_NONBLOCK );
+  }
+
+  IOManager* iom { IOManager::GetThis() };
+  const bool local { m_reusePortListeners > 0 && m_worker == iom };
+  // reuseport 分片的 accept 协程由 start 固定到本线程，之后每次挂起都以硬亲和调度回来，不会被其他线程窃取
+  const int thread { m_reusePortListeners > 0 ? sylar::GetThreadId() : -1 };
+  Fiber::SPtr fiber { Fiber::GetThis() };
+  std::vector<std::function<void()>> batch;
   while ( !m_isStop ) {
-    Socket::SPtr client = sock->accept();
-    if ( client ) {
-      client->setRecvTimeout( m_recvTimeout );
-      m_worker->schedule( std::bind( &TcpServer::handleClient, shared_from_this(), client ) );
-    } else {
-      SYLAR_LOG_ERROR( g_logger ) << "accept errno=" << errno << " errstr=" << strerror( errno );
+    const std::size_t limit { std::max<std::size_t>( g_tcp_server_accept_batch->getValue(), 1 ) };
+    bool drained { false };
+    Overload paused { NOT_OVERLOADED };
+    // 被立即关闭的连接也计入批次上限，防止连接洪水下 accept 协程长期不让出
+    for ( std::size_t i = 0; i < limit; ++i ) {
+      Overload overload { checkOverload( false ) };
+      if ( overload != NOT_OVERLOADED && m_overloadPolicy == PAUSE ) {
+        paused = overload;
+        break;
+      }
+      Socket::SPtr client { sock->tryAccept() };
+      if ( client ) {
+        if ( overload != NOT_OVERLOADED ) {
+          client->close();
+          ++m_rejected[overload];
+          continue;
+        }
+        client->setRecvTimeout( m_recvTimeout );
+        if ( m_socketProfile ) {
+          m_socketProfile->apply( *client, SocketProfile::ACCEPT );
+        }
+        trackConnection( client );
+        batch.push_back( std::bind( &TcpServer::handleClient, shared_from_this(), client ) );
+        continue;
+      }
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        drained = true;
+      } else if ( errno != EINTR && errno != ECONNABORTED && !m_isStop ) {
+        SYLAR_LOG_ERROR( g_logger ) << "accept errno=" << errno << " errstr=" << strerror( errno );
+      }
+      break;
+    }
+
+    if ( !batch.empty() ) {
+      if ( local ) {
+        // reuseport 分片：连接留在接受它的线程上处理
+        m_worker->schedulePrefer( batch.begin(), batch.end(), sylar::GetThreadId() );
+      } else {
+        m_worker->schedule( batch.begin(), batch.end() );
+      }
+      batch.clear();
+    }
+
+    if ( m_isStop ) {
+      break;
+    }
+    if ( paused != NOT_OVERLOADED ) {
+      pauseAccept( sock, paused, thread );
+      continue;
     }
+    if ( !drained ) {
+      // 批次已满或遇到 EMFILE 等错误，让出一次后继续
+      if ( thread == -1 ) {
+        Fiber::YieldToReady();
+      } else {
+        iom->schedule( fiber, thread );
+        Fiber::YieldToHold();
+      }
+      continue;
+    }
+    int rt = thread == -1 ? iom->addEvent( sock->getSocket(), IOManager::READ )
+                          : iom->addEvent( sock->getSocket(), IOManager::READ, [iom, fiber, thread]() {
+                              iom->schedule( fiber, thread );
+                            } );
+    if ( rt ) {
+      SYLAR_LOG_ERROR( g_logger ) << "accept addEvent fail, sock=" << sock->getSocket();
+      break;
+    }
+    Fiber::YieldToHold();
   }
 }
 
@@ -90,8 +367,33 @@ bool TcpServer::start()
     return true;
   }
   m_isStop = false;
-  for ( const Socket::SPtr& sock : m_socks ) {
-    m_acceptWorker->schedule( std::bind( &TcpServer::startAccept, shared_from_this(), sock ) );
+  if ( !m_reusePortListeners ) {
+    for ( const Socket::SPtr& sock : m_socks ) {
+      m_acceptWorker->schedule( std::bind( &TcpServer::startAccept, shared_from_this(), sock ) );
+    }
+    return true;
+  }
+
+  // 每个 reuseport 监听 socket 的 accept 协程固定到一个 accept 线程上
+  std::vector<int> threads { m_acceptWorker->getThreadIds() };
+  const bool incoming_cpu { g_tcp_server_incoming_cpu->getValue() };
+  auto self = shared_from_this();
+  for ( std::size_t i = 0; i < m_socks.size(); ++i ) {
+    Socket::SPtr sock { m_socks[i] };
+    int thread { threads.empty() ? -1 : threads[i % m_reusePortListeners % threads.size()] };
+    m_acceptWorker->schedule(
+      [self, sock, incoming_cpu]() {
+#ifdef SO_INCOMING_CPU
+        if ( incoming_cpu ) {
+          int cpu { sched_getcpu() };
+          if ( cpu >= 0 ) {
+            sock->setOption( SOL_SOCKET, SO_INCOMING_CPU, cpu );
+          }
+        }
+#endif
+        self->startAccept( sock );
+      },
+      thread );
   }
 
   return true;
@@ -100,6 +402,8 @@ bool TcpServer::start()
 void TcpServer::stop()
 {
   m_isStop = true;
+  // 唤醒因超限挂起的 accept 协程，使其退出
+  ResumePaused();
   auto self = shared_from_this();
   m_acceptWorker->schedule( [self, this]() {
     for ( const Socket::SPtr& sock : m_socks ) {
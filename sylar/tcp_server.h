@@ -4,7 +4,10 @@
 #include "sylar/iomanager.h"
 #include "sylar/noncopyable.h"
 #include "sylar/socket.h"
+#include "sylar/socket_profile.h"
+#include <atomic>
 #include <memory>
+#include <ostream>
 #include <vector>
 
 namespace sylar {
@@ -16,6 +19,23 @@ class TcpServer
 public:
   using SPtr = std::shared_ptr<TcpServer>;
 
+  // 连接数超限时的处理方式
+  enum OverloadPolicy
+  {
+    // 暂停 accept，监听 socket 移出 epoll，新连接留在内核积压队列中
+    PAUSE = 0,
+    // 继续 accept 并立即关闭
+    CLOSE = 1
+  };
+
+  // 超限原因，同时作为拒绝计数的下标
+  enum Overload
+  {
+    NOT_OVERLOADED = 0,
+    SERVER_LIMIT = 1,
+    GLOBAL_LIMIT = 2
+  };
+
   TcpServer( sylar::IOManager* worker = sylar::IOManager::GetThis(),
              sylar::IOManager* accept_worker = sylar::IOManager::GetThis() );
   virtual ~TcpServer();
@@ -25,6 +45,31 @@ public:
   virtual bool start();
   virtual void stop();
 
+  // 每个地址打开的 SO_REUSEPORT 监听 socket 数，0 表示只用一个普通监听 socket；需在 bind 之前设置
+  std::size_t getReusePortListeners() const { return m_reusePortListeners; }
+  void setReusePortListeners( std::size_t val ) { m_reusePortListeners = val; }
+
+  // 引用 socket.profiles 中的调优配置，bind 时解析并应用到监听 socket，accept 时应用到新连接
+  const std::string& getSocketProfile() const { return m_socketProfileName; }
+  void setSocketProfile( const std::string& name ) { m_socketProfileName = name; }
+
+  // 本服务器的最大连接数，0 表示不限制
+  std::size_t getMaxConnections() const { return m_maxConnections; }
+  void setMaxConnections( std::size_t val ) { m_maxConnections = val; }
+
+  OverloadPolicy getOverloadPolicy() const { return m_overloadPolicy; }
+  void setOverloadPolicy( OverloadPolicy val ) { m_overloadPolicy = val; }
+
+  // 当前存活的连接数，连接的 fd 关闭时减少
+  std::size_t getConnectionCount() const { return m_connections; }
+  // CLOSE 策略下因 reason 被立即关闭的连接数
+  uint64_t getRejectedCount( Overload reason ) const { return m_rejected[reason]; }
+  uint64_t getPauseCount() const { return m_pauses; }
+  std::ostream& dumpConnections( std::ostream& os ) const;
+
+  // 进程内所有 TcpServer 的连接总数
+  static std::size_t GetGlobalConnectionCount();
+
   uint64_t getRecvTimeout() const { return m_recvTimeout; }
   std::string getName() const { return m_name; }
   void setRecvTimeout( uint64_t val ) { m_recvTimeout = val; }
@@ -36,6 +81,15 @@ protected:
   virtual void handleClient( Socket::SPtr client );
   virtual void startAccept( Socket::SPtr sock );
 
+private:
+  // resume 为 true 时按低水位判断，用于决定暂停后能否恢复
+  Overload checkOverload( bool resume ) const;
+  // 计入连接数，client 的 fd 关闭时（close 或析构）扣减
+  void trackConnection( const Socket::SPtr& client );
+  // 挂起当前 accept 协程，直到连接数回落到低水位以下或服务器停止；thread 不为 -1 时恢复到该线程
+  void pauseAccept( Socket::SPtr sock, Overload reason, int thread );
+  static void ResumePaused();
+
 protected:
   std::vector<Socket::SPtr> m_socks;
   IOManager* m_worker;
@@ -44,6 +98,14 @@ protected:
   std::string m_name;
   bool m_isStop;
   std::string m_type;
+  std::size_t m_reusePortListeners;
+  std::string m_socketProfileName;
+  SocketProfile::SPtr m_socketProfile;
+  std::size_t m_maxConnections;
+  OverloadPolicy m_overloadPolicy;
+  std::atomic<std::size_t> m_connections { 0 };
+  std::atomic<uint64_t> m_rejected[3] {};
+  std::atomic<uint64_t> m_pauses { 0 };
 };
 
 }
\ No newline at end of file
@@ -1,11 +1,16 @@
 #include "thread.h"
 #include "log.h"
 #include "util.h"
+#include <cerrno>
+#include <cstring>
 #include <functional>
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <stdexcept>
 #include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 namespace sylar {
 static thread_local Thread* t_thread { nullptr };
@@ -57,6 +62,54 @@ void Thread::SetName( const std::string& name )
   t_thread_name = name;
 }
 
+static bool SetThreadAffinity( pthread_t thread, const std::vector<int>& cpus )
+{
+  cpu_set_t cpuset;
+  CPU_ZERO( &cpuset );
+  for ( int cpu : cpus ) {
+    if ( cpu >= 0 && cpu < CPU_SETSIZE ) {
+      CPU_SET( cpu, &cpuset );
+    }
+  }
+  if ( CPU_COUNT( &cpuset ) == 0 ) {
+    return false;
+  }
+
+  int ret = pthread_setaffinity_np( thread, sizeof( cpuset ), &cpuset );
+  if ( ret ) {
+    SYLAR_LOG_ERROR( g_logger ) << "pthread_setaffinity_np failed, ret = " << ret << " errstr=" << strerror( ret );
+    return false;
+  }
+  return true;
+}
+
+bool Thread::SetAffinity( const std::vector<int>& cpus )
+{
+  return SetThreadAffinity( pthread_self(), cpus );
+}
+
+bool Thread::BindNumaNode( int node )
+{
+  static constexpr int MPOL_PREFERRED_MODE { 1 };
+  static constexpr int MAX_NODES { 64 };
+  if ( node < 0 || node >= MAX_NODES ) {
+    return false;
+  }
+
+  unsigned long nodemask { 1ul << node };
+  if ( syscall( SYS_set_mempolicy, MPOL_PREFERRED_MODE, &nodemask, MAX_NODES + 1 ) ) {
+    SYLAR_LOG_ERROR( g_logger ) << "set_mempolicy node = " << node << " errno=" << errno
+                                << " errstr=" << strerror( errno );
+    return false;
+  }
+  return true;
+}
+
+bool Thread::setAffinity( const std::vector<int>& cpus )
+{
+  return m_thread && SetThreadAffinity( m_thread, cpus );
+}
+
 Thread::Thread( std::function<void()> cb, const std::string& name ) : m_cb( cb ), m_name( name )
 {
   if ( name.empty() ) {
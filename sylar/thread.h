@@ -6,6 +6,7 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <string>
+#include <vector>
 
 namespace sylar {
 
@@ -37,7 +38,7 @@ public:
     m_locked = true;
   }
 
-  ~ScopedLockImpl() { m_mutex.unlock(); }
+  ~ScopedLockImpl() { unlock(); }
 
   void lock()
   {
@@ -70,7 +71,7 @@ public:
     m_locked = true;
   }
 
-  ~ReadScopedLockImpl() { m_mutex.unlock(); }
+  ~ReadScopedLockImpl() { unlock(); }
 
   void lock()
   {
@@ -103,7 +104,7 @@ public:
     m_locked = true;
   }
 
-  ~WriteScopedLockImpl() { m_mutex.unlock(); }
+  ~WriteScopedLockImpl() { unlock(); }
 
   void lock()
   {
@@ -234,11 +235,16 @@ public:
   const std::string& getName() const { return m_name; }
 
   void join();
+  bool setAffinity( const std::vector<int>& cpus );
 
   static Thread* GetThis();
   static const std::string& GetName();
   static void SetName( const std::string& name );
 
+  // 作用于调用线程
+  static bool SetAffinity( const std::vector<int>& cpus );
+  static bool BindNumaNode( int node );
+
 private:
   Thread( const Thread& ) = delete;
   Thread( Thread&& ) = delete;
@@ -0,0 +1,365 @@
+#include "sylar/udp_server.h"
+#include "sylar/config.h"
+#include "sylar/fiber.h"
+#include "sylar/hook.h"
+#include "sylar/hugepage.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+#include <vector>
+
+namespace sylar {
+
+static sylar::ConfigVar<uint32_t>::SPtr g_udp_server_reuseport_sockets = sylar::Config::Lookup(
+  "udp_server.reuseport_sockets", (uint32_t)0, "SO_REUSEPORT sockets per address, 0 for a single socket" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_udp_server_batch
+  = sylar::Config::Lookup( "udp_server.batch", (uint32_t)64, "max datagrams per recvmmsg" );
+
+static sylar::ConfigVar<uint32_t>::SPtr g_udp_server_buffer_size = sylar::Config::Lookup(
+  "udp_server.buffer_size", (uint32_t)2048, "receive buffer per datagram, longer datagrams are truncated" );
+
+static sylar::ConfigVar<bool>::SPtr g_udp_server_gro = sylar::Config::Lookup(
+  "udp_server.gro", false, "enable UDP_GRO so the kernel coalesces datagrams of a flow into one buffer" );
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_NAME( "system" );
+
+// sendmmsg 每次调用的最大数据报数，控制数组放在协程栈上
+static constexpr std::size_t s_send_chunk { 64 };
+// recvmmsg 遇到非 ICMP 错误后的重试间隔
+static constexpr uint64_t s_recv_error_backoff_ms { 100 };
+
+namespace {
+
+// 接收协程复用的缓冲区：所有数据报缓冲区一次性从大页分配器取得，每批只重置长度字段
+struct RecvBuffers
+{
+  RecvBuffers( std::size_t batch, std::size_t buffer_size )
+    : batchSize { batch }
+    , bufferSize { buffer_size }
+    , data { static_cast<char*>( HugePageAllocator::Alloc( batch * buffer_size ) ) }
+    , msgs( batch )
+    , iovs( batch )
+    , packets( batch )
+    , controls( batch * CMSG_SPACE( sizeof( int ) ) )
+  {
+    for ( std::size_t i = 0; i < batch; ++i ) {
+      packets[i].data = data + i * buffer_size;
+      iovs[i].iov_base = packets[i].data;
+      iovs[i].iov_len = buffer_size;
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &packets[i].addr;
+    }
+  }
+
+  ~RecvBuffers() { HugePageAllocator::Dealloc( data, batchSize * bufferSize ); }
+
+  void reset( std::size_t count )
+  {
+    for ( std::size_t i = 0; i < count; ++i ) {
+      msgs[i].msg_hdr.msg_namelen = sizeof( sockaddr_storage );
+      msgs[i].msg_hdr.msg_control = &controls[i * CMSG_SPACE( sizeof( int ) )];
+      msgs[i].msg_hdr.msg_controllen = CMSG_SPACE( sizeof( int ) );
+      msgs[i].msg_hdr.msg_flags = 0;
+    }
+  }
+
+  std::size_t batchSize;
+  std::size_t bufferSize;
+  char* data;
+  std::vector<mmsghdr> msgs;
+  std::vector<iovec> iovs;
+  std::vector<UdpServer::Packet> packets;
+  std::vector<char> controls;
+};
+
+} // namespace
+
+// 对端回送的 ICMP 错误，每个只由一次 recvmmsg 报告
+static bool IsIcmpError( int err )
+{
+  switch ( err ) {
+    case ECONNREFUSED:
+    case EHOSTUNREACH:
+    case ENETUNREACH:
+    case EHOSTDOWN:
+    case ENETDOWN:
+    case EPROTO:
+    case EMSGSIZE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// GRO 合并的数据报在控制消息中带有段长
+static uint16_t GroSegmentSize( msghdr& hdr )
+{
+#ifdef UDP_GRO
+  for ( cmsghdr* cm = CMSG_FIRSTHDR( &hdr ); cm; cm = CMSG_NXTHDR( &hdr, cm ) ) {
+    if ( cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO ) {
+      int size { 0 };
+      std::memcpy( &size, CMSG_DATA( cm ), sizeof( size ) );
+      return static_cast<uint16_t>( size );
+    }
+  }
+#endif
+  return 0;
+}
+
+UdpServer::UdpServer( sylar::IOManager* worker )
+  : m_worker { worker }
+  , m_name { "sylar/1.0.0" }
+  , m_isStop { true }
+  , m_reusePortSockets { g_udp_server_reuseport_sockets->getValue() }
+{}
+
+UdpServer::~UdpServer()
+{
+  for ( auto& sock : m_socks ) {
+    sock->close();
+  }
+
+  m_socks.clear();
+}
+
+bool UdpServer::bind( sylar::Address::SPtr addr )
+{
+  std::vector<Address::SPtr> addrs;
+  std::vector<Address::SPtr> fails;
+  addrs.push_back( addr );
+  return bind( addrs, fails );
+}
+
+bool UdpServer::bind( const std::vector<Address::SPtr>& addrs, std::vector<Address::SPtr>& fails )
+{
+  const std::size_t sockets { std::max<std::size_t>( m_reusePortSockets, 1 ) };
+  const bool gro { g_udp_server_gro->getValue() };
+  for ( const Address::SPtr& addr : addrs ) {
+    for ( std::size_t i = 0; i < sockets; ++i ) {
+      Socket::SPtr sock { Socket::CreateUDP( addr ) };
+      if ( m_reusePortSockets && !sock->setReusePort( true ) ) {
+        SYLAR_LOG_ERROR( g_logger ) << "set SO_REUSEPORT fail errno=" << errno << " errstr=" << strerror( errno )
+                                    << " addr=[" << addr->toString() << "]";
+        fails.push_back( addr );
+        break;
+      }
+
+      if ( !sock->bind( addr ) ) {
+        SYLAR_LOG_ERROR( g_logger ) << "bind fail errno=" << errno << " errstr=" << strerror( errno ) << " addr=["
+                                    << addr->toString() << "]";
+        fails.push_back( addr );
+        break;
+      }
+
+#ifdef UDP_GRO
+      if ( gro ) {
+        // 不支持时只记录错误，按普通数据报接收
+        sock->setOption( SOL_UDP, UDP_GRO, 1 );
+      }
+#endif
+      m_socks.push_back( sock );
+    }
+  }
+
+  if ( !fails.empty() ) {
+    m_socks.clear();
+    return false;
+  }
+
+  for ( Socket::SPtr& sock : m_socks ) {
+    SYLAR_LOG_INFO( g_logger ) << "udp server bind success: " << *sock;
+  }
+  return true;
+}
+
+// 一次 recvmmsg 取到 EAGAIN 前的所有数据报（至多 udp_server.batch 个），在本协程内交给 handleBatch，
+// 缓冲区在批次之间复用，不为每个数据报分配内存
+void UdpServer::startRecv( Socket::SPtr sock )
+{
+  int flags = fcntl_f( sock->getSocket(), F_GETFL, 0 );
+  if ( flags != -1 && !( flags & O_NONBLOCK ) ) {
+    fcntl_f( sock->getSocket(), F_SETFL, flags | O_NONBLOCK );
+  }
+
+  std::size_t buffer_size { std::max<std::size_t>( g_udp_server_buffer_size->getValue(), 1 ) };
+  if ( g_udp_server_gro->getValue() ) {
+    // GRO 合并后的数据报最长 64KiB
+    buffer_size = std::max<std::size_t>( buffer_size, 65535 );
+  }
+  RecvBuffers buffers { std::max<std::size_t>( g_udp_server_batch->getValue(), 1 ), buffer_size };
+  IOManager* iom { IOManager::GetThis() };
+  // reuseport 分片的接收协程由 start 固定到本线程，之后每次挂起都以硬亲和调度回来，不会被其他线程窃取
+  const int thread { m_reusePortSockets > 0 ? sylar::GetThreadId() : -1 };
+  Fiber::SPtr fiber { Fiber::GetThis() };
+  std::function<void()> resume { [iom, fiber, thread]() { iom->schedule( fiber, thread ); } };
+  while ( !m_isStop ) {
+    buffers.reset( buffers.batchSize );
+    int n = recvmmsg( sock->getSocket(), buffers.msgs.data(), buffers.batchSize, MSG_DONTWAIT, nullptr );
+    if ( n > 0 ) {
+      for ( int i = 0; i < n; ++i ) {
+        Packet& packet { buffers.packets[i] };
+        packet.addrLen = buffers.msgs[i].msg_hdr.msg_namelen;
+        packet.length = buffers.msgs[i].msg_len;
+        packet.segmentSize = GroSegmentSize( buffers.msgs[i].msg_hdr );
+      }
+      m_recvPackets += n;
+      ++m_recvBatches;
+      handleBatch( sock, buffers.packets.data(), n );
+      if ( (std::size_t)n == buffers.batchSize ) {
+        // 批次已满，让出一次避免独占线程
+        if ( thread == -1 ) {
+          Fiber::YieldToReady();
+        } else {
+          resume();
+          Fiber::YieldToHold();
+        }
+      }
+      continue;
+    }
+
+    if ( errno == EINTR ) {
+      continue;
+    }
+    if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+      if ( m_isStop ) {
+        break;
+      }
+      if ( IsIcmpError( errno ) ) {
+        // ICMP 不可达等错误只报告一次，记录后继续
+        SYLAR_LOG_DEBUG( g_logger ) << "recvmmsg errno=" << errno << " errstr=" << strerror( errno )
+                                    << " sock=" << sock->getSocket();
+        continue;
+      }
+      SYLAR_LOG_ERROR( g_logger ) << "recvmmsg errno=" << errno << " errstr=" << strerror( errno )
+                                  << " sock=" << sock->getSocket();
+      if ( errno == EBADF || errno == ENOTSOCK || errno == EINVAL || errno == EFAULT ) {
+        break;
+      }
+      // ENOMEM 等可能恢复的错误，退避一段时间再重试，不空转
+      iom->addTimer( s_recv_error_backoff_ms, resume );
+      Fiber::YieldToHold();
+      continue;
+    }
+    int rt = thread == -1 ? iom->addEvent( sock->getSocket(), IOManager::READ )
+                          : iom->addEvent( sock->getSocket(), IOManager::READ, resume );
+    if ( rt ) {
+      SYLAR_LOG_ERROR( g_logger ) << "udp recv addEvent fail, sock=" << sock->getSocket();
+      break;
+    }
+    Fiber::YieldToHold();
+  }
+}
+
+int UdpServer::sendBatch( Socket::SPtr sock, const Packet* packets, std::size_t count )
+{
+  mmsghdr msgs[s_send_chunk];
+  iovec iovs[s_send_chunk];
+  char controls[s_send_chunk][CMSG_SPACE( sizeof( uint16_t ) )];
+  IOManager* iom { IOManager::GetThis() };
+  std::size_t sent { 0 };
+  while ( sent < count ) {
+    const std::size_t chunk { std::min( count - sent, s_send_chunk ) };
+    std::memset( msgs, 0, sizeof( mmsghdr ) * chunk );
+    for ( std::size_t i = 0; i < chunk; ++i ) {
+      const Packet& packet { packets[sent + i] };
+      iovs[i].iov_base = packet.data;
+      iovs[i].iov_len = packet.length;
+      msghdr& hdr { msgs[i].msg_hdr };
+      hdr.msg_name = const_cast<sockaddr_storage*>( &packet.addr );
+      hdr.msg_namelen = packet.addrLen;
+      hdr.msg_iov = &iovs[i];
+      hdr.msg_iovlen = 1;
+#ifdef UDP_SEGMENT
+      if ( packet.segmentSize ) {
+        hdr.msg_control = controls[i];
+        hdr.msg_controllen = sizeof( controls[i] );
+        cmsghdr* cm { CMSG_FIRSTHDR( &hdr ) };
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+        std::memcpy( CMSG_DATA( cm ), &packet.segmentSize, sizeof( uint16_t ) );
+      }
+#endif
+    }
+
+    int n = sendmmsg( sock->getSocket(), msgs, chunk, MSG_DONTWAIT );
+    if ( n > 0 ) {
+      sent += n;
+      continue;
+    }
+    if ( errno == EINTR ) {
+      continue;
+    }
+    if ( ( errno == EAGAIN || errno == EWOULDBLOCK ) && iom && !m_isStop ) {
+      if ( iom->addEvent( sock->getSocket(), IOManager::WRITE ) ) {
+        break;
+      }
+      Fiber::YieldToHold();
+      continue;
+    }
+    SYLAR_LOG_DEBUG( g_logger ) << "sendmmsg errno=" << errno << " errstr=" << strerror( errno )
+                                << " sock=" << sock->getSocket();
+    break;
+  }
+
+  m_sendPackets += sent;
+  return sent ? (int)sent : -1;
+}
+
+bool UdpServer::start()
+{
+  if ( !m_isStop ) {
+    return true;
+  }
+  m_isStop = false;
+  if ( !m_reusePortSockets ) {
+    for ( const Socket::SPtr& sock : m_socks ) {
+      m_worker->schedule( std::bind( &UdpServer::startRecv, shared_from_this(), sock ) );
+    }
+    return true;
+  }
+
+  // 每个 reuseport socket 的接收协程固定到一个线程上
+  std::vector<int> threads { m_worker->getThreadIds() };
+  for ( std::size_t i = 0; i < m_socks.size(); ++i ) {
+    int thread { threads.empty() ? -1 : threads[i % m_reusePortSockets % threads.size()] };
+    m_worker->schedule( std::bind( &UdpServer::startRecv, shared_from_this(), m_socks[i] ), thread );
+  }
+  return true;
+}
+
+void UdpServer::stop()
+{
+  m_isStop = true;
+  auto self = shared_from_this();
+  m_worker->schedule( [self, this]() {
+    for ( const Socket::SPtr& sock : m_socks ) {
+      sock->cancelAll();
+      sock->close();
+    }
+    m_socks.clear();
+  } );
+}
+
+std::ostream& UdpServer::dump( std::ostream& os ) const
+{
+  os << "[UdpServer name=" << m_name << " sockets=" << m_socks.size() << " recv_packets=" << m_recvPackets
+     << " recv_batches=" << m_recvBatches << " send_packets=" << m_sendPackets << "]";
+  return os;
+}
+
+void UdpServer::handleBatch( Socket::SPtr sock, Packet* packets, std::size_t count )
+{
+  SYLAR_LOG_DEBUG( g_logger ) << "handleBatch: sock=" << sock->getSocket() << " packets=" << count;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "sylar/address.h"
+#include "sylar/iomanager.h"
+#include "sylar/noncopyable.h"
+#include "sylar/socket.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <sys/socket.h>
+#include <vector>
+
+namespace sylar {
+
+// UDP 服务器：每个 socket 一个接收协程，用 recvmmsg 一次收取一批数据报交给 handleBatch，
+// 开启 reuseport 时每个地址打开多个 socket 并固定到不同线程，由内核按四元组分摊
+class UdpServer
+  : public std::enable_shared_from_this<UdpServer>
+  , Noncopyable
+{
+public:
+  using SPtr = std::shared_ptr<UdpServer>;
+
+  struct Packet
+  {
+    // 接收时为来源地址，发送时为目的地址
+    sockaddr_storage addr;
+    socklen_t addrLen { 0 };
+    char* data { nullptr };
+    std::size_t length { 0 };
+    // GSO/GRO 分段长度：接收时为内核合并的段长，发送时非 0 则由内核按该长度切分，0 表示单个数据报
+    uint16_t segmentSize { 0 };
+  };
+
+  UdpServer( sylar::IOManager* worker = sylar::IOManager::GetThis() );
+  virtual ~UdpServer();
+
+  virtual bool bind( sylar::Address::SPtr addr );
+  virtual bool bind( const std::vector<Address::SPtr>& addrs, std::vector<Address::SPtr>& fails );
+  virtual bool start();
+  virtual void stop();
+
+  // 用 sendmmsg 批量发送，socket 缓冲区满时挂起当前协程等待可写；返回发出的数据报数，出错且一个未发出时返回 -1
+  int sendBatch( Socket::SPtr sock, const Packet* packets, std::size_t count );
+
+  // 每个地址打开的 SO_REUSEPORT socket 数，0 表示只用一个普通 socket；需在 bind 之前设置
+  std::size_t getReusePortSockets() const { return m_reusePortSockets; }
+  void setReusePortSockets( std::size_t val ) { m_reusePortSockets = val; }
+
+  const std::string& getName() const { return m_name; }
+  void setName( const std::string& val ) { m_name = val; }
+
+  bool isStop() const { return m_isStop; }
+
+  uint64_t getRecvPackets() const { return m_recvPackets; }
+  uint64_t getRecvBatches() const { return m_recvBatches; }
+  uint64_t getSendPackets() const { return m_sendPackets; }
+  std::ostream& dump( std::ostream& os ) const;
+
+protected:
+  // 在接收协程中调用，packets 指向该协程复用的缓冲区，返回后即被下一批覆盖，需要保留的数据应自行拷贝
+  virtual void handleBatch( Socket::SPtr sock, Packet* packets, std::size_t count );
+  virtual void startRecv( Socket::SPtr sock );
+
+protected:
+  std::vector<Socket::SPtr> m_socks;
+  IOManager* m_worker;
+  std::string m_name;
+  bool m_isStop;
+  std::size_t m_reusePortSockets;
+  std::atomic<uint64_t> m_recvPackets { 0 };
+  std::atomic<uint64_t> m_recvBatches { 0 };
+  std::atomic<uint64_t> m_sendPackets { 0 };
+};
+
+}
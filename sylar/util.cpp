@@ -1,8 +1,12 @@
 #include "util.h"
 #include "sylar/fiber.h"
 #include "sylar/log.h"
+#include <cstdio>
 #include <ctime>
+#include <dirent.h>
 #include <execinfo.h>
+#include <fstream>
+#include <set>
 #include <sstream>
 #include <sys/syscall.h>
 #include <sys/time.h>
@@ -73,4 +77,94 @@ uint64_t GetElapsedMS()
   return ts.tv_sec * 1000 + ts.tv_nsec / 1000'000;
 }
 
+int GetCpuCount()
+{
+  long count = sysconf( _SC_NPROCESSORS_ONLN );
+  return count > 0 ? count : 1;
+}
+
+std::vector<int> ParseCpuList( const std::string& str )
+{
+  std::vector<int> cpus;
+  std::stringstream ss { str };
+  std::string item;
+  while ( std::getline( ss, item, ',' ) ) {
+    if ( item.empty() ) {
+      continue;
+    }
+    std::size_t pos = item.find( '-' );
+    try {
+      if ( pos == std::string::npos ) {
+        cpus.push_back( std::stoi( item ) );
+      } else {
+        int begin = std::stoi( item.substr( 0, pos ) );
+        int end = std::stoi( item.substr( pos + 1 ) );
+        for ( int i = begin; i <= end; ++i ) {
+          cpus.push_back( i );
+        }
+      }
+    } catch ( ... ) {
+      SYLAR_LOG_ERROR( g_logger ) << "invalid cpu list: " << str;
+    }
+  }
+  return cpus;
+}
+
+static int ReadCpuTopology( int cpu, const char* name )
+{
+  std::ifstream ifs { "/sys/devices/system/cpu/cpu" + std::to_string( cpu ) + "/topology/" + name };
+  int value { -1 };
+  if ( !( ifs >> value ) ) {
+    return -1;
+  }
+  return value;
+}
+
+std::vector<int> GetPhysicalCoreCpus()
+{
+  std::vector<int> cpus;
+  std::set<std::pair<int, int>> cores;
+  int count = GetCpuCount();
+  for ( int cpu = 0; cpu < count; ++cpu ) {
+    int package = ReadCpuTopology( cpu, "physical_package_id" );
+    int core = ReadCpuTopology( cpu, "core_id" );
+    if ( core == -1 || cores.insert( { package, core } ).second ) {
+      cpus.push_back( cpu );
+    }
+  }
+  return cpus;
+}
+
+int GetNumaNodeOfCpu( int cpu )
+{
+  DIR* dir = opendir( "/sys/devices/system/node" );
+  if ( !dir ) {
+    return -1;
+  }
+
+  int result { -1 };
+  while ( dirent* ent = readdir( dir ) ) {
+    int node { -1 };
+    if ( std::sscanf( ent->d_name, "node%d", &node ) != 1 ) {
+      continue;
+    }
+    std::ifstream ifs { std::string( "/sys/devices/system/node/" ) + ent->d_name + "/cpulist" };
+    std::string list;
+    if ( !std::getline( ifs, list ) ) {
+      continue;
+    }
+    for ( int i : ParseCpuList( list ) ) {
+      if ( i == cpu ) {
+        result = node;
+        break;
+      }
+    }
+    if ( result != -1 ) {
+      break;
+    }
+  }
+  closedir( dir );
+  return result;
+}
+
 } // namespace sylar
\ No newline at end of file
@@ -25,4 +25,10 @@ const char* TypeToName()
 
 uint64_t GetElapsedMS();
 
+int GetCpuCount();
+// 每个物理核只返回一个逻辑 CPU
+std::vector<int> GetPhysicalCoreCpus();
+int GetNumaNodeOfCpu( int cpu );
+std::vector<int> ParseCpuList( const std::string& str );
+
 } // namespace sylar
\ No newline at end of file
@@ -0,0 +1,137 @@
+#include "sylar/buffered_stream.h"
+#include "sylar/bytearray.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+// 内存中的流：每次 read 至多返回 chunk 字节，记录下层调用次数
+class MemoryStream : public sylar::Stream
+{
+public:
+  MemoryStream( const std::string& input, size_t chunk ) : m_input { input }, m_chunk { chunk } {}
+
+  int read( void* buffer, size_t length ) override
+  {
+    ++reads;
+    size_t len { std::min( { length, m_chunk, m_input.size() - m_pos } ) };
+    std::memcpy( buffer, m_input.data() + m_pos, len );
+    m_pos += len;
+    return len;
+  }
+
+  int read( sylar::ByteArray::SPtr ba, size_t length ) override
+  {
+    std::string buf( length, '\0' );
+    int ret = read( &buf[0], length );
+    ba->write( buf.data(), ret );
+    return ret;
+  }
+
+  int write( const void* buffer, size_t length ) override
+  {
+    ++writes;
+    output.append( (const char*)buffer, length );
+    return length;
+  }
+
+  int write( sylar::ByteArray::SPtr ba, size_t length ) override
+  {
+    std::string buf( length, '\0' );
+    ba->read( &buf[0], length );
+    return write( buf.data(), length );
+  }
+
+  int writev( const iovec* iov, size_t count ) override
+  {
+    ++writevs;
+    int total { 0 };
+    for ( size_t i = 0; i < count; ++i ) {
+      output.append( (const char*)iov[i].iov_base, iov[i].iov_len );
+      total += iov[i].iov_len;
+    }
+    return total;
+  }
+
+  void close() override {}
+
+  int reads { 0 };
+  int writes { 0 };
+  int writevs { 0 };
+  std::string output;
+
+private:
+  std::string m_input;
+  size_t m_chunk;
+  size_t m_pos { 0 };
+};
+
+// 多行输入一次预读后逐行取出，分隔符跨两次下层读取时也能找到
+void test_read()
+{
+  std::shared_ptr<MemoryStream> mem { std::make_shared<MemoryStream>(
+    "GET / HTTP/1.1\r\nHost: a\r\n\r\nlen:5|hello|tail", 1024 ) };
+  sylar::BufferedStream stream { mem, 64 };
+
+  std::string line;
+  SYLAR_ASSERT( stream.readLine( line ) > 0 && line == "GET / HTTP/1.1" );
+  SYLAR_ASSERT( stream.readLine( line ) > 0 && line == "Host: a" );
+  SYLAR_ASSERT( stream.readLine( line ) > 0 && line.empty() );
+  char buf[8];
+  SYLAR_ASSERT( stream.peek( buf, 4 ) == 4 && std::memcmp( buf, "len:", 4 ) == 0 );
+  SYLAR_ASSERT( stream.readUntil( line, "|" ) > 0 && line == "len:5|" );
+  SYLAR_ASSERT( stream.readFixSize( buf, 5 ) == 5 && std::memcmp( buf, "hello", 5 ) == 0 );
+  SYLAR_ASSERT( stream.readUntil( line, "|" ) > 0 && line == "|" );
+  // 找不到分隔符：EOF 时不完整的数据仍可用 read 取出
+  SYLAR_ASSERT( stream.readUntil( line, "\n" ) == 0 );
+  SYLAR_ASSERT( stream.read( buf, sizeof( buf ) ) == 4 && std::memcmp( buf, "tail", 4 ) == 0 );
+  SYLAR_LOG_INFO( g_logger ) << "buffered read: lower reads=" << mem->reads;
+  SYLAR_ASSERT( mem->reads == 2 );
+
+  std::shared_ptr<MemoryStream> slow { std::make_shared<MemoryStream>( "abc\r\n\r\nxyz", 3 ) };
+  sylar::BufferedStream slow_stream { slow, 4 };
+  SYLAR_ASSERT( slow_stream.readUntil( line, "\r\n\r\n" ) == 7 && line == "abc\r\n\r\n" );
+
+  std::shared_ptr<MemoryStream> big { std::make_shared<MemoryStream>( std::string( 100, 'x' ), 1024 ) };
+  sylar::BufferedStream big_stream { big, 16 };
+  SYLAR_ASSERT( big_stream.readUntil( line, "\n", 50 ) == -1 && errno == EMSGSIZE );
+}
+
+// 小块写入合并为一次 writev，超过缓冲区的写入与已缓冲数据一起写出
+void test_write()
+{
+  std::shared_ptr<MemoryStream> mem { std::make_shared<MemoryStream>( "", 1024 ) };
+  sylar::BufferedStream stream { mem, 64, 32 };
+
+  std::string expect;
+  for ( int i = 0; i < 5; ++i ) {
+    std::string field { "f" + std::to_string( i ) + ";" };
+    SYLAR_ASSERT( stream.write( field.data(), field.size() ) == (int)field.size() );
+    expect += field;
+  }
+  SYLAR_ASSERT( mem->writevs == 0 && stream.getWriteBuffered() == expect.size() );
+  std::string body( 100, 'b' );
+  SYLAR_ASSERT( stream.write( body.data(), body.size() ) == (int)body.size() );
+  expect += body;
+  SYLAR_ASSERT( mem->writevs == 1 && mem->output == expect );
+
+  stream.write( "end", 3 );
+  char buf[4];
+  // 读之前先 flush 写缓冲区
+  SYLAR_ASSERT( stream.read( buf, sizeof( buf ) ) == 0 );
+  SYLAR_LOG_INFO( g_logger ) << "buffered write: lower writevs=" << mem->writevs << " writes=" << mem->writes;
+  SYLAR_ASSERT( mem->writevs == 2 && mem->writes == 0 && mem->output == expect + "end" );
+}
+
+int main()
+{
+  test_read();
+  test_write();
+  return 0;
+}
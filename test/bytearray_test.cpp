@@ -1,8 +1,14 @@
 #include "sylar/bytearray.h"
+#include "sylar/chunk_pool.h"
+#include "sylar/config.h"
+#include "sylar/hugepage.h"
 #include "sylar/log.h"
 #include "sylar/macro.h"
 #include <cassert>
+#include <map>
 #include <memory>
+#include <sstream>
+#include <string>
 #include <vector>
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
@@ -88,8 +94,74 @@ void test()
 #undef XX
 }
 
+// 反复创建、增长、clear 同样大小的 ByteArray，预热后所有节点都应从池中取得
+void test_pool()
+{
+  sylar::ByteArray::SPtr small { std::make_shared<sylar::ByteArray>( 4 ) };
+  small->writeStringWithoutLength( "bytearray;" );
+  small->setPosition( 0 );
+  SYLAR_ASSERT( small->toString() == "bytearray;" );
+
+  std::string data( 64 * 1024, 'p' );
+  auto run = [&data]() {
+    sylar::ByteArray::SPtr ba( std::make_shared<sylar::ByteArray>( 4096 ) );
+    ba->write( data.c_str(), data.size() );
+    ba->clear();
+    ba->write( data.c_str(), data.size() );
+    ba->setPosition( 0 );
+    SYLAR_ASSERT( ba->toString() == data );
+  };
+  auto misses = []() {
+    uint64_t total { 0 };
+    for ( auto& s : sylar::ChunkPool::GetStats() ) {
+      total += s.misses;
+    }
+    return total;
+  };
+
+  run();
+  uint64_t warm { misses() };
+  for ( int i = 0; i < 100; ++i ) {
+    run();
+  }
+  std::ostringstream ss;
+  sylar::ChunkPool::Dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+  SYLAR_ASSERT( misses() == warm );
+}
+
+// 切到透明大页模式后重跑读写，再切回 off 释放大页上的节点
+void test_hugepage()
+{
+  // 池中保留的块不计为释放，关闭池化后再统计大页占用
+  sylar::Config::Lookup<std::map<std::string, uint32_t>>( "bytearray.pool.sizes" )->setValue( {} );
+  sylar::ChunkPool::Register( sizeof( sylar::ByteArray::Node ), 0 );
+  auto mode = sylar::Config::Lookup<std::string>( "hugepage.mode" );
+  mode->setValue( "thp" );
+  test();
+
+  std::vector<sylar::ByteArray::SPtr> arrays;
+  for ( int i = 0; i < 64; ++i ) {
+    sylar::ByteArray::SPtr ba( std::make_shared<sylar::ByteArray>( 4096 ) );
+    std::string data( 64 * 1024, 'a' + i % 26 );
+    ba->write( data.c_str(), data.size() );
+    ba->setPosition( 0 );
+    SYLAR_ASSERT( ba->toString() == data );
+    arrays.push_back( ba );
+  }
+  mode->setValue( "off" );
+  arrays.clear();
+
+  std::ostringstream ss;
+  sylar::HugePageAllocator::Dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+  SYLAR_ASSERT( sylar::HugePageAllocator::GetStats().bytesInUse == 0 );
+}
+
 int main()
 {
   test();
+  test_pool();
+  test_hugepage();
   return 0;
 }
@@ -0,0 +1,129 @@
+#include "sylar/fd_manager.h"
+#include "sylar/hook.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include <atomic>
+#include <cassert>
+#include <fcntl.h>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+// 非 socket 和 socket 的查找、自动创建与越界 fd
+void test_lookup()
+{
+  sylar::FdManager& mgr { sylar::FdMgr::GetInstance() };
+  int fds[2];
+  SYLAR_ASSERT( pipe( fds ) == 0 );
+  SYLAR_ASSERT( !mgr.get( fds[0] ) );
+  sylar::FdCtx* pipe_ctx { mgr.get( fds[0], true ) };
+  SYLAR_ASSERT( pipe_ctx && pipe_ctx->isInit() && !pipe_ctx->isSocket() && !pipe_ctx->getSysNonblock() );
+  SYLAR_ASSERT( mgr.get( fds[0] ) == pipe_ctx );
+
+  int sock { socket( AF_INET, SOCK_STREAM, 0 ) };
+  sylar::FdCtx* sock_ctx { mgr.get( sock, true ) };
+  SYLAR_ASSERT( sock_ctx && sock_ctx->isInit() && sock_ctx->isSocket() && sock_ctx->getSysNonblock() );
+  // hook 后的 fcntl 对用户隐藏 O_NONBLOCK，这里看系统真实状态
+  SYLAR_ASSERT( fcntl_f( sock, F_GETFL, 0 ) & O_NONBLOCK );
+  SYLAR_ASSERT( sock_ctx->getTimeout( SO_RCVTIMEO ) == (uint64_t)-1 );
+
+  SYLAR_ASSERT( !mgr.get( -1, true ) );
+  SYLAR_ASSERT( !mgr.get( (int)sylar::FdTable<sylar::FdCtx>::MAX_FDS, true ) );
+
+  for ( int fd : { fds[0], fds[1], sock } ) {
+    mgr.del( fd );
+    close( fd );
+  }
+}
+
+// 同号 fd 复用：沿用同一个上下文，但状态按新 fd 重新初始化
+void test_reuse()
+{
+  sylar::FdManager& mgr { sylar::FdMgr::GetInstance() };
+  int fds[2];
+  SYLAR_ASSERT( pipe( fds ) == 0 );
+  int fd { fds[0] };
+  sylar::FdCtx* ctx { mgr.get( fd, true ) };
+  ctx->setUserNonblock( true );
+  ctx->setTimeout( SO_RCVTIMEO, 100 );
+  mgr.del( fd );
+  SYLAR_ASSERT( !mgr.get( fd ) );
+  close( fd );
+
+  // 最小可用 fd 号被新 socket 复用
+  int sock { socket( AF_INET, SOCK_STREAM, 0 ) };
+  SYLAR_ASSERT( sock == fd );
+  sylar::FdCtx* reused { mgr.get( sock, true ) };
+  SYLAR_ASSERT( reused == ctx );
+  SYLAR_ASSERT( reused->isSocket() && reused->getSysNonblock() && !reused->getUserNonblock() );
+  SYLAR_ASSERT( reused->getTimeout( SO_RCVTIMEO ) == (uint64_t)-1 );
+
+  // accept4 登记的 socket 覆盖仍处于激活状态的旧上下文
+  reused->setTimeout( SO_SNDTIMEO, 200 );
+  SYLAR_ASSERT( mgr.addSocket( sock, false ) == ctx );
+  SYLAR_ASSERT( ctx->isSocket() && !ctx->getSysNonblock() );
+  SYLAR_ASSERT( ctx->getTimeout( SO_SNDTIMEO ) == (uint64_t)-1 );
+
+  mgr.del( sock );
+  close( sock );
+  close( fds[1] );
+}
+
+// 一个线程反复关闭并重新登记同一个 fd，其他线程无锁查找：指针不变，且读到的状态总是完整的
+void test_concurrent()
+{
+  static const int s_readers { 4 };
+  static const int s_rounds { 100000 };
+  sylar::FdManager& mgr { sylar::FdMgr::GetInstance() };
+  int sock { socket( AF_INET, SOCK_STREAM, 0 ) };
+  sylar::FdCtx* ctx { mgr.addSocket( sock, true ) };
+  std::atomic<bool> stop { false };
+  std::atomic<uint64_t> hits { 0 };
+
+  std::vector<std::shared_ptr<sylar::Thread>> readers;
+  for ( int i = 0; i < s_readers; ++i ) {
+    readers.push_back( std::make_shared<sylar::Thread>(
+      [&]() {
+        while ( !stop ) {
+          sylar::FdCtx* cur { mgr.get( sock ) };
+          if ( !cur ) {
+            continue;
+          }
+          SYLAR_ASSERT( cur == ctx );
+          SYLAR_ASSERT( cur->isInit() && cur->isSocket() );
+          uint64_t timeout { cur->getTimeout( SO_RCVTIMEO ) };
+          SYLAR_ASSERT( timeout == (uint64_t)-1 || timeout == 100 );
+          ++hits;
+        }
+      },
+      "fd_reader_" + std::to_string( i ) ) );
+  }
+
+  for ( int i = 0; i < s_rounds; ++i ) {
+    mgr.del( sock );
+    SYLAR_ASSERT( mgr.addSocket( sock, i % 2 ) == ctx );
+    SYLAR_ASSERT( ctx->getSysNonblock() == (bool)( i % 2 ) );
+    ctx->setTimeout( SO_RCVTIMEO, 100 );
+  }
+  stop = true;
+  for ( auto& reader : readers ) {
+    reader->join();
+  }
+  SYLAR_LOG_INFO( g_logger ) << "concurrent rounds=" << s_rounds << " lookups=" << hits;
+  SYLAR_ASSERT( hits > 0 );
+
+  mgr.del( sock );
+  close( sock );
+}
+
+int main()
+{
+  test_lookup();
+  test_reuse();
+  test_concurrent();
+  return 0;
+}
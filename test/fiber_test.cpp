@@ -27,9 +27,95 @@ void test_fiber()
   SYLAR_LOG_INFO( g_logger ) << "main after end2";
 }
 
+// 协程切换微基准：调度器内反复 YieldToReady，并对比 GetThis 与 Current 的开销。
+// 先断言 Current 和切换路径不增减引用计数；计时期间调高 system 日志级别，数字中不含调度器日志的开销
+void test_switch_bench()
+{
+  static const int s_rounds { 1000000 };
+  sylar::Logger::SPtr system_log { SYLAR_LOG_NAME( "system" ) };
+  sylar::LogLevel::Level old_level { system_log->getLevel() };
+  sylar::Scheduler sc { 1, false, "bench" };
+  sc.start();
+  sc.schedule( [&]() {
+    sylar::Fiber::SPtr self { sylar::Fiber::GetThis() };
+    const long owners { self.use_count() };
+    {
+      sylar::Fiber::SPtr copy { sylar::Fiber::GetThis() };
+      SYLAR_ASSERT( self.use_count() == owners + 1 );
+    }
+    for ( int i = 0; i < 1000; ++i ) {
+      SYLAR_ASSERT( sylar::Fiber::Current() == self.get() && self.use_count() == owners );
+      sylar::Fiber::YieldToReady();
+      SYLAR_ASSERT( self.use_count() == owners );
+    }
+    self.reset();
+
+    system_log->setLevel( sylar::LogLevel::WARN );
+    std::uint64_t start_us { sylar::GetCurrentUS() };
+    for ( int i = 0; i < s_rounds; ++i ) {
+      sylar::Fiber::YieldToReady();
+    }
+    std::uint64_t switch_us { sylar::GetCurrentUS() - start_us };
+
+    start_us = sylar::GetCurrentUS();
+    std::uint64_t sum { 0 };
+    for ( int i = 0; i < s_rounds; ++i ) {
+      sum += sylar::Fiber::GetThis()->getId();
+    }
+    std::uint64_t get_this_us { sylar::GetCurrentUS() - start_us };
+
+    start_us = sylar::GetCurrentUS();
+    for ( int i = 0; i < s_rounds; ++i ) {
+      sum += sylar::Fiber::Current()->getId();
+    }
+    std::uint64_t current_us { sylar::GetCurrentUS() - start_us };
+    system_log->setLevel( old_level );
+
+    SYLAR_LOG_INFO( g_logger ) << "rounds=" << s_rounds << " yield=" << switch_us << "us GetThis=" << get_this_us
+                               << "us Current=" << current_us << "us sum=" << sum;
+  } );
+  sc.stop();
+}
+
+struct RequestContext
+{
+  static std::atomic<int> s_alive;
+
+  RequestContext() { ++s_alive; }
+  ~RequestContext() { --s_alive; }
+
+  std::string traceId;
+};
+
+std::atomic<int> RequestContext::s_alive { 0 };
+
+static sylar::FiberLocal<RequestContext> s_request_ctx;
+
+// 多个协程交替执行，各自看到自己的 traceId，协程结束后变量被析构
+void test_fiber_local()
+{
+  sylar::Scheduler sc { 2, false, "local" };
+  sc.start();
+  for ( int i = 0; i < 10; ++i ) {
+    sc.schedule( [i]() {
+      std::string id { "trace_" + std::to_string( i ) };
+      s_request_ctx->traceId = id;
+      for ( int j = 0; j < 3; ++j ) {
+        sylar::Fiber::YieldToReady();
+        SYLAR_ASSERT( s_request_ctx->traceId == id );
+      }
+    } );
+  }
+  sc.stop();
+  SYLAR_LOG_INFO( g_logger ) << "fiber local alive after stop = " << RequestContext::s_alive;
+  SYLAR_ASSERT( RequestContext::s_alive == 0 );
+}
+
 int main()
 {
   sylar::Thread::SetName( "main" );
+  test_fiber_local();
+  test_switch_bench();
 
   std::vector<sylar::Thread::SPtr> thrs;
   for ( int i = 0; i < 1; ++i ) {
@@ -1,14 +1,84 @@
 #include "sylar/address.h"
+#include "sylar/fiber.h"
+#include "sylar/hook.h"
+#include "sylar/http/http_connection.h"
 #include "sylar/http/http_server.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/socket.h"
+#include <cassert>
 #include <memory>
 #include <unistd.h>
+#include <vector>
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
 
 #define XX( ... ) #__VA_ARGS__
 
+// 每个连接发一个请求后保持空闲，返回空闲期间协程总数的增量；再在每个连接上发第二个请求确认仍能处理
+static uint64_t idle_fiber_delta( bool release_idle_fiber, const std::string& address )
+{
+  static const int s_connections { 64 };
+  sylar::IOManager iom { 2, false, "idle_http" };
+  for ( int tid : iom.getThreadIds() ) {
+    iom.schedule( []() { sylar::set_hook_enable( true ); }, tid );
+  }
+  sylar::http::HttpServer::SPtr server { std::make_shared<sylar::http::HttpServer>( true, &iom, &iom, &iom ) };
+  server->setReleaseIdleFiber( release_idle_fiber );
+  server->getServletDisaptch()->addServlet( "/idle",
+                                            []( sylar::http::HttpRequest::SPtr req,
+                                                sylar::http::HttpResponse::SPtr rsp,
+                                                sylar::http::HttpSession::SPtr session ) {
+                                              rsp->setBody( "ok" );
+                                              return 0;
+                                            } );
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( address );
+  while ( !server->bind( addr ) ) {
+    sleep( 2 );
+  }
+  server->start();
+  usleep( 100 * 1000 );
+  uint64_t before { sylar::Fiber::TotalFibers() };
+
+  auto request = []( sylar::http::HttpConnection& conn ) {
+    sylar::http::HttpRequest::SPtr req { std::make_shared<sylar::http::HttpRequest>( 0x11, false ) };
+    req->setPath( "/idle" );
+    req->setHeader( "Host", "localhost" );
+    SYLAR_ASSERT( conn.sendRequest( req ) > 0 );
+    sylar::http::HttpResponse::SPtr rsp { conn.recvResponse() };
+    SYLAR_ASSERT( rsp && rsp->getBody() == "ok" && rsp->getHeader( "connection" ) == "keep-alive" );
+  };
+
+  std::vector<std::shared_ptr<sylar::http::HttpConnection>> conns;
+  for ( int i = 0; i < s_connections; ++i ) {
+    sylar::Socket::SPtr sock { sylar::Socket::CreateTCP( addr ) };
+    SYLAR_ASSERT( sock->connect( addr ) );
+    conns.push_back( std::make_shared<sylar::http::HttpConnection>( sock ) );
+    request( *conns.back() );
+  }
+  usleep( 100 * 1000 );
+  uint64_t idle { sylar::Fiber::TotalFibers() };
+
+  for ( auto& conn : conns ) {
+    request( *conn );
+  }
+  conns.clear();
+  server->stop();
+  SYLAR_LOG_INFO( g_logger ) << "release_idle_fiber=" << release_idle_fiber << " connections=" << s_connections
+                             << " fibers before=" << before << " idle=" << idle;
+  return idle > before ? idle - before : 0;
+}
+
+// 空闲长连接不占协程：释放模式下协程数不随空闲连接数增长，阻塞模式下每个连接占一个
+void test_release_idle_fiber()
+{
+  uint64_t blocking { idle_fiber_delta( false, "127.0.0.1:8004" ) };
+  uint64_t released { idle_fiber_delta( true, "127.0.0.1:8003" ) };
+  SYLAR_ASSERT( released < 16 );
+  SYLAR_ASSERT( blocking >= 48 );
+}
+
 void run()
 {
   g_logger->setLevel( sylar::LogLevel::INFO );
@@ -56,6 +126,7 @@ void run()
 
 int main()
 {
+  test_release_idle_fiber();
   sylar::IOManager iom { 4 };
   iom.schedule( run );
   return 0;
@@ -0,0 +1,121 @@
+#include "sylar/bytearray.h"
+#include "sylar/config.h"
+#include "sylar/iobuf.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include <cassert>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+// 用很小的块让数据跨越多个块
+static const uint32_t s_block_size { 16 };
+
+void test_append_slice()
+{
+  std::string data;
+  for ( int i = 0; i < 100; ++i ) {
+    data += (char)( 'a' + i % 26 );
+  }
+  sylar::IOBuf buf;
+  buf.append( data.substr( 0, 10 ) );
+  buf.append( data.substr( 10 ) );
+  SYLAR_ASSERT( buf.size() == data.size() && buf.toString() == data );
+  // 第二次 append 先填满第一块剩余的 6 字节
+  SYLAR_ASSERT( buf.getSegmentCount() == ( data.size() + s_block_size - 1 ) / s_block_size );
+
+  // slice 与原对象共享块，原对象之后的 append 不影响 slice
+  sylar::IOBuf part { buf.slice( 30, 40 ) };
+  SYLAR_ASSERT( part.size() == 40 && part.toString() == data.substr( 30, 40 ) );
+  buf.append( "tail", 4 );
+  SYLAR_ASSERT( part.toString() == data.substr( 30, 40 ) && buf.toString() == data + "tail" );
+  // slice 的尾块是共享的，append 只能用新块
+  part.append( "!", 1 );
+  SYLAR_ASSERT( part.toString() == data.substr( 30, 40 ) + "!" && buf.toString() == data + "tail" );
+
+  sylar::IOBuf joined;
+  joined.append( part );
+  joined.append( buf.slice( 0, 5 ) );
+  SYLAR_ASSERT( joined.toString() == data.substr( 30, 40 ) + "!" + data.substr( 0, 5 ) );
+
+  buf.consume( 95 );
+  SYLAR_ASSERT( buf.toString() == data.substr( 95 ) + "tail" );
+  char out[4];
+  SYLAR_ASSERT( buf.copyTo( out, sizeof( out ), 3 ) == 4 && std::string( out, 4 ) == "uvta" );
+  buf.consume( 100 );
+  SYLAR_ASSERT( buf.empty() && buf.getSegmentCount() == 0 );
+}
+
+// 接管 ByteArray 的节点，逐块以 string_view 遍历
+void test_bytearray()
+{
+  sylar::ByteArray::SPtr ba { std::make_shared<sylar::ByteArray>( 8 ) };
+  std::string data { "0123456789abcdefghijklmnopqrstuvwxyz" };
+  ba->write( data.data(), data.size() );
+  ba->setPosition( 3 );
+
+  sylar::IOBuf buf;
+  buf.append( "<", 1 );
+  buf.append( std::move( *ba ) );
+  SYLAR_ASSERT( ba->getReadSize() == 0 && ba->getPosition() == 0 );
+  SYLAR_ASSERT( buf.toString() == "<" + data.substr( 3 ) );
+  // 接管后的 ByteArray 仍可正常使用
+  ba->write( data.data(), data.size() );
+  ba->setPosition( 0 );
+  SYLAR_ASSERT( ba->toString() == data );
+
+  std::string joined;
+  std::size_t segments { 0 };
+  for ( std::string_view seg : buf ) {
+    SYLAR_ASSERT( seg.size() <= 8 );
+    joined.append( seg );
+    ++segments;
+  }
+  SYLAR_LOG_INFO( g_logger ) << "iobuf from bytearray: segments=" << segments << " size=" << buf.size();
+  SYLAR_ASSERT( joined == buf.toString() && segments == buf.getSegmentCount() && segments == 6 );
+}
+
+// getReadBuffers 直接交给 writev
+void test_writev()
+{
+  sylar::IOBuf buf;
+  std::string data( 1000, 'x' );
+  for ( std::size_t i = 0; i < data.size(); ++i ) {
+    data[i] = (char)( 'A' + i % 26 );
+  }
+  buf.append( data );
+  sylar::IOBuf part { buf.slice( 7, 900 ) };
+
+  int fds[2];
+  SYLAR_ASSERT( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) == 0 );
+  std::vector<iovec> iovs;
+  SYLAR_ASSERT( part.getReadBuffers( iovs ) == 900 && iovs.size() == part.getSegmentCount() );
+  SYLAR_ASSERT( writev( fds[0], iovs.data(), iovs.size() ) == 900 );
+  iovs.clear();
+  SYLAR_ASSERT( part.getReadBuffers( iovs, 10 ) == 10 && iovs.size() == 2 && iovs[1].iov_len == 1 );
+
+  std::string received( 900, '\0' );
+  std::size_t got { 0 };
+  while ( got < received.size() ) {
+    ssize_t n = read( fds[1], &received[got], received.size() - got );
+    SYLAR_ASSERT( n > 0 );
+    got += n;
+  }
+  SYLAR_ASSERT( received == data.substr( 7, 900 ) );
+  close( fds[0] );
+  close( fds[1] );
+}
+
+int main()
+{
+  sylar::Config::Lookup<uint32_t>( "iobuf.block_size" )->setValue( s_block_size );
+  test_append_slice();
+  test_bytearray();
+  test_writev();
+  return 0;
+}
@@ -1,11 +1,13 @@
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
 #include "sylar/timer.h"
+#include "sylar/util.h"
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
+#include <sstream>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -67,8 +69,54 @@ void test_timer()
     true );
 }
 
+// 两个协程通过 pipe 乒乓，唤醒均经由 epoll 返回
+void test_ping_pong( std::size_t threads )
+{
+  static const int s_rounds { 10000 };
+  sylar::IOManager iomanager { threads, true, "ping_pong" };
+  int ping[2];
+  int pong[2];
+  pipe2( ping, O_NONBLOCK );
+  pipe2( pong, O_NONBLOCK );
+
+  auto wait_read = []( int fd ) {
+    char c;
+    while ( read( fd, &c, 1 ) != 1 ) {
+      sylar::IOManager::GetThis()->addEvent( fd, sylar::IOManager::READ );
+      sylar::Fiber::YieldToHold();
+    }
+  };
+
+  std::uint64_t start_us { sylar::GetCurrentUS() };
+  iomanager.schedule( [&]() {
+    for ( int i = 0; i < s_rounds; ++i ) {
+      wait_read( ping[0] );
+      write( pong[1], "o", 1 );
+    }
+  } );
+  iomanager.schedule( [&]() {
+    for ( int i = 0; i < s_rounds; ++i ) {
+      write( ping[1], "i", 1 );
+      wait_read( pong[0] );
+    }
+    SYLAR_LOG_INFO( g_logger ) << "ping-pong rounds=" << s_rounds << " used "
+                               << ( sylar::GetCurrentUS() - start_us ) << "us";
+  } );
+  iomanager.stop();
+
+  std::ostringstream ss;
+  iomanager.dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+  close( ping[0] );
+  close( ping[1] );
+  close( pong[0] );
+  close( pong[1] );
+}
+
 int main()
 {
+  test_ping_pong( 1 );
+  test_ping_pong( 4 );
   test_timer();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "sylar/address.h"
+#include "sylar/config.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/offload.h"
+#include "sylar/util.h"
+#include <cassert>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+// 线程全忙且队列已满时 submit 被拒绝，offload() 退化为在调用线程上同步执行
+void test_queue_limit()
+{
+  auto max_queue = sylar::Config::Lookup<std::uint32_t>( "offload.max_queue" );
+  std::uint32_t old_max_queue { max_queue->getValue() };
+
+  sylar::OffloadPool& pool { sylar::OffloadMgr::GetInstance() };
+  while ( pool.getStats().queued > 0 || pool.getStats().running > 0 ) {
+    usleep( 1000 );
+  }
+  std::size_t threads { pool.getStats().threads };
+  sylar::Semaphore release;
+  for ( std::size_t i = 0; i < threads; ++i ) {
+    SYLAR_ASSERT( pool.submit( [&release]() { release.wait(); } ) );
+  }
+  while ( pool.getStats().running < threads ) {
+    usleep( 1000 );
+  }
+  max_queue->setValue( 2 );
+  SYLAR_ASSERT( pool.submit( []() {} ) && pool.submit( []() {} ) );
+  SYLAR_ASSERT( !pool.submit( []() {} ) );
+
+  int caller { sylar::GetThreadId() };
+  int runner = sylar::offload( []() { return sylar::GetThreadId(); } );
+  SYLAR_ASSERT( runner == caller );
+
+  for ( std::size_t i = 0; i < threads; ++i ) {
+    release.notify();
+  }
+  while ( pool.getStats().queued > 0 || pool.getStats().running > 0 ) {
+    usleep( 1000 );
+  }
+  std::stringstream ss;
+  pool.dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+  SYLAR_ASSERT( pool.getStats().rejected == 2 );
+  max_queue->setValue( old_max_queue );
+}
+
+void test_offload()
+{
+  int value = sylar::offload( []() {
+    usleep( 100 * 1000 );
+    return 42;
+  } );
+  SYLAR_LOG_INFO( g_logger ) << "offload result=" << value;
+
+  sylar::offload( []() { SYLAR_LOG_INFO( g_logger ) << "void job in offload thread"; } );
+
+  try {
+    sylar::offload( []() -> int { throw std::runtime_error( "offload error" ); } );
+  } catch ( std::exception& ex ) {
+    SYLAR_LOG_INFO( g_logger ) << "caught: " << ex.what();
+  }
+
+  std::vector<sylar::Address::SPtr> addrs;
+  sylar::Address::LookUp( addrs, "localhost:80" );
+  for ( auto& addr : addrs ) {
+    SYLAR_LOG_INFO( g_logger ) << "lookup: " << addr->toString();
+  }
+
+  std::stringstream ss;
+  sylar::OffloadMgr::GetInstance().dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+
+  test_queue_limit();
+}
+
+void test_ticker()
+{
+  for ( int i = 0; i < 3; ++i ) {
+    SYLAR_LOG_INFO( g_logger ) << "ticker " << i;
+    sylar::Fiber::YieldToReady();
+  }
+}
+
+int main()
+{
+  sylar::IOManager iom { 1, false };
+  iom.schedule( test_offload );
+  iom.schedule( test_ticker );
+  return 0;
+}
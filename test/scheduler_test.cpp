@@ -1,5 +1,15 @@
 #include "sylar/sylar.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <sched.h>
+#include <sstream>
+#include <string>
 #include <unistd.h>
+#include <vector>
 
 sylar::Logger::SPtr g_logger { SYLAR_LOG_ROOT() };
 
@@ -14,8 +24,311 @@ void test_fiber()
   }
 }
 
+// 单线程按 8:4:1 加权出队：第一轮恰好是 8 个高、4 个普通、1 个低优先级任务
+void test_priority()
+{
+  static const int s_rounds { 4 };
+  sylar::Scheduler sc { 1, false, "priority" };
+  std::vector<int> order;
+  for ( int i = 0; i < 8 * s_rounds; ++i ) {
+    sc.schedule( [&order]() { order.push_back( sylar::Scheduler::HIGH ); }, -1, sylar::Scheduler::HIGH );
+  }
+  for ( int i = 0; i < 4 * s_rounds; ++i ) {
+    sc.schedule( [&order]() { order.push_back( sylar::Scheduler::NORMAL ); } );
+  }
+  for ( int i = 0; i < s_rounds; ++i ) {
+    sc.schedule( [&order]() { order.push_back( sylar::Scheduler::LOW ); }, -1, sylar::Scheduler::LOW );
+  }
+  sc.start();
+  sc.stop();
+
+  std::stringstream ss;
+  sc.dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << ss.str();
+  SYLAR_ASSERT( order.size() == 13 * s_rounds );
+  for ( int round = 0; round < s_rounds; ++round ) {
+    int counts[sylar::Scheduler::PRIORITY_COUNT] {};
+    for ( int i = 0; i < 13; ++i ) {
+      ++counts[order[round * 13 + i]];
+    }
+    SYLAR_ASSERT( counts[sylar::Scheduler::HIGH] == 8 && counts[sylar::Scheduler::NORMAL] == 4
+                  && counts[sylar::Scheduler::LOW] == 1 );
+  }
+}
+
+// 高优先级任务源源不断且权重极大时，低优先级任务仍在 starvation_ms 内被提升执行
+void test_starvation()
+{
+  static const std::uint32_t s_starvation_ms { 20 };
+  auto weights = sylar::Config::Lookup<std::vector<std::uint32_t>>( "scheduler.priority.weights" );
+  auto starvation = sylar::Config::Lookup<std::uint32_t>( "scheduler.priority.starvation_ms" );
+  std::vector<std::uint32_t> old_weights { weights->getValue() };
+  std::uint32_t old_starvation { starvation->getValue() };
+  weights->setValue( { 1000000, 1, 1 } );
+  starvation->setValue( s_starvation_ms );
+
+  sylar::Scheduler sc { 1, false, "starvation" };
+  std::atomic<bool> low_done { false };
+  std::uint64_t low_wait_us { 0 };
+  std::function<void()> busy;
+  busy = [&]() {
+    usleep( 1000 );
+    if ( !low_done ) {
+      sylar::Scheduler::GetThis()->schedule( busy, -1, sylar::Scheduler::HIGH );
+    }
+  };
+  for ( int i = 0; i < 4; ++i ) {
+    sc.schedule( busy, -1, sylar::Scheduler::HIGH );
+  }
+  std::uint64_t start_us { sylar::GetCurrentUS() };
+  sc.schedule(
+    [&]() {
+      low_wait_us = sylar::GetCurrentUS() - start_us;
+      low_done = true;
+    },
+    -1,
+    sylar::Scheduler::LOW );
+  sc.start();
+  sc.stop();
+
+  weights->setValue( old_weights );
+  starvation->setValue( old_starvation );
+  SYLAR_LOG_INFO( g_logger ) << "starved low task waited " << low_wait_us << "us";
+  // 提升发生在阈值之后的下一次出队，多出一个高优先级任务的耗时
+  SYLAR_ASSERT( low_done && low_wait_us >= s_starvation_ms * 1000 );
+  SYLAR_ASSERT( low_wait_us < ( s_starvation_ms + 10 ) * 1000 );
+}
+
+// 在调度器的每个线程上读取 sched_getaffinity
+static std::vector<cpu_set_t> thread_affinity( const std::string& name )
+{
+  sylar::Scheduler sc { 2, false, name };
+  sc.start();
+  std::vector<cpu_set_t> masks;
+  sylar::Mutex mutex;
+  for ( int tid : sc.getThreadIds() ) {
+    sc.schedule(
+      [&]() {
+        cpu_set_t mask;
+        CPU_ZERO( &mask );
+        SYLAR_ASSERT( sched_getaffinity( 0, sizeof( mask ), &mask ) == 0 );
+        sylar::Mutex::Lock lock { mutex };
+        masks.push_back( mask );
+      },
+      tid );
+  }
+  sc.stop();
+  return masks;
+}
+
+// pin 策略把线程绑到配置的 cpu 上；列表中不可用的 cpu 被忽略，全部不可用时不绑核
+void test_affinity()
+{
+  cpu_set_t allowed;
+  CPU_ZERO( &allowed );
+  SYLAR_ASSERT( sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0 );
+  int last { -1 };
+  for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+    if ( CPU_ISSET( cpu, &allowed ) ) {
+      last = cpu;
+    }
+  }
+
+  auto policy = sylar::Config::Lookup<std::string>( "scheduler.affinity.policy" );
+  auto cpus = sylar::Config::Lookup<std::map<std::string, std::vector<int>>>( "scheduler.affinity.cpus" );
+  policy->setValue( "pin" );
+  cpus->setValue( { { "pin_last", { last } }, { "pin_mixed", { 1000, last } }, { "pin_bad", { -1, 1000 } } } );
+
+  for ( const char* name : { "pin_last", "pin_mixed" } ) {
+    std::vector<cpu_set_t> masks { thread_affinity( name ) };
+    SYLAR_ASSERT( masks.size() == 2 );
+    for ( auto& mask : masks ) {
+      SYLAR_ASSERT( CPU_COUNT( &mask ) == 1 && CPU_ISSET( last, &mask ) );
+    }
+  }
+
+  std::vector<cpu_set_t> masks { thread_affinity( "pin_bad" ) };
+  SYLAR_ASSERT( masks.size() == 2 );
+  for ( auto& mask : masks ) {
+    SYLAR_ASSERT( CPU_EQUAL( &mask, &allowed ) );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "affinity pinned to cpu " << last << ", invalid list left threads unpinned";
+
+  policy->setValue( "none" );
+  cpus->setValue( {} );
+}
+
+// 弹性模式：阻塞任务积压时扩容，空闲超过 cooldown 后收缩回最小线程数，stop() 回收已退休的线程
+void test_elastic()
+{
+  std::map<std::string, std::uint32_t> values { { "scheduler.elastic.min_threads", 1 },
+                                                { "scheduler.elastic.max_threads", 4 },
+                                                { "scheduler.elastic.target_wait_ms", 5 },
+                                                { "scheduler.elastic.sustain_ms", 10 },
+                                                { "scheduler.elastic.cooldown_ms", 200 } };
+  std::map<std::string, std::uint32_t> old_values;
+  for ( auto& [name, value] : values ) {
+    auto var = sylar::Config::Lookup<std::uint32_t>( name );
+    old_values[name] = var->getValue();
+    var->setValue( value );
+  }
+  auto enable = sylar::Config::Lookup<bool>( "scheduler.elastic.enable" );
+  enable->setValue( true );
+
+  sylar::Scheduler sc { 1, false, "elastic" };
+  sc.start();
+  std::atomic<int> done { 0 };
+  for ( int i = 0; i < 40; ++i ) {
+    sc.schedule( [&done]() {
+      usleep( 10 * 1000 );
+      ++done;
+    } );
+  }
+
+  std::vector<int> all_tids;
+  std::size_t max_threads { 0 };
+  while ( done < 40 ) {
+    std::vector<int> tids { sc.getThreadIds() };
+    max_threads = std::max( max_threads, tids.size() );
+    for ( int tid : tids ) {
+      if ( std::find( all_tids.begin(), all_tids.end(), tid ) == all_tids.end() ) {
+        all_tids.push_back( tid );
+      }
+    }
+    usleep( 1000 );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "elastic grew to " << max_threads << " threads";
+  SYLAR_ASSERT( max_threads > 1 && max_threads <= 4 );
+
+  std::uint64_t deadline_us { sylar::GetCurrentUS() + 5 * 1000 * 1000 };
+  while ( sc.getThreadIds().size() > 1 && sylar::GetCurrentUS() < deadline_us ) {
+    usleep( 10 * 1000 );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "elastic shrank to " << sc.getThreadIds().size() << " threads";
+  SYLAR_ASSERT( sc.getThreadIds().size() == 1 );
+
+  sc.stop();
+  for ( int tid : all_tids ) {
+    SYLAR_ASSERT( access( ( "/proc/self/task/" + std::to_string( tid ) ).c_str(), F_OK ) != 0 );
+  }
+
+  enable->setValue( false );
+  for ( auto& [name, value] : old_values ) {
+    sylar::Config::Lookup<std::uint32_t>( name )->setValue( value );
+  }
+}
+
+// 弹性模式下钉在某个线程上、挂在 fd 事件上的协程：该线程退休后事件到达，协程改由其他线程恢复
+void test_elastic_pinned()
+{
+  std::map<std::string, std::uint32_t> values { { "scheduler.elastic.min_threads", 1 },
+                                                { "scheduler.elastic.max_threads", 2 },
+                                                { "scheduler.elastic.target_wait_ms", 5 },
+                                                { "scheduler.elastic.sustain_ms", 10 },
+                                                { "scheduler.elastic.cooldown_ms", 200 } };
+  std::map<std::string, std::uint32_t> old_values;
+  for ( auto& [name, value] : values ) {
+    auto var = sylar::Config::Lookup<std::uint32_t>( name );
+    old_values[name] = var->getValue();
+    var->setValue( value );
+  }
+  auto enable = sylar::Config::Lookup<bool>( "scheduler.elastic.enable" );
+  enable->setValue( true );
+
+  sylar::IOManager iom { 1, false, "elastic_pinned" };
+  for ( int i = 0; i < 20; ++i ) {
+    iom.schedule( []() { usleep( 10 * 1000 ); } );
+  }
+  std::uint64_t deadline_us { sylar::GetCurrentUS() + 5 * 1000 * 1000 };
+  while ( iom.getThreadIds().size() < 2 && sylar::GetCurrentUS() < deadline_us ) {
+    usleep( 1000 );
+  }
+  std::vector<int> tids { iom.getThreadIds() };
+  SYLAR_ASSERT( tids.size() == 2 );
+
+  // 两个线程上各挂一个协程，收缩时退休的是哪一个都能覆盖到
+  int fds[2][2];
+  std::atomic<int> parked_tids[2] { { -1 }, { -1 } };
+  std::atomic<int> resumed_tids[2] { { -1 }, { -1 } };
+  for ( int i = 0; i < 2; ++i ) {
+    SYLAR_ASSERT( pipe2( fds[i], O_NONBLOCK ) == 0 );
+    int thread { tids[i] };
+    iom.schedule(
+      [&, i, thread]() {
+        sylar::IOManager* iom { sylar::IOManager::GetThis() };
+        sylar::Fiber::SPtr fiber { sylar::Fiber::GetThis() };
+        iom->addEvent(
+          fds[i][0], sylar::IOManager::READ, [iom, fiber, thread]() { iom->schedule( fiber, thread ); } );
+        parked_tids[i] = sylar::GetThreadId();
+        sylar::Fiber::YieldToHold();
+        char c;
+        SYLAR_ASSERT( read( fds[i][0], &c, 1 ) == 1 );
+        resumed_tids[i] = sylar::GetThreadId();
+      },
+      thread );
+  }
+
+  deadline_us = sylar::GetCurrentUS() + 5 * 1000 * 1000;
+  while ( ( parked_tids[0] == -1 || parked_tids[1] == -1 || iom.getThreadIds().size() > 1 )
+          && sylar::GetCurrentUS() < deadline_us ) {
+    usleep( 10 * 1000 );
+  }
+  SYLAR_ASSERT( parked_tids[0] == tids[0] && parked_tids[1] == tids[1] );
+  SYLAR_ASSERT( iom.getThreadIds().size() == 1 );
+
+  for ( int i = 0; i < 2; ++i ) {
+    SYLAR_ASSERT( write( fds[i][1], "x", 1 ) == 1 );
+  }
+  deadline_us = sylar::GetCurrentUS() + 2 * 1000 * 1000;
+  while ( ( resumed_tids[0] == -1 || resumed_tids[1] == -1 ) && sylar::GetCurrentUS() < deadline_us ) {
+    usleep( 1000 );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "elastic pinned fibers parked on " << parked_tids[0] << "," << parked_tids[1]
+                             << " resumed on " << resumed_tids[0] << "," << resumed_tids[1];
+  int alive { iom.getThreadIds()[0] };
+  SYLAR_ASSERT( resumed_tids[0] == alive && resumed_tids[1] == alive );
+  iom.stop();
+  for ( int i = 0; i < 2; ++i ) {
+    close( fds[i][0] );
+    close( fds[i][1] );
+  }
+
+  enable->setValue( false );
+  for ( auto& [name, value] : old_values ) {
+    sylar::Config::Lookup<std::uint32_t>( name )->setValue( value );
+  }
+}
+
+// 回调挂起后以协程身份恢复并结束，结束的协程回到池中供下一个回调使用
+void test_fiber_pool()
+{
+  sylar::Scheduler sc { 1, false, "pool" };
+  sc.start();
+  sc.schedule( []() {
+    for ( int i = 0; i < 1000; ++i ) {
+      sylar::Scheduler::GetThis()->schedule( []() {
+        sylar::Scheduler::GetThis()->schedule( sylar::Fiber::GetThis() );
+        sylar::Fiber::YieldToHold();
+      } );
+      sylar::Fiber::YieldToReady();
+    }
+  } );
+  sc.stop();
+
+  sylar::Fiber::PoolStats stats { sylar::Fiber::GetPoolStats() };
+  SYLAR_LOG_INFO( g_logger ) << "fiber pool hits=" << stats.hits << " misses=" << stats.misses
+                             << " recycled=" << stats.recycled << " dropped=" << stats.dropped;
+}
+
 int main()
 {
+  test_priority();
+  test_starvation();
+  test_affinity();
+  test_elastic();
+  test_elastic_pinned();
+  test_fiber_pool();
+
   SYLAR_LOG_INFO( g_logger ) << "main";
   sylar::Scheduler sc { 3, false, "test" };
 
@@ -0,0 +1,130 @@
+#include "sylar/address.h"
+#include "sylar/bytearray.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/shm_stream.h"
+#include "sylar/socket.h"
+#include "sylar/util.h"
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+static const char* s_path { "/tmp/sylar_shm_stream_test.sock" };
+static const int s_rounds { 2000 };
+static const std::size_t s_msg_size { 4096 };
+// 小于总传输量，使两个方向的环形缓冲区都会写满绕回
+static const std::size_t s_capacity { 64 * 1024 };
+
+// 子进程：没有 IOManager，阻塞在 poll 上；发出数据并校验回显
+static int run_client()
+{
+  sylar::ShmStream::SPtr stream {
+    sylar::ShmStream::Connect( std::make_shared<sylar::UnixAddress>( s_path ), s_capacity ) };
+  if ( !stream ) {
+    return 1;
+  }
+  std::string out( s_msg_size, '\0' );
+  std::string in( s_msg_size, '\0' );
+  uint64_t start_us { sylar::GetCurrentUS() };
+  for ( int i = 0; i < s_rounds; ++i ) {
+    std::memset( &out[0], 'a' + i % 26, out.size() );
+    if ( stream->writeFixSize( out.data(), out.size() ) <= 0 ) {
+      return 2;
+    }
+    if ( stream->readFixSize( &in[0], in.size() ) <= 0 || in != out ) {
+      return 3;
+    }
+  }
+  uint64_t elapsed_us { std::max<uint64_t>( sylar::GetCurrentUS() - start_us, 1 ) };
+  SYLAR_LOG_INFO( g_logger ) << "shm echo: rounds=" << s_rounds << " msg_size=" << s_msg_size
+                             << " MB/s=" << s_rounds * s_msg_size * 2 / elapsed_us;
+  stream->close();
+  return 0;
+}
+
+// 父进程在协程中接受连接并用 ByteArray 接口回显，直到对端关闭
+static void test_echo()
+{
+  ::unlink( s_path );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateUnixTCPSocket() };
+  SYLAR_ASSERT( listener->bind( std::make_shared<sylar::UnixAddress>( s_path ) ) && listener->listen() );
+
+  pid_t pid = fork();
+  SYLAR_ASSERT( pid >= 0 );
+  if ( pid == 0 ) {
+    exit( run_client() );
+  }
+
+  uint64_t echoed { 0 };
+  {
+    sylar::IOManager iom { 1, false, "shm_echo" };
+    iom.schedule( [&]() {
+      sylar::ShmStream::SPtr stream { sylar::ShmStream::Open( listener->accept() ) };
+      SYLAR_ASSERT( stream && stream->getCapacity() == s_capacity );
+      sylar::ByteArray::SPtr ba { std::make_shared<sylar::ByteArray>() };
+      while ( true ) {
+        ba->clear();
+        int n = stream->read( ba, s_msg_size );
+        if ( n <= 0 ) {
+          break;
+        }
+        ba->setPosition( 0 );
+        SYLAR_ASSERT( stream->writeFixSize( ba, n ) > 0 );
+        echoed += n;
+      }
+      // 对端已关闭，继续写应得到 EPIPE
+      SYLAR_ASSERT( stream->write( "x", 1 ) == -1 && errno == EPIPE );
+    } );
+  }
+
+  int status { 0 };
+  SYLAR_ASSERT( waitpid( pid, &status, 0 ) == pid );
+  SYLAR_LOG_INFO( g_logger ) << "child status=" << WEXITSTATUS( status ) << " echoed=" << echoed;
+  SYLAR_ASSERT( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+  SYLAR_ASSERT( echoed == s_rounds * s_msg_size );
+  ::unlink( s_path );
+}
+
+// 本端一个协程阻塞在读上时另一个协程关闭流：读立即以 EBADF 返回，不再访问已解除映射的共享区域
+static void test_close_while_reading()
+{
+  ::unlink( s_path );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateUnixTCPSocket() };
+  SYLAR_ASSERT( listener->bind( std::make_shared<sylar::UnixAddress>( s_path ) ) && listener->listen() );
+
+  int ret { 0 };
+  int err { 0 };
+  uint64_t elapsed_ms { 0 };
+  {
+    sylar::IOManager iom { 1, true, "shm_close" };
+    iom.schedule( [&]() {
+      sylar::ShmStream::SPtr peer;
+      iom.schedule( [&]() { peer = sylar::ShmStream::Open( listener->accept() ); } );
+      sylar::ShmStream::SPtr stream {
+        sylar::ShmStream::Connect( std::make_shared<sylar::UnixAddress>( s_path ), s_capacity ) };
+      SYLAR_ASSERT( stream );
+      iom.schedule( [stream]() { stream->close(); } );
+      char c;
+      uint64_t start_ms { sylar::GetCurrentMS() };
+      ret = stream->read( &c, 1 );
+      err = errno;
+      elapsed_ms = sylar::GetCurrentMS() - start_ms;
+    } );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "close while reading: ret=" << ret << " errno=" << err
+                             << " elapsed_ms=" << elapsed_ms;
+  SYLAR_ASSERT( ret == -1 && err == EBADF && elapsed_ms < 100 );
+  ::unlink( s_path );
+}
+
+int main()
+{
+  test_echo();
+  test_close_while_reading();
+  return 0;
+}
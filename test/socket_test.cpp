@@ -2,7 +2,16 @@
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
 #include "sylar/socket.h"
+#include "sylar/socket_profile.h"
+#include "sylar/socket_stream.h"
 #include "sylar/sylar.h"
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sstream>
+#include <vector>
+#include <yaml-cpp/yaml.h>
 
 static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
 
@@ -46,8 +55,321 @@ void test_socket()
   SYLAR_LOG_INFO( g_logger ) << bufs;
 }
 
+// 从 YAML 加载命名 profile，应用到监听 socket 后读回选项
+void test_socket_profile()
+{
+  YAML::Node root = YAML::Load( R"(
+socket:
+  profiles:
+    web:
+      send_buffer: 65536
+      recv_buffer: 131072
+      no_delay: false
+      defer_accept: 5
+      fast_open: 128
+      notsent_lowat: 16384
+      backlog: 1024
+      bogus: 1
+)" );
+  sylar::Config::LoadFromYaml( root );
+
+  sylar::SocketProfile::SPtr profile { sylar::SocketProfile::Get( "web" ) };
+  SYLAR_ASSERT( profile );
+  SYLAR_ASSERT( !sylar::SocketProfile::Get( "missing" ) );
+  std::stringstream ss;
+  profile->dump( ss );
+  SYLAR_LOG_INFO( g_logger ) << "profile web: " << ss.str();
+  SYLAR_ASSERT( profile->getBacklog() == 1024 && profile->busyPoll == -1 );
+
+  sylar::Socket::SPtr sock { sylar::Socket::CreateTCPSocket() };
+  SYLAR_ASSERT( profile->apply( *sock, sylar::SocketProfile::LISTEN ) );
+  int no_delay { 1 };
+  int defer_accept { 0 };
+  sock->getOption( IPPROTO_TCP, TCP_NODELAY, no_delay );
+  sock->getOption( IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept );
+  SYLAR_LOG_INFO( g_logger ) << "no_delay=" << no_delay << " defer_accept=" << defer_accept;
+  SYLAR_ASSERT( no_delay == 0 && defer_accept > 0 );
+}
+
+// 回环上内核会把零拷贝退化为拷贝，但仍会发出完成通知，holder 应在对端收完后被释放
+void test_zerocopy()
+{
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( "127.0.0.1:0" );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateTCP( addr ) };
+  SYLAR_ASSERT( listener->bind( addr ) && listener->listen() );
+  sylar::Socket::SPtr client { sylar::Socket::CreateTCP( addr ) };
+  bool rt { client->connect( listener->getLocalAddress() ) };
+  SYLAR_ASSERT( rt );
+  sylar::Socket::SPtr server { listener->accept() };
+  SYLAR_ASSERT( server );
+
+  std::shared_ptr<std::string> data { std::make_shared<std::string>( 256 * 1024, 'z' ) };
+  std::weak_ptr<std::string> weak_data { data };
+  std::string buf( 64 * 1024, '\0' );
+  int sent { 0 };
+  int received { 0 };
+  while ( sent < (int)data->size() ) {
+    int ret = client->sendZeroCopy( data->data() + sent, data->size() - sent, data );
+    SYLAR_ASSERT( ret > 0 );
+    sent += ret;
+    while ( received < sent ) {
+      ret = server->recv( buf.data(), buf.size() );
+      SYLAR_ASSERT( ret > 0 );
+      received += ret;
+    }
+  }
+  SYLAR_LOG_INFO( g_logger ) << "zerocopy sent=" << sent << " pending=" << client->getZeroCopyPending();
+  data.reset();
+
+  // hook 后的 usleep 挂起协程，IOManager 得以 epoll_wait 并调度错误队列回调
+  sylar::set_hook_enable( true );
+  for ( int i = 0; i < 100 && !weak_data.expired(); ++i ) {
+    usleep( 1000 );
+  }
+  sylar::set_hook_enable( false );
+  SYLAR_LOG_INFO( g_logger ) << "zerocopy holder released=" << weak_data.expired()
+                             << " pending=" << client->getZeroCopyPending();
+  SYLAR_ASSERT( weak_data.expired() && client->getZeroCopyPending() == 0 );
+}
+
+// 对端不读时关闭仍有在途零拷贝发送的 socket：fd 和缓冲区保留到对端收完，数据完整送达后才收到 EOF
+void test_zerocopy_close()
+{
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( "127.0.0.1:0" );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateTCP( addr ) };
+  SYLAR_ASSERT( listener->bind( addr ) );
+  // 接收缓冲区继承给 accept 出的 socket，让大部分数据滞留在发送端队列中
+  SYLAR_ASSERT( listener->setOption( SOL_SOCKET, SO_RCVBUF, 64 * 1024 ) && listener->listen() );
+  sylar::Socket::SPtr client { sylar::Socket::CreateTCP( addr ) };
+  bool rt { client->connect( listener->getLocalAddress() ) };
+  SYLAR_ASSERT( rt );
+  sylar::Socket::SPtr server { listener->accept() };
+  SYLAR_ASSERT( server );
+
+  std::shared_ptr<std::string> data { std::make_shared<std::string>( 1024 * 1024, 'c' ) };
+  std::weak_ptr<std::string> weak_data { data };
+  int sent { client->sendZeroCopy( data->data(), data->size(), data, MSG_DONTWAIT ) };
+  SYLAR_ASSERT( sent > 0 );
+  data.reset();
+  int fd { client->getSocket() };
+  SYLAR_LOG_INFO( g_logger ) << "zerocopy close sent=" << sent << " pending=" << client->getZeroCopyPending();
+  SYLAR_ASSERT( client->getZeroCopyPending() > 0 );
+  client->close();
+  SYLAR_ASSERT( !weak_data.expired() && fcntl_f( fd, F_GETFD ) != -1 );
+
+  sylar::set_hook_enable( true );
+  std::string buf( 64 * 1024, '\0' );
+  int received { 0 };
+  int ret { 0 };
+  while ( ( ret = server->recv( buf.data(), buf.size() ) ) > 0 ) {
+    received += ret;
+  }
+  for ( int i = 0; i < 100 && !weak_data.expired(); ++i ) {
+    usleep( 1000 );
+  }
+  sylar::set_hook_enable( false );
+  SYLAR_LOG_INFO( g_logger ) << "zerocopy close received=" << received
+                             << " holder released=" << weak_data.expired();
+  SYLAR_ASSERT( ret == 0 && received == sent && weak_data.expired() );
+}
+
+static std::pair<sylar::Socket::SPtr, sylar::Socket::SPtr> connected_pair( sylar::Socket::SPtr listener )
+{
+  sylar::Socket::SPtr client { sylar::Socket::CreateTCPSocket() };
+  bool rt { client->connect( listener->getLocalAddress() ) };
+  SYLAR_ASSERT( rt );
+  return { client, listener->accept() };
+}
+
+// c1 -> s1 ==Pipe== s2 -> c2 转发 1 MiB，c1 关闭后半关闭传到 c2；再用 spliceFrom 从临时文件发送
+void test_splice()
+{
+  // 转发协程与读写协程在同一线程上交替运行，需要 hook 把阻塞读写变为挂起
+  sylar::set_hook_enable( true );
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( "127.0.0.1:0" );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateTCP( addr ) };
+  SYLAR_ASSERT( listener->bind( addr ) && listener->listen() );
+  auto [c1, s1] = connected_pair( listener );
+  auto [c2, s2] = connected_pair( listener );
+
+  bool piped { false };
+  sylar::SocketStream::Pipe( std::make_shared<sylar::SocketStream>( s1 ),
+                             std::make_shared<sylar::SocketStream>( s2 ),
+                             [&piped]() { piped = true; } );
+
+  std::string data( 1024 * 1024, '\0' );
+  for ( size_t i = 0; i < data.size(); ++i ) {
+    data[i] = (char)( i * 31 );
+  }
+  sylar::IOManager::GetThis()->schedule( [c1, &data]() {
+    sylar::SocketStream stream { c1 };
+    SYLAR_ASSERT( stream.writeFixSize( data.data(), data.size() ) > 0 );
+  } );
+  std::string received( data.size(), '\0' );
+  sylar::SocketStream stream2 { c2 };
+  SYLAR_ASSERT( stream2.readFixSize( &received[0], received.size() ) > 0 );
+  char c;
+  SYLAR_ASSERT( received == data && c2->recv( &c, 1 ) == 0 );
+  stream2.close();
+  for ( int i = 0; i < 100 && !piped; ++i ) {
+    usleep( 1000 );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "splice pipe forwarded=" << received.size() << " done=" << piped;
+  SYLAR_ASSERT( piped );
+
+  FILE* file { tmpfile() };
+  SYLAR_ASSERT( file && fwrite( data.data(), 1, 300 * 1024, file ) == 300 * 1024 && fflush( file ) == 0 );
+  auto [c3, s3] = connected_pair( listener );
+  sylar::IOManager::GetThis()->schedule( [s3, file]() {
+    sylar::SocketStream stream { s3 };
+    loff_t offset { 0 };
+    while ( offset < 300 * 1024 ) {
+      SYLAR_ASSERT( stream.spliceFrom( fileno( file ), &offset, 300 * 1024 - offset ) > 0 );
+    }
+  } );
+  received.assign( 300 * 1024, '\0' );
+  sylar::SocketStream stream3 { c3 };
+  SYLAR_ASSERT( stream3.readFixSize( &received[0], received.size() ) > 0 );
+  SYLAR_ASSERT( received == data.substr( 0, received.size() ) && c3->recv( &c, 1 ) == 0 );
+  fclose( file );
+  sylar::set_hook_enable( false );
+}
+
+// accept4 hook 与 tryAccept：新连接直接登记为 socket，阻塞模式随 hook 状态；本端地址用到时再取
+void test_accept()
+{
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( "127.0.0.1:0" );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateTCP( addr ) };
+  SYLAR_ASSERT( listener->bind( addr ) && listener->listen() );
+  sylar::Address::SPtr listen_addr { listener->getLocalAddress() };
+  int flags { fcntl_f( listener->getSocket(), F_GETFL, 0 ) };
+  fcntl_f( listener->getSocket(), F_SETFL, flags | O_NONBLOCK );
+  errno = 0;
+  SYLAR_ASSERT( !listener->tryAccept() && errno == EAGAIN );
+
+  // 客户端在开启 hook 之前连上，hook 后的 connect 需要 IOManager
+  std::vector<sylar::Socket::SPtr> clients;
+  for ( int i = 0; i < 4; ++i ) {
+    clients.push_back( sylar::Socket::CreateTCPSocket() );
+    bool rt { clients.back()->connect( listen_addr ) };
+    SYLAR_ASSERT( rt );
+  }
+
+  // 未开启 hook：保持阻塞，不做 getsockname
+  sylar::Socket::SPtr server { listener->tryAccept() };
+  SYLAR_ASSERT( server && server->isConnected() );
+  sylar::FdCtx* ctx { sylar::FdMgr::GetInstance().get( server->getSocket() ) };
+  SYLAR_ASSERT( ctx && ctx->isSocket() && !ctx->getSysNonblock() );
+  SYLAR_ASSERT( !( fcntl_f( server->getSocket(), F_GETFL, 0 ) & O_NONBLOCK ) );
+  SYLAR_ASSERT( server->getRemoteAddress()->toString() == clients[0]->getLocalAddress()->toString() );
+  std::stringstream ss;
+  server->dump( ss );
+  SYLAR_ASSERT( ss.str().find( "local_address" ) == std::string::npos );
+  SYLAR_ASSERT( server->getLocalAddress()->toString() == listen_addr->toString() );
+  SYLAR_ASSERT( clients[0]->send( "a", 1 ) == 1 );
+  char c { 0 };
+  SYLAR_ASSERT( server->recv( &c, 1 ) == 1 && c == 'a' );
+
+  // 开启 hook：以 SOCK_NONBLOCK 创建，对用户仍表现为阻塞
+  sylar::set_hook_enable( true );
+  sylar::Socket::SPtr hooked { listener->tryAccept() };
+  SYLAR_ASSERT( hooked );
+  ctx = sylar::FdMgr::GetInstance().get( hooked->getSocket() );
+  SYLAR_ASSERT( ctx && ctx->isSocket() && ctx->getSysNonblock() && !ctx->getUserNonblock() );
+  SYLAR_ASSERT( fcntl_f( hooked->getSocket(), F_GETFL, 0 ) & O_NONBLOCK );
+  SYLAR_ASSERT( !( fcntl( hooked->getSocket(), F_GETFL, 0 ) & O_NONBLOCK ) );
+
+  // 调用方要求 SOCK_NONBLOCK 时记为用户非阻塞
+  int fd { accept4( listener->getSocket(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC ) };
+  SYLAR_ASSERT( fd >= 0 );
+  ctx = sylar::FdMgr::GetInstance().get( fd );
+  SYLAR_ASSERT( ctx && ctx->getSysNonblock() && ctx->getUserNonblock() );
+  SYLAR_ASSERT( fcntl( fd, F_GETFL, 0 ) & O_NONBLOCK );
+  close( fd );
+  sylar::set_hook_enable( false );
+
+  // 未开启 hook 的 accept4 不改变阻塞模式
+  fd = accept4( listener->getSocket(), nullptr, nullptr, SOCK_CLOEXEC );
+  SYLAR_ASSERT( fd >= 0 );
+  ctx = sylar::FdMgr::GetInstance().get( fd );
+  SYLAR_ASSERT( ctx && ctx->isSocket() && !ctx->getSysNonblock() && !ctx->getUserNonblock() );
+  SYLAR_ASSERT( !( fcntl_f( fd, F_GETFL, 0 ) & O_NONBLOCK ) );
+  sylar::FdMgr::GetInstance().del( fd );
+  close( fd );
+
+  errno = 0;
+  SYLAR_ASSERT( !listener->tryAccept() && errno == EAGAIN );
+  SYLAR_LOG_INFO( g_logger ) << "accept server=" << *server << " hooked=" << *hooked;
+}
+
+// 拷贝的小块、引用的正文和 ByteArray 依次排队，flush 与随后的 write 保持顺序
+void test_output_queue()
+{
+  sylar::Address::SPtr addr = sylar::Address::LookUpAnyIPAddress( "127.0.0.1:0" );
+  sylar::Socket::SPtr listener { sylar::Socket::CreateTCP( addr ) };
+  SYLAR_ASSERT( listener->bind( addr ) && listener->listen() );
+  auto [client, server] = connected_pair( listener );
+
+  sylar::SocketStream stream { server };
+  std::shared_ptr<std::string> body { std::make_shared<std::string>( "body;" ) };
+  sylar::ByteArray::SPtr ba { std::make_shared<sylar::ByteArray>() };
+  ba->writeStringWithoutLength( "bytearray;" );
+  ba->setPosition( 0 );
+  SYLAR_ASSERT( stream.queue( "head:", 5 ) == 5 && stream.queue( "1;", 2 ) == 2 );
+  SYLAR_ASSERT( stream.queue( body->data(), body->size(), body ) == 5 );
+  SYLAR_ASSERT( stream.queue( ba, ba->getReadSize() ) == 10 && ba->getReadSize() == 0 );
+  sylar::IOBuf buf;
+  buf.append( std::string { "xiobuf;x" } );
+  SYLAR_ASSERT( stream.queue( buf.slice( 1, 6 ) ) == 6 );
+  SYLAR_ASSERT( stream.getQueued() == 28 && stream.flush() == 28 && stream.getQueued() == 0 );
+  SYLAR_ASSERT( stream.queue( "tail", 4 ) == 4 && stream.write( "!", 1 ) == 1 && stream.getQueued() == 0 );
+
+  std::string expect { "head:1;body;bytearray;iobuf;tail!" };
+  std::string received( expect.size(), '\0' );
+  sylar::SocketStream client_stream { client };
+  SYLAR_ASSERT( client_stream.readFixSize( &received[0], received.size() ) > 0 );
+  SYLAR_LOG_INFO( g_logger ) << "output queue received=" << received;
+  SYLAR_ASSERT( received == expect );
+
+  // splice 搬运前先发出写入端的排队数据，close 先 flush 再关闭
+  auto [client2, server2] = connected_pair( listener );
+  sylar::SocketStream dst { server2 };
+  SYLAR_ASSERT( dst.queue( "pre;", 4 ) == 4 && client_stream.write( "fwd;", 4 ) == 4 );
+  SYLAR_ASSERT( stream.spliceTo( dst, 4 ) == 4 && dst.getQueued() == 0 );
+  int fds[2];
+  SYLAR_ASSERT( pipe( fds ) == 0 && write( fds[1], "spliced;", 8 ) == 8 );
+  SYLAR_ASSERT( dst.queue( "mid;", 4 ) == 4 && dst.spliceFrom( fds[0], nullptr, 8 ) == 8 && dst.getQueued() == 0 );
+  SYLAR_ASSERT( dst.queue( "post", 4 ) == 4 );
+  dst.close();
+  ::close( fds[0] );
+  ::close( fds[1] );
+
+  expect = "pre;fwd;mid;spliced;post";
+  received.assign( expect.size(), '\0' );
+  sylar::SocketStream client_stream2 { client2 };
+  SYLAR_ASSERT( client_stream2.readFixSize( &received[0], received.size() ) > 0 );
+  char c;
+  SYLAR_LOG_INFO( g_logger ) << "splice after queue received=" << received;
+  SYLAR_ASSERT( received == expect && client2->recv( &c, 1 ) == 0 );
+}
+
 int main()
 {
+  test_socket_profile();
+  {
+    sylar::IOManager iom { 1, true, "zerocopy" };
+    iom.schedule( &test_zerocopy );
+  }
+  {
+    sylar::IOManager iom { 1, true, "zerocopy_close" };
+    iom.schedule( &test_zerocopy_close );
+  }
+  {
+    sylar::IOManager iom { 1, false, "splice" };
+    iom.schedule( &test_splice );
+  }
+  test_accept();
+  test_output_queue();
   sylar::IOManager iom;
   iom.schedule( &test_socket );
   return 0;
@@ -1,12 +1,238 @@
 #include "sylar/address.h"
+#include "sylar/config.h"
 #include "sylar/iomanager.h"
 #include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/socket.h"
 #include "sylar/tcp_server.h"
+#include "sylar/thread.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <sstream>
 #include <unistd.h>
 #include <vector>
+#include <yaml-cpp/yaml.h>
 
 sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
 
+// 持有所有连接不关闭，用于观察连接数限制
+class HoldServer : public sylar::TcpServer
+{
+public:
+  using sylar::TcpServer::TcpServer;
+
+  void release()
+  {
+    sylar::Mutex::Lock lock( m_mutex );
+    m_clients.clear();
+  }
+
+protected:
+  void handleClient( sylar::Socket::SPtr client ) override
+  {
+    sylar::Mutex::Lock lock( m_mutex );
+    m_clients.push_back( client );
+  }
+
+private:
+  sylar::Mutex m_mutex;
+  std::vector<sylar::Socket::SPtr> m_clients;
+};
+
+// 记录每个 accept 协程开始和退出时所在的线程
+class ShardServer : public HoldServer
+{
+public:
+  using HoldServer::HoldServer;
+
+  std::vector<std::pair<int, int>> getAcceptThreads()
+  {
+    sylar::Mutex::Lock lock( m_mutex );
+    return m_acceptThreads;
+  }
+
+protected:
+  void startAccept( sylar::Socket::SPtr sock ) override
+  {
+    int start { sylar::GetThreadId() };
+    sylar::TcpServer::startAccept( sock );
+    sylar::Mutex::Lock lock( m_mutex );
+    m_acceptThreads.emplace_back( start, sylar::GetThreadId() );
+  }
+
+private:
+  sylar::Mutex m_mutex;
+  std::vector<std::pair<int, int>> m_acceptThreads;
+};
+
+// 轮询等待条件成立，超时返回 false
+static bool wait_for( const std::function<bool()>& cond, uint64_t timeout_ms = 2000 )
+{
+  uint64_t deadline { sylar::GetCurrentMS() + timeout_ms };
+  while ( !cond() ) {
+    if ( sylar::GetCurrentMS() >= deadline ) {
+      return false;
+    }
+    usleep( 1000 );
+  }
+  return true;
+}
+
+static std::vector<sylar::Socket::SPtr> connect_clients( sylar::Address::SPtr addr, int n )
+{
+  std::vector<sylar::Socket::SPtr> clients;
+  for ( int i = 0; i < n; ++i ) {
+    sylar::Socket::SPtr sock { sylar::Socket::CreateTCP( addr ) };
+    bool rt { sock->connect( addr ) };
+    SYLAR_ASSERT( rt );
+    clients.push_back( sock );
+  }
+  return clients;
+}
+
+static std::string dump( const sylar::TcpServer::SPtr& server )
+{
+  std::stringstream ss;
+  server->dumpConnections( ss );
+  return ss.str();
+}
+
+// 超过 max_connections 后：close 策略立即关闭新连接，pause 策略停止 accept，连接释放后恢复
+void test_connection_limit()
+{
+  sylar::IOManager iom { 2, false, "limit" };
+  sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8001" );
+  std::shared_ptr<HoldServer> server { std::make_shared<HoldServer>( &iom, &iom ) };
+  while ( !server->bind( addr ) ) {
+    sleep( 2 );
+  }
+  server->setMaxConnections( 4 );
+  server->setOverloadPolicy( sylar::TcpServer::CLOSE );
+  server->start();
+
+  auto clients = connect_clients( addr, 8 );
+  SYLAR_ASSERT( wait_for( [&]() {
+    return server->getConnectionCount() == 4 && server->getRejectedCount( sylar::TcpServer::SERVER_LIMIT ) == 4;
+  } ) );
+  SYLAR_LOG_INFO( g_logger ) << "close policy: " << dump( server );
+  clients.clear();
+  // 连接在 fd 关闭时扣减，释放持有的 Socket 后计数立即归零
+  server->release();
+  SYLAR_ASSERT( server->getConnectionCount() == 0 );
+
+  server->setOverloadPolicy( sylar::TcpServer::PAUSE );
+  clients = connect_clients( addr, 8 );
+  SYLAR_ASSERT( wait_for( [&]() { return server->getConnectionCount() == 4 && server->getPauseCount() > 0; } ) );
+  SYLAR_LOG_INFO( g_logger ) << "pause policy: " << dump( server );
+  // 释放后恢复 accept，积压在内核队列中的 4 个连接被接受
+  server->release();
+  SYLAR_ASSERT( wait_for( [&]() {
+    return server->getConnectionCount() == 4 && sylar::TcpServer::GetGlobalConnectionCount() == 4;
+  } ) );
+  SYLAR_LOG_INFO( g_logger ) << "after release: " << dump( server );
+  server->release();
+  server->stop();
+}
+
+// 积压多于批次上限时分批取完；批次上限大于积压和 backlog 时取到 EAGAIN 即停止，重新等待读事件
+void test_accept_batch()
+{
+  sylar::Config::LoadFromYaml( YAML::Load( R"(
+socket:
+  profiles:
+    small_backlog:
+      backlog: 4
+)" ) );
+  auto accept_batch = sylar::Config::Lookup<uint32_t>( "tcp_server.accept_batch" );
+  uint32_t old_batch { accept_batch->getValue() };
+  sylar::IOManager iom { 1, false, "batch" };
+  sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8002" );
+  std::shared_ptr<HoldServer> server { std::make_shared<HoldServer>( &iom, &iom ) };
+  server->setSocketProfile( "small_backlog" );
+  while ( !server->bind( addr ) ) {
+    sleep( 2 );
+  }
+
+  // 启动前积压 4 个连接，每批只取 2 个
+  accept_batch->setValue( 2 );
+  auto clients = connect_clients( addr, 4 );
+  server->start();
+  SYLAR_ASSERT( wait_for( [&]() { return server->getConnectionCount() == 4; } ) );
+
+  // 批次上限大于 backlog：取完后停在 EAGAIN 而不是阻塞，之后的连接照常被接受
+  accept_batch->setValue( 64 );
+  auto more = connect_clients( addr, 4 );
+  SYLAR_ASSERT( wait_for( [&]() { return server->getConnectionCount() == 8; } ) );
+
+  // 未 hook 的 usleep 占住唯一的 accept 线程，让连接同时积压，再一次唤醒全部取完
+  iom.schedule( []() { usleep( 200 * 1000 ); } );
+  usleep( 50 * 1000 );
+  auto burst = connect_clients( addr, 4 );
+  SYLAR_ASSERT( wait_for( [&]() { return server->getConnectionCount() == 12; } ) );
+  SYLAR_LOG_INFO( g_logger ) << "accept batch: " << dump( server );
+
+  accept_batch->setValue( old_batch );
+  server->release();
+  server->stop();
+}
+
+// reuseport 分片：每个监听 socket 的 accept 协程固定在分配给它的线程上，所有连接都被处理。
+// steal_backlog 为 1 时软亲和任务随时可被空闲线程取走，未固定的 accept 协程会在线程间漂移
+void test_reuseport_listeners()
+{
+  static const uint32_t s_shards { 2 };
+  static const int s_clients { 64 };
+  auto listeners = sylar::Config::Lookup<uint32_t>( "tcp_server.reuseport_listeners" );
+  auto steal_backlog = sylar::Config::Lookup<uint32_t>( "scheduler.affinity.steal_backlog" );
+  uint32_t old_listeners { listeners->getValue() };
+  uint32_t old_steal_backlog { steal_backlog->getValue() };
+  listeners->setValue( s_shards );
+  steal_backlog->setValue( 1 );
+
+  sylar::IOManager iom { 4, false, "reuseport" };
+  std::vector<int> tids { iom.getThreadIds() };
+  sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8006" );
+  std::shared_ptr<ShardServer> server { std::make_shared<ShardServer>( &iom, &iom ) };
+  SYLAR_ASSERT( server->getReusePortListeners() == s_shards );
+  while ( !server->bind( addr ) ) {
+    sleep( 2 );
+  }
+  server->start();
+
+  // 分批连接，accept 协程在批次之间挂起等待读事件
+  std::vector<sylar::Socket::SPtr> clients;
+  for ( int i = 0; i < 8; ++i ) {
+    auto batch = connect_clients( addr, s_clients / 8 );
+    clients.insert( clients.end(), batch.begin(), batch.end() );
+    SYLAR_ASSERT( wait_for( [&]() { return server->getConnectionCount() == clients.size(); } ) );
+    usleep( 5 * 1000 );
+  }
+  SYLAR_LOG_INFO( g_logger ) << "reuseport: " << dump( server );
+
+  // stop 取消监听 socket 上的读事件，accept 协程被唤醒后退出
+  server->stop();
+  SYLAR_ASSERT( wait_for( [&]() { return server->getAcceptThreads().size() == s_shards; } ) );
+  std::vector<int> started;
+  for ( auto& [start, exit] : server->getAcceptThreads() ) {
+    SYLAR_LOG_INFO( g_logger ) << "reuseport accept fiber started on " << start << " exited on " << exit;
+    SYLAR_ASSERT( start == exit );
+    started.push_back( start );
+  }
+  std::sort( started.begin(), started.end() );
+  std::vector<int> expected { tids.begin(), tids.begin() + s_shards };
+  std::sort( expected.begin(), expected.end() );
+  SYLAR_ASSERT( started == expected );
+
+  listeners->setValue( old_listeners );
+  steal_backlog->setValue( old_steal_backlog );
+  clients.clear();
+  server->release();
+}
+
 void run()
 {
   sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8000" );
@@ -23,7 +249,11 @@ void run()
 
 int main()
 {
+  test_connection_limit();
+  test_accept_batch();
+  test_reuseport_listeners();
+
   sylar::IOManager iom { 2 };
   iom.schedule( run );
   return 0;
-}
\ No newline at end of file
+}
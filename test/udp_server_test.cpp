@@ -0,0 +1,140 @@
+#include "sylar/address.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/macro.h"
+#include "sylar/thread.h"
+#include "sylar/udp_server.h"
+#include "sylar/util.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+static sylar::Logger::SPtr g_logger = SYLAR_LOG_ROOT();
+
+// 统计收到的数据报，echo 为 true 时整批原样发回
+class CountServer : public sylar::UdpServer
+{
+public:
+  CountServer( sylar::IOManager* worker, bool echo )
+    : sylar::UdpServer( worker ), m_echo { echo }
+  {}
+
+  std::atomic<uint64_t> received { 0 };
+
+protected:
+  void handleBatch( sylar::Socket::SPtr sock, Packet* packets, std::size_t count ) override
+  {
+    received += count;
+    if ( m_echo ) {
+      sendBatch( sock, packets, count );
+    }
+  }
+
+private:
+  bool m_echo;
+};
+
+static std::string dump( const sylar::UdpServer::SPtr& server )
+{
+  std::stringstream ss;
+  server->dump( ss );
+  return ss.str();
+}
+
+// 回环上发出若干数据报，服务器批量回显
+void test_echo()
+{
+  sylar::IOManager iom { 1, false, "udp_echo" };
+  sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8002" );
+  std::shared_ptr<CountServer> server { std::make_shared<CountServer>( &iom, true ) };
+  SYLAR_ASSERT( server->bind( addr ) );
+  server->start();
+
+  sylar::Socket::SPtr client { sylar::Socket::CreateUDP( addr ) };
+  SYLAR_ASSERT( client->connect( addr ) );
+  // connect 时才创建 fd，超时要在其后设置
+  client->setRecvTimeout( 1000 );
+  for ( int i = 0; i < 16; ++i ) {
+    std::string msg { "ping " + std::to_string( i ) };
+    SYLAR_ASSERT( client->send( msg.data(), msg.size() ) == (int)msg.size() );
+  }
+  int echoed { 0 };
+  char buf[64];
+  while ( echoed < 16 && client->recv( buf, sizeof( buf ) ) > 0 ) {
+    ++echoed;
+  }
+  SYLAR_LOG_INFO( g_logger ) << "echoed=" << echoed << " " << dump( server );
+  SYLAR_ASSERT( echoed == 16 && server->getRecvPackets() == 16 );
+  server->stop();
+}
+
+// 多个发送线程用 sendmmsg 压满两个 reuseport socket，统计服务器每秒收到的数据报数
+void bench_pps()
+{
+  static const int s_seconds { 2 };
+  static const int s_senders { 2 };
+  static const int s_payload { 64 };
+
+  sylar::IOManager iom { 2, false, "udp_bench" };
+  sylar::Address::SPtr addr = sylar::Address::LoopUpAny( "127.0.0.1:8003" );
+  std::shared_ptr<CountServer> server { std::make_shared<CountServer>( &iom, false ) };
+  server->setReusePortSockets( 2 );
+  SYLAR_ASSERT( server->bind( addr ) );
+  server->start();
+
+  std::atomic<bool> running { true };
+  std::atomic<uint64_t> sent { 0 };
+  std::vector<sylar::Thread::SPtr> senders;
+  for ( int i = 0; i < s_senders; ++i ) {
+    senders.push_back( std::make_shared<sylar::Thread>(
+      [&]() {
+        sylar::Socket::SPtr sock { sylar::Socket::CreateUDP( addr ) };
+        sock->connect( addr );
+        char payload[s_payload] {};
+        mmsghdr msgs[64];
+        iovec iov { payload, sizeof( payload ) };
+        std::memset( msgs, 0, sizeof( msgs ) );
+        for ( mmsghdr& msg : msgs ) {
+          msg.msg_hdr.msg_iov = &iov;
+          msg.msg_hdr.msg_iovlen = 1;
+        }
+        while ( running ) {
+          int n = sendmmsg( sock->getSocket(), msgs, 64, 0 );
+          if ( n > 0 ) {
+            sent += n;
+          }
+        }
+      },
+      "udp_sender_" + std::to_string( i ) ) );
+  }
+
+  uint64_t start_us { sylar::GetCurrentUS() };
+  uint64_t start_received { server->received };
+  sleep( s_seconds );
+  uint64_t elapsed_us { sylar::GetCurrentUS() - start_us };
+  uint64_t received { server->received - start_received };
+  running = false;
+  for ( auto& sender : senders ) {
+    sender->join();
+  }
+
+  uint64_t avg_batch { server->getRecvPackets() / std::max<uint64_t>( server->getRecvBatches(), 1 ) };
+  SYLAR_LOG_INFO( g_logger ) << "udp loopback bench: payload=" << s_payload << " sent=" << sent
+                             << " received=" << received << " pps=" << received * 1000000 / elapsed_us
+                             << " avg_batch=" << avg_batch << " " << dump( server );
+  server->stop();
+}
+
+int main()
+{
+  test_echo();
+  bench_pps();
+  return 0;
+}